@@ -26,6 +26,51 @@ extern "C" {
 	/// @returns Nothing.
 	void fxCleanup();
 
+	/// \brief Size the memory pools the library allocates frames, devices and device data from.
+	/// Call this before fxSetup(), which otherwise sets up pools for 1024 queued frames and 16 devices.
+	/// Once the pools are large enough, streaming doesn't allocate from the heap.
+	/// @param messageBlocks is the number of outgoing frames that can be queued at once, over all ports
+	/// @param maxDevices is the number of devices that can be connected at once
+	/// @param countingMode if true, a message is printed the first time a pool has to use the heap
+	/// @returns 1 if the pools were sized, 0 if some are in use and kept their size.
+	uint8_t fxSetMemoryPools(uint32_t messageBlocks, uint32_t maxDevices, bool countingMode);
+
+	/// \brief Get the number of allocations the memory pools had to serve from the heap.
+	/// This stays constant while streaming if the pools are large enough.
+	/// @returns the number of heap allocations made by the pools since they were set up.
+	uint64_t fxGetHeapFallbacks();
+
+	/// \brief Stream from simulated devices and count the heap allocations made once streaming
+	/// has reached its steady state (TX scheduling, receive and parsing of packed frames, logging,
+	/// and reads with fxReadDevice and fxReadDeviceEx).
+	/// Allocations are only seen if the library was built with the FX_ALLOC_CHECK option,
+	/// the call stacks of the first ones are printed.
+	/// The simulated devices are on a manager of their own, the other functions of this API don't see them.
+	/// Allocations are counted on every thread, so the check refuses to run between fxSetup and fxCleanup.
+	/// @param numDevices is the number of simulated devices
+	/// @param freq is the streaming frequency
+	/// @param durationMs is how long the steady state is checked, after a 500 ms warmup
+	/// @returns the number of allocations (0 passes), or -1 if the check isn't available in this build,
+	/// was called after fxSetup, or no data was received.
+	int64_t fxRunAllocationCheck(int numDevices, int freq, int durationMs);
+
+	/// \brief Set which diagnostic messages the library prints.
+	/// Messages are queued without blocking and written out by a background thread.
+	/// @param level is 0 for none, 1 errors, 2 warnings, 3 info (the default), 4 debug
+	/// @returns Nothing.
+	void fxSetDiagLevel(int level);
+
+	/// \brief Write diagnostic messages to a file rather than stdout.
+	/// @param path is the file to append messages to, NULL for stdout
+	/// @returns 1 on success, 0 if the file couldn't be opened.
+	uint8_t fxSetDiagOutput(const char* path);
+
+	/// \brief Hand diagnostic messages to a function rather than writing them out.
+	/// @param callback is called from the library's diagnostic thread with the level and text
+	/// of each message, NULL to write them out again
+	/// @returns Nothing.
+	void fxSetDiagCallback(void (*callback)(int level, const char* message));
+
 	/// \brief Open a serial port to communicate with a FlexSEA device.
 	/// @param portName is the name of the port to open (e.g. "COM3")
 	/// @param portIdx is a user defined "handle" that refers to this port.
@@ -42,6 +87,45 @@ extern "C" {
 	/// @returns Nothing.
 	void fxClose(uint16_t portIdx);
 
+	/// \brief Automatically open ports as matching USB devices are plugged in, and close them
+	/// when they are unplugged. A port that drops out is reopened as soon as it is back.
+	/// Devices get the same port index (and so the same device ids) when they reconnect.
+	/// @param vid is the USB vendor id to match, 0 for any
+	/// @param pid is the USB product id to match, 0 for any
+	/// @param serialNumber is the USB serial number to match, NULL for any
+	/// @returns 1 if auto connect started, 0 otherwise (e.g. it is already running).
+	/// @note Ports opened with fxOpen() are left alone.
+	uint8_t fxStartAutoConnect(int vid, int pid, const char* serialNumber);
+
+	/// \brief Stop opening and closing ports automatically. Open ports stay open.
+	/// @returns Nothing.
+	void fxStopAutoConnect();
+
+	/// \brief Enable or disable automatic recovery from link loss. When a port fails
+	/// (e.g. a USB brownout), the port is reopened and, once its devices answer again, their
+	/// stream variables, streams and control settings are restored. Device ids don't change.
+	/// @param enable is 1 to enable recovery, 0 to close failed ports for good (the default)
+	/// @param timeoutMs is how long to keep trying to reopen a failed port
+	/// @returns Nothing.
+	void fxSetLinkRecovery(uint8_t enable, int timeoutMs);
+
+	/// \brief Get the downtime of the latest link loss recovered on a port.
+	/// @param portIdx is the "handle" supplied in fxOpen()
+	/// @returns the time in ms from the loss to all devices being restored, -1 if none yet.
+	int fxGetLastDowntime(int portIdx);
+
+	/// \brief Get how long device discovery took on a port.
+	/// @param portIdx is the "handle" supplied in fxOpen()
+	/// @returns the time in ms from fxOpen() to the first metadata received from a device
+	/// on that port, or -1 if no device has answered yet.
+	int fxGetDiscoveryTime(int portIdx);
+
+	/// \brief Get how many times the receive buffer of a port had to be resynchronized
+	/// because it filled up with corrupt data.
+	/// @param portIdx is the "handle" supplied in fxOpen()
+	/// @returns the number of resyncs since the library was set up.
+	uint32_t fxGetResyncCount(int portIdx);
+
 	// ------------------------------------------
 	// Stream configuration and reading functions
 	// ------------------------------------------
@@ -67,6 +151,13 @@ extern "C" {
 	/// @returns Returns 0 on error 1 otherwise.
 	uint8_t fxSetStreamVariables(int devId, int* fieldIds, int n);
 
+	/// \brief Stream only the variables that are actually read. When enabled, a device streams
+	/// the variables given to fxSetStreamVariables plus any variable read with fxReadDevice or fxReadDeviceEx
+	/// (added automatically the first time it is read) or used by a merged stream.
+	/// @param enable is 1 to enable, 0 to disable (the default)
+	/// @returns Nothing.
+	void fxSetBitmapMinimizer(uint8_t enable);
+
 	/// \brief Start streaming data from a FlexSEA device.
 	/// @param devId is the opaque handle for the device.
 	/// @param frequency This is the frequency of updates. This value is in Hz and can be
@@ -93,6 +184,30 @@ extern "C" {
 	/// @returns 0 on success. Otherwise returns 1.
 	uint8_t fxStopStreaming(int devId);
 
+	/// \brief Get the measured health of a device's stream.
+	/// @param devId is the opaque handle for the device.
+	/// @param measuredHz is written with the rate at which data is actually received, in Hz
+	/// @param jitterUs is written with the standard deviation of the time between received samples, in us
+	/// @returns 1 if the device is streaming and has been measured, 0 otherwise.
+	/// @note Autostreams running below half their requested rate are started again, then replaced by
+	/// polled streaming. Measurements are updated every second.
+	uint8_t fxGetStreamHealth(int devId, float* measuredHz, float* jitterUs);
+
+	/// \brief Select what happens to streams a port can't carry. The load of a stream is predicted
+	/// from its frequency and the size of the device's active variables.
+	/// @param policy 0: start them anyway (default), 1: refuse them, 2: start them at a lower
+	/// frequency that fits, 3: start them and decimate every stream of the port until they fit
+	/// @param maxUtilization is the fraction of the port's capacity streams may use (e.g. 0.9)
+	/// @returns Nothing.
+	void fxSetRatePolicy(int policy, float maxUtilization);
+
+	/// \brief Get the load of a port, as a fraction of its capacity (115200 baud).
+	/// @param portIdx is the "handle" supplied in fxOpen()
+	/// @param predicted is written with the load predicted from the active streams
+	/// @param measured is written with the load received over the last second
+	/// @returns 1 on success, 0 for an invalid port.
+	uint8_t fxGetPortUtilization(int portIdx, float* predicted, float* measured);
+
 	/// \brief a utility function to access the most recent values received from a FlexSEA device.
 	/// @param devId is the opaque handle for the device.
 	/// @param fieldIds Specify the field ids of variables to read. These must have been requested
@@ -195,6 +310,48 @@ extern "C" {
 	/// @returns Nothing.
 	void findPoles(int devId, int block);
 
+	// ------------------
+	// Telemetry functions
+	// ------------------
+
+	/// \brief Start publishing all received data on a Unix domain socket, so other processes
+	/// can read it live without opening the serial ports (Linux only).
+	/// @param socketPath is the path where the socket is created.
+	/// @returns 1 if publishing started, 0 otherwise.
+	/// @note The stream format is described in fxtelemetry.h and fxlogformat.h
+	uint8_t fxStartTelemetry(const char* socketPath);
+
+	/// \brief Stop publishing data and remove the socket.
+	/// @returns Nothing.
+	void fxStopTelemetry();
+
+	/// \brief Start mirroring all received data into named POSIX shared memory, so other processes
+	/// can read the latest samples and history while this one owns the ports (Linux only).
+	/// @param prefix names the segments: "/prefix" lists the devices, "/prefix_<devId>" holds a device's ring.
+	/// @returns 1 if the export started, 0 otherwise.
+	/// @note Readers use fxshmring.h, which has no other dependency on this library.
+	uint8_t fxStartSharedMemoryExport(const char* prefix);
+
+	/// \brief Stop the shared memory export and remove the segments.
+	/// @returns Nothing.
+	void fxStopSharedMemoryExport();
+
+	// ------------------
+	// Log file functions
+	// ------------------
+
+	/// \brief Validates a block log file (see fxlogformat.h) and truncates it after its last
+	/// valid block, e.g. after the program was killed while logging.
+	/// @param path is the path to the log file.
+	/// @returns the number of valid bytes kept, or -1 if the file is not a block log or can't be truncated.
+	int64_t fxRecoverLogFile(const char* path);
+
+	/// \brief Converts the valid part of a block log file to a CSV file.
+	/// @param inPath is the path to the block log file.
+	/// @param outPath is the path of the CSV file to write.
+	/// @returns 1 on success, 0 otherwise.
+	uint8_t fxLogFileToCsv(const char* inPath, const char* outPath);
+
 	/// \brief Return the revision information for the library as a string
 	/// @param None.
 	/// @returns a string that includes build date and time and 'GIT describe information'
@@ -2,6 +2,7 @@
 #define STREAMMANAGER_H
 
 #include <ctime>
+#include <cstring>
 #include <memory>
 #include <queue>
 #include <mutex>
@@ -9,18 +10,48 @@
 #include <vector>
 #include <string>
 #include <functional>
+#include <chrono>
+#include <unordered_map>
 
 #include "flexseaserial.h"
 #include "periodictask.h"
 #include "flexsea_sys_def.h"
 #include "comm_string_generation.h"
 #include "datalogger.h"
+#include "fxmergedstream.h"
+#include "fxtelemetry.h"
+#include "fxshmexporter.h"
+#include "fxcommand.h"
+#include "fxhotplug.h"
+#include "fxstreamhealth.h"
+#include "fxlinkbudget.h"
+#include "fxfieldinterest.h"
+#include "fxmempool.h"
+#include "fxdiag.h"
 
 struct MultiWrapper_struct;
 typedef MultiWrapper_struct MultiWrapper;
 typedef std::function<void(uint8_t*, uint8_t*, uint8_t*, uint16_t*)> StreamFunc;
 static std::mutex mtOGBuffer;
 
+/// \brief link loss recovery statistics for a port
+struct FxLinkStats {
+    uint32_t linkLosses;
+    /// losses after which every device came back
+    uint32_t recoveries;
+    /// losses given up on after the recovery timeout
+    uint32_t failedRecoveries;
+    /// ms from the loss to the last device being restored, for the latest recovery (-1 if none yet)
+    int lastDowntimeMs;
+    int64_t totalDowntimeMs;
+    bool recovering;
+};
+
+/// \brief called once a device's configuration has been replayed after a link loss
+/// lets the owner restore state the CommManager doesn't know about (ie: controller set points)
+/// runs on the event notifier's thread (as a FX_EVENT_LINK_RESTORED subscriber), never on the comm thread
+typedef std::function<void(int devId)> FxRecoveryHook;
+
 class CommManager : public FlexseaSerial
 {
 
@@ -60,6 +91,12 @@ public:
     int writeDeviceMap(int devId, const std::vector<int> &fields);
     int writeDeviceMap(int devId, uint32_t* map);
 
+    /// \brief non blocking versions of writeDeviceMap
+    /// the handle completes with FX_CMD_CONFIRMED once the device reports the requested map in its metadata,
+    /// or FX_CMD_TIMEOUT if that doesn't happen within timeoutMs. Many devices can be configured in parallel
+    FxCommandHandle writeDeviceMapAsync(int devId, const std::vector<int> &fields, int timeoutMs = 1000);
+    FxCommandHandle writeDeviceMapAsync(int devId, uint32_t* map, int timeoutMs = 1000);
+
     /// \brief overloaded to manage streams and connected devices
     virtual void close(uint16_t portIdx);
 
@@ -69,13 +106,80 @@ public:
     bool setLogFolder(std::string logFolderPath);
     bool setDefaultLogFolder();
 
+    /// \brief sets format, compression, disk backend and rotation of log files, see DataLogger
+    bool setLogFormat(FxLogFormat f);
+    bool setLogCompression(FxLogCompression c);
+    bool setLogBackend(FxLogBackend b, size_t segmentSize = 0);
+    void setLogRotation(const FxLogRotation &r);
+
+    /// \brief starts merging the given device fields into a single time aligned stream
+    /// rows are emitted every periodUs, see FxMergedStream for details
+    /// @param shouldLog if true, merged rows are also logged to a single file in the session folder
+    bool startMergedStream(const std::vector<FxMergedColumn> &columns, int periodUs,
+                           FxMergePolicy policy=FX_MERGE_LATEST, bool shouldLog=false);
+    void stopMergedStream();
+
+    /// \brief access to the merged stream's rows (see FxMergedStream::getRows)
+    const FxMergedStream& getMergedStream() const { return *mergedStream; }
+
+    /// \brief starts publishing received data to other processes on a Unix domain socket
+    /// see FxTelemetryPublisher for the protocol
+    bool startTelemetry(const std::string &socketPath, unsigned int periodMs = 5);
+    void stopTelemetry();
+
+    /// \brief starts mirroring every device's data into named shared memory, for other processes to read
+    /// see fxshmring.h for the layout and the reader
+    bool startSharedMemoryExport(const std::string &prefix, uint32_t numSlots = FX_SHM_DEFAULT_SLOTS);
+    void stopSharedMemoryExport();
+
+    /// \brief opens (and reopens) ports automatically when USB serial devices matching one of the rules are plugged in
+    /// ports opened this way are closed when their device is unplugged. See FxHotplugWatcher
+    bool startAutoConnect(const std::vector<FxHotplugRule> &rules);
+    void stopAutoConnect();
+
+    /// \brief enables link loss recovery
+    /// When a port fails, the field maps and streams of its devices are remembered, the port is reopened
+    /// until its devices come back (for at most timeoutMs) and their configuration is replayed.
+    /// Devices keep their ids. FX_EVENT_LINK_LOST / FX_EVENT_LINK_RESTORED are posted for each device
+    void setLinkRecovery(bool enable, int timeoutMs = 10000);
+    void setRecoveryHook(const FxRecoveryHook &hook);
+    FxLinkStats getLinkStats(int portIdx) const;
+
+    /// \brief sets how autostreams running below their requested rate are handled
+    /// they are re-sent, then replaced by polled sysdata reads. A minRateRatio of 0 only measures
+    void setStreamHealthPolicy(const FxStreamHealthPolicy &policy);
+    /// \brief measured rate and jitter of every stream, updated once per measurement window
+    std::vector<FxStreamHealth> getStreamHealth() const;
+
+    /// \brief sets what happens to streams a port can't carry, see FxRatePolicy
+    /// @param maxUtilization fraction of the port's capacity streams may use
+    void setRateControl(FxRatePolicy policy, float maxUtilization = 0.9f);
+    /// \brief bytes per second the port carries in each direction (FX_DEFAULT_PORT_CAPACITY by default)
+    void setPortCapacity(int portIdx, uint32_t bytesPerSecond);
+    FxPortUtilization getPortUtilization(int portIdx) const;
+
+    /// \brief bitmap minimizer: when enabled, each device streams only the fields someone reads
+    /// A device's map is the union of the fields registered with addFieldInterest, the merged stream's
+    /// columns, fields widened on demand, and the fields last given to writeDeviceMap (which then
+    /// only declares the user's own interest). It is rewritten whenever that union changes.
+    /// Devices nobody declared an interest in keep their current map
+    void setBitmapMinimizer(bool enable);
+    bool isBitmapMinimizerOn() const { return minimizeBitmaps; }
+    /// \brief declares the fields a consumer reads from a device, returns a handle for removeFieldInterest
+    int addFieldInterest(int devId, const std::vector<int> &fields);
+    void removeFieldInterest(int handle);
+    /// \brief makes sure the n fields are streamed from the device from now on (minimizer only)
+    /// @returns true if the device's map had to be widened
+    bool widenFieldMap(int devId, const int *fields, size_t n);
+
     /// \brief adds a message to a queue of messages to be written to the port periodically
     template<typename T, typename... Args>
     bool enqueueCommand(int devId, T tx_func, Args&&... tx_args)
     {
-        if(connectedDevices.find(devId) != connectedDevices.end())
+        FxDevicePtr d = getDevicePtr(devId);
+        if(d)
         {
-            return enqueueCommand(connectedDevices.at(devId), tx_func, std::forward<Args>(tx_args)...);
+            return enqueueCommand(d, tx_func, std::forward<Args>(tx_args)...);
         }
         else
         {
@@ -83,20 +187,58 @@ public:
         }
     }
 
+    /// \brief non blocking version of enqueueCommand
+    /// the handle completes with FX_CMD_SENT once the command has been written to the port,
+    /// or FX_CMD_TIMEOUT if it is still queued after timeoutMs
+    template<typename T, typename... Args>
+    FxCommandHandle submitCommand(int devId, int timeoutMs, T tx_func, Args&&... tx_args)
+    {
+        FxDevicePtr d = getDevicePtr(devId);
+        if(!d) return FxCommandHandle();
+
+        FxCommandStatePtr cmd = newCommand(devId, false, timeoutMs);
+        if(!enqueueCommand(d, cmd, tx_func, std::forward<Args>(tx_args)...))
+        {
+            cmd->resolve(FX_CMD_FAILED);
+            return FxCommandHandle();
+        }
+
+        trackCommand(cmd);
+        return FxCommandHandle(cmd);
+    }
+
 protected:
     virtual void periodicTask();
     virtual bool wakeFromLongSleep();
     virtual bool goToLongSleep();
 
-    virtual int writeDeviceMap(const FxDevicePtr d, uint32_t* map);
+    /// \brief completion, if not null, is resolved as the command is sent (and confirmed)
+    virtual int writeDeviceMap(const FxDevicePtr d, uint32_t* map, const FxCommandStatePtr &completion = FxCommandStatePtr());
     int enqueueMultiPacket(int devId, MultiWrapper *out);
-    int enqueueMultiPacket(int devId, int port, MultiWrapper *out);
+    int enqueueMultiPacket(int devId, int port, MultiWrapper *out, const FxCommandStatePtr &completion = FxCommandStatePtr());
+
+    /// \brief confirms pending writeDeviceMap commands whose map the device now reports,
+    /// restores devices that come back after a link loss
+    virtual void deviceMetadataReceived(int devId);
+
+    /// \brief remembers the port's device configuration before closing it, if link recovery is on
+    virtual void portLost(uint16_t portIdx);
+
+    FxCommandStatePtr newCommand(int devId, bool awaitConfirmation, int timeoutMs) const;
+    /// \brief keeps track of cmd until it is final, so it times out if nothing else completes it
+    void trackCommand(const FxCommandStatePtr &cmd);
 
     virtual void serviceStreams(uint8_t milliseconds);
     uint8_t serviceCount = 0;
 
     template<typename T, typename... Args>
     bool enqueueCommand(const FxDevicePtr d, T tx_func, Args&&... tx_args)
+    {
+        return enqueueCommand(d, FxCommandStatePtr(), tx_func, std::forward<Args>(tx_args)...);
+    }
+
+    template<typename T, typename... Args>
+    bool enqueueCommand(const FxDevicePtr d, const FxCommandStatePtr &completion, T tx_func, Args&&... tx_args)
     {
         if(!d->isValid()) return false;
         MultiWrapper *out = &(portPeriphs[d->port].out);
@@ -110,7 +252,7 @@ protected:
             return false;
         }
 
-        return !enqueueMultiPacket(d->id, d->port, out);
+        return !enqueueMultiPacket(d->id, d->port, out, completion);
     }
 
     /// \brief adds a message to a queue of messages to be written to the port periodically
@@ -123,11 +265,14 @@ private:
     struct StreamRcd;
     typedef std::vector<StreamRcd> StreamList;
 
-    std::queue<Message> outgoingBuffer[FX_NUMPORTS];
+    FxRingQueue<Message> outgoingBuffer[FX_NUMPORTS];
     const unsigned int MAX_Q_SIZE = 200;
 
     StreamList autoStreamLists[NUM_TIMER_FREQS];
     StreamList streamLists[NUM_TIMER_FREQS];
+    // guards both stream lists and their records, changed by the API and by the comm thread (health fallbacks)
+    // recursive since the functions holding it call each other (ie: startStreaming -> admitStream -> predictLoad)
+    mutable std::recursive_mutex streamMutex;
 
     int getIndexOfFrequency(int freq);
 
@@ -136,6 +281,82 @@ private:
     float msSinceLast[NUM_TIMER_FREQS] = {0};
 
     void sendCommands(int index);
+    void serviceCommands();
+    void dropOldestMessage(int port, std::vector<FxCommandStatePtr> &dropped);
+
+    // commands submitted through the async API that aren't final yet
+    std::mutex commandMutex;
+    std::vector<FxCommandStatePtr> trackedCommands;
+
+    // link loss recovery, see setLinkRecovery
+    struct SavedStream {
+        int freq;
+        int cmdCode;
+        bool shouldLog;
+        bool isAuto;
+        StreamFunc func;        // empty unless the stream was started with a custom function
+    };
+    struct SavedDevice {
+        int devId;
+        uint32_t bitmap[FX_BITMAP_WIDTH];
+        std::vector<SavedStream> streams;
+        bool restored;
+    };
+    struct LinkRecovery {
+        int portIdx;
+        std::string portName;
+        std::chrono::steady_clock::time_point lostAt, nextAttempt;
+        std::vector<SavedDevice> devices;
+    };
+
+    void serviceRecoveries();
+    void restoreDevice(const SavedDevice &saved);
+
+    mutable std::mutex recoveryMutex;
+    bool linkRecoveryEnabled;
+    int recoveryTimeoutMs;
+    int recoveryHookHandle;
+    std::vector<LinkRecovery> recoveries;
+    /// devices that came back, restored by serviceRecoveries rather than from the packet handler
+    std::vector<SavedDevice> pendingRestores;
+    FxLinkStats linkStats[FX_NUMPORTS];
+
+    // stream health monitoring, see setStreamHealthPolicy
+    struct DeviceHealth {
+        FxRateMeter meter;
+        float rateHz = 0;
+        float jitterUs = 0;
+    };
+    void serviceStreamHealth();
+    void fallBackToPolling(int devId, int cmdCode);
+
+    std::unordered_map<int, DeviceHealth> deviceHealth;    // comm thread only
+    mutable std::mutex healthMutex;
+    FxStreamHealthPolicy healthPolicy;
+    std::vector<FxStreamHealth> healthReport;
+    // reused by serviceStreamHealth, so a pass doesn't allocate once they have grown
+    std::vector<std::pair<int, bool>> healthStreamed;   // devId, whether its window just completed
+    std::vector<std::pair<int, int>> healthFallbacks;
+    std::vector<FxStreamHealth> healthScratch;
+
+    // rate control, see setRateControl
+    /// bytes per second received from the port's streams, raw ignores decimation
+    float predictLoad(int portIdx, bool raw, int extraDevId = -1, int extraFreq = 0) const;
+    /// returns the frequency the new stream may use, -1 if it must be rejected
+    int admitStream(int devId, int freq);
+    void rebalancePort(int portIdx);
+    void serviceUtilization();
+
+    mutable std::mutex rateMutex;
+    FxRatePolicy ratePolicy;
+    float maxUtilization;
+    uint32_t portCapacity[FX_NUMPORTS];
+    int portDecimation[FX_NUMPORTS];
+    FxPortUtilization portUtil[FX_NUMPORTS];
+    std::atomic<uint64_t> portTxBytes[FX_NUMPORTS];
+    uint64_t lastRxBytes[FX_NUMPORTS], lastTxBytes[FX_NUMPORTS];
+    std::chrono::steady_clock::time_point lastUtilUpdate;
+
     void sendAutoStream(int devId, int cmd, int period, bool start);
     void sendSysDataRead(int slaveId);
 
@@ -143,34 +364,65 @@ private:
     static const int CMD_CODE_BASE = 256;
 
     DataLogger *dataLogger;
+    FxMergedStream *mergedStream;
+    FxTelemetryPublisher *telemetry;
+    FxShmExporter *shmExporter;
+    FxHotplugWatcher *hotplug;
+
+    // bitmap minimizer, see setBitmapMinimizer
+    void applyFieldInterests(int devId);
+    void fieldsToMap(const FxDevicePtr &d, const int *fields, size_t n, uint32_t *map) const;
+
+    std::atomic<bool> minimizeBitmaps;
+    FxFieldInterests fieldInterests;
+    std::mutex minimizerMutex;
+    /// per device interest handles of the user's writeDeviceMap calls and of on demand widening
+    std::unordered_map<int, int> userInterests, readerInterests;
+    std::vector<int> mergedStreamInterests;
+    struct SentMap {
+        uint32_t map[FX_BITMAP_WIDTH] = {0};
+        std::chrono::steady_clock::time_point at;
+    };
+    std::unordered_map<int, SentMap> sentMaps;
 };
 
 class CommManager::Message {
 public:
-    static void do_delete(uint8_t buf[]) { delete[] buf; }
+    Message() : numBytes(0), dataPacket(nullptr, FxPoolDeleter{&FxMemoryPools::instance().messages}) {}
 
+    /// the frame is copied into a block of the messages pool
     Message(uint8_t nb, uint8_t* data):
     numBytes(nb)
-    , dataPacket(std::shared_ptr<uint8_t>(new uint8_t[nb], do_delete))
+    , dataPacket((uint8_t*)FxMemoryPools::instance().messages.acquire(nb), FxPoolDeleter{&FxMemoryPools::instance().messages})
     {
-        uint8_t* temp = dataPacket.get();
-        for(int i = 0; i < numBytes; i++)
-            temp[i] = data[i];
+        memcpy(dataPacket.get(), data, nb);
     }
 
     uint8_t numBytes;
-    std::shared_ptr<uint8_t> dataPacket;
+    std::unique_ptr<uint8_t, FxPoolDeleter> dataPacket;
+    /// set on the last frame of an asynchronously submitted command
+    FxCommandStatePtr completion;
 };
 
 struct CommManager::StreamRcd {
 
-    StreamRcd(int id=-1, int cc=-1, bool sl=false, StreamFunc* fc=nullptr) : devId(id), cmdCode(cc), shouldLog(sl), func(fc) {}
+    StreamRcd(int id=-1, int cc=-1, bool sl=false, StreamFunc* fc=nullptr) : devId(id), cmdCode(cc), shouldLog(sl), func(fc),
+        resends(0), healthWindows(0), polledFallback(false), decimation(1), decimCount(0) {}
 
     int devId;
     int cmdCode;
     bool shouldLog;
     StreamFunc* func;
 
+    // health monitoring
+    uint32_t resends;
+    int healthWindows;
+    bool polledFallback;
+
+    // rate control: only 1 sample out of decimation is requested
+    int decimation;
+    int decimCount;
+
 };
 
 
@@ -4,23 +4,38 @@
 #include <vector>
 #include <fstream>
 #include <mutex>
+#include <chrono>
 
 #include "periodictask.h"
 #include "flexseadeviceprovider.h"
+#include "fxlogwriter.h"
+#include "fxlogformat.h"
 
 #define MAX_LOG_SIZE 50000
 #define DEFAULT_LOG_FOLDER "Plan-GUI-Logs"
 #define LOG_FOLDER_CONFIG_FILE "logFolderConfigFile.txt"
 
+/// \brief when to close a log file and continue in a new one; a limit of 0 disables it
+struct FxLogRotation {
+    /// number of data lines
+    unsigned int maxLines;
+    /// bytes of CSV text, before compression
+    uint64_t maxBytes;
+    /// time since the file was opened
+    unsigned int maxSeconds;
+};
+
 /// \brief class which manages creating log files
 /// reads data from FlexseaDevices provided by a FlexseaDeviceProvider
 /// employs a polling method therefore the owner MUST either
 ///  - trigger polls by calling serviceLogs, or
 ///  - run DataLogger on a thread using the PeriodicTask pattern
+/// polling only formats rows; compressing and writing them to disk happens on an FxAsyncLogWriter's thread
 class DataLogger : public PeriodicTask
 {
 public:
     DataLogger(FlexseaDeviceProvider* fdp);
+    virtual ~DataLogger();
 
     /// \brief starts logging all data received by device with id=devId
     bool startLogging(int devId, bool logAdditionalColumnsInit = false);
@@ -38,6 +53,39 @@ public:
     bool setDefaultLogFolder();
 	bool createSessionFolder(std::string session_name);
 
+    /// \brief returns a path in the session folder for a merged (multi device) log
+    std::string generateMergedFileName();
+
+    /// \brief sets the compression used for log files opened from now on
+    /// returns false if the compression is not available in this build, or the format is FX_LOG_BLOCKS
+    bool setCompression(FxLogCompression c);
+    FxLogCompression getCompression() const { return sinkConfig.compression; }
+
+    /// \brief sets the format of log files opened from now on
+    /// FX_LOG_BLOCKS files survive crashes (see fxRecoverLog) and record field changes in-band
+    /// returns false for FX_LOG_BLOCKS while compression is on, since compressed block logs can't be recovered
+    bool setFormat(FxLogFormat f);
+    FxLogFormat getFormat() const { return format; }
+
+    /// \brief sets how log files opened from now on are written to disk
+    /// @param segmentSize for FX_LOG_MMAP, the size of the preallocated segments (0 keeps the current size)
+    /// returns false if the backend is not available on this platform
+    bool setBackend(FxLogBackend b, size_t segmentSize = 0);
+    FxLogBackend getBackend() const { return sinkConfig.backend; }
+
+    /// \brief sets when log files are rotated, applies to all current logs
+    void setRotation(const FxLogRotation &r);
+    FxLogRotation getRotation() const { return rotation; }
+
+    /// \brief bytes of log data dropped because the disk couldn't keep up
+    uint64_t getDroppedBytes() const { return writer.getDroppedBytes(); }
+
+    /// \brief log files that couldn't be opened, and failed writes or flushes
+    uint32_t getWriteErrors() const { return writer.getErrorCount(); }
+
+    /// \brief the writer log files are written by, shared with other file outputs (see FxMergedStream)
+    FxAsyncLogWriter* getWriter() { return &writer; }
+
 protected:
 
     virtual void periodicTask() {serviceLogs();}
@@ -50,18 +98,32 @@ private:
 
 struct LogRecord {
     int devId;
-    std::ofstream* fileObject;
-    unsigned int lastTimestamp;
+    int fileHandle;             // FxAsyncLogWriter handle, -1 if no file is open
+    uint64_t lastTimestamp;     // unwrapped, see FlexseaDevice::getLatestTimestamp64
     unsigned int logFileSize;
+    uint64_t logFileBytes;
+    std::chrono::steady_clock::time_point logFileOpened;
     unsigned int logFileSplitIndex;
     unsigned int numActiveFields;
     unsigned int logAdditionalField;
+    FxLogFormat format;
+    std::vector<int> loggedFieldIds;    // fields described by the file's current header/schema
+    uint64_t flushedBytes;              // logFileBytes at the last flush
+    std::chrono::steady_clock::time_point lastFlush;
 };
 
     std::vector<std::string> additionalColumnLabels;
     std::vector<int> additionalColumnValues;
-    unsigned int writeLogHeader(std::ofstream* fout, const FxDevicePtr dev, bool logAdditionalColumnsInit);
+
+    // reused by logDevice, so logging a poll doesn't allocate once they have grown
+    std::vector<uint32_t> scratchStamps;
+    std::vector<int32_t> scratchRows;
+    FxLogDataBlock scratchBlock{0};
+    unsigned int writeLogHeader(LogRecord &record, const FxDevicePtr dev, bool logAdditionalColumnsInit);
     void swapFileObject(LogRecord &record, std::string newfilename, const FxDevicePtr dev);
+    void closeFileObject(LogRecord &record);
+    void flushFileObject(LogRecord &record);
+    bool shouldRotate(const LogRecord &record) const;
 
     std::vector<LogRecord> logRecords;
     bool removeRecord(int idx);
@@ -72,6 +134,11 @@ struct LogRecord {
 
     std::mutex resMutex;
 
+    FxAsyncLogWriter writer;
+    FxLogSinkConfig sinkConfig;
+    FxLogRotation rotation;
+    FxLogFormat format;
+
     std::string _logFolderPath;
 
     std::string _sessionPath;
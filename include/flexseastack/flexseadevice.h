@@ -4,8 +4,12 @@
 #include <vector>
 #include <string>
 #include <mutex>
+#include <atomic>
 #include "flexseadevicetypes.h"
 #include "circular_buffer.h"
+#include "fxdecoder.h"
+#include "fxclockmodel.h"
+#include "fxlabeltable.h"
 
 #include "fxdata.h"
 
@@ -24,6 +28,20 @@ struct InaccessiblePointer : public std::exception {
 	return "Error accessing data ptr";}
 };
 
+/// \brief receive path statistics for a single device
+struct FxRxStats {
+    /// rows written since the device was added
+    uint64_t samplesReceived;
+    /// discontinuities inferred from device timestamps (at least one sample period missing)
+    uint64_t timestampGaps;
+    /// estimated number of samples missing across those discontinuities
+    uint64_t samplesMissed;
+    /// device timestamps that went backwards (wrap around or device reset)
+    uint64_t timestampResets;
+    /// current estimate of the device's sample period, in device timestamp units (0 if unknown)
+    uint64_t nominalPeriod;
+};
+
 /// \brief FlexseaDevice class provides read access to connected devices
 class FlexseaDevice
 {
@@ -47,11 +65,22 @@ public:
 	std::recursive_mutex *const dataMutex;
 
 	// Returns a vector of strings which describe the fields specified by map
-	std::vector<std::string> getActiveFieldLabels() const;
-	std::vector<int> getActiveFieldIds() const;
-	std::vector<std::string> getAllFieldLabels() const;
+	// the active label and id lists are shared with every device of the same type and bitmap,
+	// they are never modified and stay valid while any device of this type exists
+	const std::vector<std::string>& getActiveFieldLabels() const { return _activeFields.load()->labels; }
+	const std::vector<int>& getActiveFieldIds() const { return _activeFields.load()->fieldIds; }
+	const std::vector<std::string>& getAllFieldLabels() const { return _labels->all(); }
 
 	uint32_t getLatestTimestamp() const;
+	/// \brief unwrapped (64 bit, monotonic) timestamp of the latest row, 0 if there is no data
+	uint64_t getLatestTimestamp64() const;
+
+	/// \brief returns the host steady_clock time (ns) estimated for an unwrapped device timestamp
+	/// times from different devices are aligned onto the same host timeline
+	int64_t toHostTime(uint64_t timestamp64) const;
+
+	/// \brief current estimate of the device clock's drift relative to the host, in ppm
+	double getClockDriftPpm() const;
 
 	// Data retrieval functions
 
@@ -73,6 +102,14 @@ public:
 	/// note this is considerably slower than the array alternative
 	uint32_t getDataAfterTime(uint32_t timeStamp, std::vector<uint32_t> &timestamps, std::vector<std::vector<int32_t>> &data) const;
 
+	/// \brief same as above, but takes and returns unwrapped timestamps (see getLatestTimestamp64)
+	/// unlike the 32 bit version this is safe across timestamp wrap around and device resets
+	uint64_t getDataAfterTime64(uint64_t timeStamp, std::vector<uint32_t> &timestamps, std::vector<std::vector<int32_t>> &data) const;
+
+	/// \brief same as above, with the rows packed one after the other in data (numFields values each)
+	/// the vectors are only grown, so reusing them across calls doesn't allocate
+	uint64_t getDataAfterTime64(uint64_t timeStamp, std::vector<uint32_t> &timestamps, std::vector<int32_t> &data) const;
+
 	/// \brief A convenience function which counts through the bitmap to tell you how many active fields this device has
 	int getNumActiveFields() const;
 	std::string getName() const;
@@ -81,6 +118,19 @@ public:
 
 	FxDevData* getCircBuff() { return &_data; }
 
+	/// \brief appends a row stamped with deviceTimestamp, a sequence number and the host receive time
+	/// updates the gap statistics. dataMutex must be held by the caller
+	FX_DataPtr writeRow(uint32_t deviceTimestamp);
+
+	/// \brief fills out with the host side info (sequence number, receive time) of the row at index
+	/// returns false if index is invalid
+	bool getRowInfo(uint32_t index, FxRowInfo *out) const;
+
+	/// \brief returns a copy of this device's receive statistics
+	FxRxStats getRxStats() const;
+	/// \brief Returns the decoder selected for this device's type when it was added
+	const FxDecoder& getDecoder() const { return _decoder; }
+
 	bool isValid() const { return this->id != -1; }
 	/// \brief Returns the rate at which this device is/was receiving data in Hz
 	double getDataRate() const;
@@ -94,18 +144,26 @@ protected:
 	/// or in general if (1 << x) & active()[y] then field 32*y+x is active
 	uint32_t bitmap[FX_BITMAP_WIDTH];
 
-	//mutable because they're used for caching
-	mutable uint32_t lastFieldLabelMap[FX_BITMAP_WIDTH] = {0};
-	mutable std::vector<std::string> lastRequest;
-
 	int shortId;
 	int _role;
-	std::vector<std::string> fieldLabels;
+	FxLabelTablePtr _labels;
+	/// view of _labels for the current bitmap, updated by setBitmap
+	std::atomic<const FxActiveFields*> _activeFields;
 	std::recursive_mutex _dataMutex;
 	FxDevData _data;
+	FxDecoder _decoder;
+
+	FxRxStats _rxStats;
+	uint64_t _lastDeviceTimestamp;
+	uint8_t _consecutiveGaps;
+	/// size of the first gap of the current run of gaps, the others must be close to it
+	uint64_t _gapRunDelta;
+	FxClockModel _clock;
 
 private:
 	inline size_t findIndexAfterTime(uint32_t timestamp) const;
+	/// \brief index of the first row whose unwrapped timestamp is > timestamp (or >= if inclusive)
+	size_t findIndexAfterTime64(uint64_t timestamp, bool inclusive=false) const;
 };
 
 #endif // FLEXSEADEVICE_H
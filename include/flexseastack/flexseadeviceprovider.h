@@ -9,6 +9,8 @@
 #include "flexseadevicetypes.h"
 #include "circular_buffer.h"
 #include "flexseadevice.h"
+#include "fxdevicetable.h"
+#include "fxeventnotifier.h"
 #include <memory>
 
 /// \brief convenience class which manages a thread safe vector of uint8_t* flags
@@ -47,12 +49,30 @@ private:
 
 typedef std::shared_ptr<FlexseaDevice> FxDevicePtr;
 
+/// \brief immutable view of the devices connected at some point in time
+/// A registry is never modified once published; writers copy it, modify the copy and swap it in.
+struct FxDeviceRegistry {
+    std::vector<int> deviceIds;
+    std::unordered_map<int, FxDevicePtr> devices;
+
+    FxDevicePtr find(int id) const
+    {
+        auto it = devices.find(id);
+        return it != devices.end() ? it->second : nullptr;
+    }
+};
+typedef std::shared_ptr<const FxDeviceRegistry> FxRegistrySnapshot;
+
 class FlexseaDeviceProvider
 {
 public:
     FlexseaDeviceProvider();
     virtual ~FlexseaDeviceProvider();
 
+    /// \brief Returns the current device registry.
+    /// Safe to call from any thread; the returned snapshot stays valid (and unchanging) for as long as it is held
+    FxRegistrySnapshot snapshot() const { return std::atomic_load(&registry); }
+
     /// \brief Returns a vector containing the ids of all connected devices.
     std::vector<int> getDeviceIds() const;
 
@@ -68,7 +88,7 @@ public:
     const FxDevicePtr getDevicePtr(int id) const;
 
     /// \brief Returns true if this provider contains a device with given id, false otherwise
-    bool haveDevice(int id) const { return connectedDevices.count(id) > 0; }
+    bool haveDevice(int id) const { return snapshot()->devices.count(id) > 0; }
 
     // These functions allow users to be notified of the corresponding events.
     // flag ownership does not transfer to the device provider
@@ -77,32 +97,63 @@ public:
     void unregisterConnectionChangeFlag(uint8_t *flag) const {deviceConnectedFlags.remove(flag);}
     void unregisterMapChangeFlag(uint8_t *flag) const {mapChangedFlags.remove(flag);}
 
+    /// \brief Subscribes cb to the events selected by eventMask (a combination of FxEventType).
+    /// Returns a handle to pass to unsubscribe, or -1 on failure.
+    /// Callbacks are dispatched on a dedicated notifier thread and should not block for long
+    int subscribe(uint8_t eventMask, const FxEventCallback &cb) const { return events.subscribe(eventMask, cb); }
+    void unsubscribe(int handle) const { events.unsubscribe(handle); }
+
 protected:
     mutable FlagList deviceConnectedFlags;
     mutable FlagList mapChangedFlags;
+    mutable FxEventNotifier events;
 
-    std::vector<int> deviceIds;
-    std::unordered_map<int, FxDevicePtr> connectedDevices;
     const FlexseaDevice defaultDevice;
 
+    /// \brief Returns a raw pointer to the device with matching ID, or nullptr if no match.
+    /// Meant for the comm thread's receive path: resolves in a single array load for long ids.
+    /// The pointer stays valid until the next call to reclaimRetiredDevices.
+    FlexseaDevice* findDevice(int id) const;
+
     int addDevice(int id, int port, FlexseaDeviceType type, int role=FLEXSEA_MANAGE_1);
 
     template<typename ... Args>
     int addDevice(int id, Args&&... args)
     {
-        if(haveDevice(id)) return 1;
+        FxDevicePtr devPtr;
+        {
+            std::lock_guard<std::mutex> lk(writeMutex);
+            if(haveDevice(id)) return 1;
 
-        deviceIds.push_back(id);
-        FxDevicePtr devPtr(new FlexseaDevice( id, std::forward<Args>(args)... ));
-        connectedDevices.insert({id, devPtr});
+            devPtr = std::allocate_shared<FlexseaDevice>(FxPoolAllocator<FlexseaDevice>(&FxMemoryPools::instance().devices),
+                                                         id, std::forward<Args>(args)... );
+            publishAdd(devPtr);
+        }
 
         //Notify device connected
         deviceConnectedFlags.notify();
+        events.post(FX_EVENT_DEVICE_CONNECTED, id);
 
         return 0;
     }
 
     int removeDevice(int id);
+
+    /// \brief Releases devices removed since the last call.
+    /// Must only be called from the thread that uses findDevice, at a point where it holds no raw device pointers
+    void reclaimRetiredDevices();
+
+private:
+    /// \brief copies the registry, adds devPtr and publishes the copy. writeMutex must be held
+    void publishAdd(const FxDevicePtr &devPtr);
+
+    FxRegistrySnapshot registry;
+    std::mutex writeMutex;
+    FxDeviceTable rxTable;
+
+    // removed devices are kept alive here until the comm thread reaches a quiescent point
+    std::vector<FxDevicePtr> retired;
+    std::mutex retiredMutex;
 };
 
 #endif // FLEXSEADEVICEPROVIDER_H
@@ -8,6 +8,8 @@
 #include <algorithm>
 #include <functional>
 #include <atomic>
+#include <chrono>
+#include <random>
 
 #include "rxhandler.h"
 #include "flexseadevicetypes.h"
@@ -33,6 +35,28 @@ typedef std::vector<OpenAttempt> OpenAttemptList;
 #define CHUNK_SIZE				48
 #define MAX_SERIAL_RX_LEN		(CHUNK_SIZE*15 + 10)
 
+//Discovery: who am i probes back off exponentially (with jitter) until metadata is received
+#define FX_WHOAMI_FIRST_DELAY_MS	20
+#define FX_WHOAMI_MAX_DELAY_MS		1000
+
+/// \brief discovery progress of a port, since its last open()
+struct FxPortDiscovery {
+    /// number of who am i probes sent
+    int probes;
+    /// ms from open() to the first metadata received, -1 until then
+    int timeToMetadataMs;
+};
+
+/// \brief receive path counters of a port
+struct FxPortRxStats {
+    uint64_t bytes;
+    /// times the receive buffer filled up with data that wouldn't unpack
+    uint32_t resyncs;
+    /// resyncs that found no valid frame within the scan window, the buffer was cleared
+    uint32_t resyncFailures;
+    /// bytes dropped while resynchronizing
+    uint64_t discardedBytes;
+};
 
 /// \brief FlexseaSerial class manages serial ports and connected devices
 class FlexseaSerial : public PeriodicTask, public SerialDriver, public FlexseaDeviceProvider, public RxHandlerManager
@@ -61,6 +85,11 @@ public:
     /// \brief close the corresponding port
     virtual void close(uint16_t portIdx);
 
+    /// \brief returns how discovery went (or is going) on the given port
+    FxPortDiscovery getPortDiscovery(int portIdx) const;
+    /// \brief returns the receive counters of the given port
+    FxPortRxStats getPortRxStats(int portIdx) const;
+
 protected:
     /// \brief see class PeriodicTask for more info
     virtual void periodicTask();
@@ -69,8 +98,12 @@ protected:
     /// \brief see class PeriodicTask for more info
     virtual bool goToLongSleep();
 
-    /// \brief checks any ports that currently have open attempts
-    void serviceOpenAttempts(uint8_t delayed);
+    /// \brief called on the comm thread after metadata from devId was processed
+    virtual void deviceMetadataReceived(int devId) { (void)devId; }
+
+    /// \brief checks any ports that currently have open attempts, sends who am i probes that are due
+    /// The open attempt list is only locked to copy and update it, never across port I/O
+    void serviceOpenAttempts();
 
     /// \brief checks any ports that currently open, receives data if any bytes are available
     virtual void serviceOpenPorts();
@@ -78,30 +111,62 @@ protected:
     /// \brief processes nb bytes at the port, analyses for packets, parses, etc
     void processReceivedData(int port, size_t nb);
 
+    /// \brief hands bytes to the port's receive path as if they had been read from it (see TestSerial)
+    void receiveBytes(int port, const uint8_t *bytes, size_t n);
+
     MultiCommPeriph *portPeriphs;
     std::atomic<int> devicesAtPort[FX_NUMPORTS];
+    /// bytes read from each port since it was created
+    std::atomic<uint64_t> portRxBytes[FX_NUMPORTS];
+    std::atomic<uint32_t> portResyncs[FX_NUMPORTS];
+    std::atomic<uint32_t> portResyncFailures[FX_NUMPORTS];
+    std::atomic<uint64_t> portDiscardedBytes[FX_NUMPORTS];
 
 private:
     int sysDataParser(int port);
+    /// \brief unpacks and parses packets from the port's buffer, at most *budget of them (decremented)
+    /// returns false if nothing was consumed
+    bool unpackBuffered(int port, int *budget);
+    /// \brief skips garbage at the front of a full receive buffer, keeping at least the last keepBytes
+    void resync(int port, uint16_t keepBytes);
     inline int updateDeviceMetadata(int port, uint8_t *buf);
-    inline int updateDeviceData(int port, uint8_t *buf);
+    /// len is the length of the unpacked message buf
+    inline int updateDeviceData(int port, uint8_t *buf, uint16_t len);
+
+    /// \brief rows received per device during the current serviceOpenPorts pass
+    std::vector<std::pair<int, uint32_t>> rxBatch;
+    void countReceivedRow(int devId);
+    void postReceivedRows();
 
     // open attempts needs serialization.
     // It is written to from the control thread, read from the worker thread
     OpenAttemptList openAttempts;
     std::mutex openAttemptMut_;
     std::atomic<int> haveOpenAttempts;
+    uint32_t nextOpenAttemptId;
     uint8_t largeRxBuffer[MAX_SERIAL_RX_LEN];
+
+    // only used from the comm thread
+    std::minstd_rand probeJitter;
+    int nextProbeDelay(int delayMs);
+
+    /// steady_clock time of the last open(), in ns (0 if never opened); written by the caller of open()
+    std::atomic<int64_t> openTimeNs[FX_NUMPORTS];
+    std::atomic<int> probesSent[FX_NUMPORTS];
+    std::atomic<int> timeToMetadataMs[FX_NUMPORTS];
 };
 
 class OpenAttempt {
 public:
-    explicit OpenAttempt(int portIdx_, std::string portName_, int tries_, int tryMax_, int delay_, int delayed_) :
-        portIdx(portIdx_), portName(portName_), tries(tries_), tryMax(tryMax_), delay(delay_), delayed(delayed_), markedToRemove(false) {}
+    explicit OpenAttempt(uint32_t id_, int portIdx_, std::string portName_) :
+        id(id_), portIdx(portIdx_), portName(portName_), delayMs(0), nextProbe(std::chrono::steady_clock::now()), markedToRemove(false) {}
 
+    uint32_t id;
     int portIdx;
     std::string portName;
-    int tries, tryMax, delay, delayed;
+    /// current backoff, the first probe is sent as soon as the port is open
+    int delayMs;
+    std::chrono::steady_clock::time_point nextProbe;
     bool markedToRemove;
 };
 
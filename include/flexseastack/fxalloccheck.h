@@ -0,0 +1,60 @@
+#ifndef FXALLOCCHECK_H
+#define FXALLOCCHECK_H
+
+#include <cstdint>
+#include <string>
+
+class CommManager;
+
+/// \brief counts heap allocations made by any thread while armed, and records their call stacks
+///
+/// Only available when the library is built with FX_ALLOC_CHECK, which replaces the global
+/// operator new / delete of the whole process, and with glibc malloc, calloc, realloc and free too
+/// (so the C parts of the stack are covered). Elsewhere, direct malloc calls aren't seen.
+class FxAllocTracker
+{
+public:
+    static bool isAvailable();
+
+    static void arm();
+    /// \brief stops counting, returns the number of allocations made since arm()
+    static uint64_t disarm();
+    static uint64_t getCount();
+
+    /// \brief size and call stack of the first allocations made while armed; call once disarmed
+    static std::string report();
+};
+
+/// \brief a simulated streaming session, see fxCheckSteadyStateAllocations
+struct FxSteadyStateConfig {
+    int numDevices;
+    /// stream frequency, one of CommManager's timer frequencies
+    int freq;
+    /// log the streams too
+    bool log;
+    /// time given to buffers and pools to reach their steady state size, not counted
+    int warmupMs;
+    int durationMs;
+    /// stream with the bitmap minimizer on, so reads go through its on demand widening check
+    bool minimizeBitmaps;
+    /// called for every device at each poll, the way an application reads it (e.g. with the C API's read functions);
+    /// if null the device's data is read straight from its FlexseaDevice
+    void (*readDevice)(CommManager &manager, int devId);
+};
+
+struct FxSteadyStateResult {
+    /// false if the check couldn't run (library built without FX_ALLOC_CHECK, or no data was received)
+    bool ran;
+    uint64_t allocations;
+    std::string report;
+};
+
+/// \brief streams from simulated devices (TestSerial) and counts the heap allocations made in steady state
+///
+/// The devices answer each read with packed sysdata frames, which go through the regular receive path
+/// (processReceivedData, unpacking, sysdata parsing). Runs the TX scheduling, receive, logging and the
+/// reads of config.readDevice on a TestSerial of its own. The session passes if no allocation was made
+/// after the warmup. Allocations made by any other thread of the process are counted too.
+FxSteadyStateResult fxCheckSteadyStateAllocations(const FxSteadyStateConfig &config);
+
+#endif // FXALLOCCHECK_H
@@ -0,0 +1,67 @@
+#ifndef FXCLOCKMODEL_H
+#define FXCLOCKMODEL_H
+
+#include <cstdint>
+
+/// nominal length of one device timestamp tick, in ns (device timestamps are in ms)
+#define FX_DEVICE_TICK_NS 1000000LL
+
+/// \brief online model of a device's clock relative to the host steady_clock
+///
+/// Unwraps the device's raw 32 bit timestamps into a monotonic 64 bit timeline,
+/// surviving both counter wrap around and device resets.
+/// Maps that timeline onto host time by tracking offset and drift:
+///  - host receive times only ever lag the device's clock (by transport latency),
+///    so the offset is taken from the lower envelope of (host - device) over one second windows
+///  - drift is the slope of those window minima, smoothed over roughly ten windows
+/// Aligned host times are comparable across devices, which is what allows merging their streams.
+class FxClockModel
+{
+public:
+    FxClockModel();
+
+    /// \brief returns the unwrapped (64 bit, monotonic) value of a newly received raw timestamp
+    uint64_t unwrap(uint32_t raw);
+
+    /// \brief maps a raw timestamp onto the current unwrapped timeline without updating the model
+    /// picks the unwrapped value closest to the latest received timestamp
+    uint64_t unwrapQuery(uint32_t raw) const;
+
+    /// \brief feeds an (unwrapped device time, host receive time) pair into the model
+    void addSample(uint64_t deviceTs, int64_t hostNs);
+
+    /// \brief returns the host steady_clock time (ns) estimated for an unwrapped device time
+    int64_t toHostNs(uint64_t deviceTs) const;
+
+    /// \brief latest unwrapped timestamp (0 if nothing was received)
+    uint64_t latest() const { return _latest; }
+
+    /// \brief current estimate of the device clock's drift, in parts per million
+    double getDriftPpm() const { return slope * 1e6 / FX_DEVICE_TICK_NS; }
+
+    /// \brief number of times the device clock was seen going backwards (resets, not wraps)
+    uint32_t getResetCount() const { return resets; }
+
+private:
+    void resetFit();
+
+    // unwrapping
+    uint64_t epochOffset;
+    uint64_t _latest;
+    uint32_t lastRaw;
+    bool haveRaw;
+    uint32_t resets;
+
+    // current one second window
+    int64_t windowStartNs;
+    int64_t windowMinOffset;
+    uint64_t windowMinTs;
+    bool windowOpen;
+
+    // smoothed fit of window minima: offset(ts) = meanOffset + slope * (ts - meanTs)
+    double meanTs, meanOffset, varTs, covTsOffset;
+    double slope;
+    bool haveFit;
+};
+
+#endif // FXCLOCKMODEL_H
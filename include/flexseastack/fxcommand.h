@@ -0,0 +1,101 @@
+#ifndef FXCOMMAND_H
+#define FXCOMMAND_H
+
+#include <cstdint>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <vector>
+
+#include "flexseadevicetypes.h"
+
+/// \brief progress of a submitted command
+enum FxCommandStatus {
+    /// queued, not written to the port yet
+    FX_CMD_PENDING = 0,
+    /// written to the port. Final for commands the device doesn't answer
+    FX_CMD_SENT,
+    /// the device's response confirmed the command (ie: metadata showing the requested bitmap)
+    FX_CMD_CONFIRMED,
+    /// not sent, or not confirmed, before the deadline
+    FX_CMD_TIMEOUT,
+    /// dropped before being sent (device or port gone, queue overflow)
+    FX_CMD_FAILED
+};
+
+inline bool fxCommandIsFinal(FxCommandStatus s, bool awaitsConfirmation)
+{
+    return s >= FX_CMD_CONFIRMED || (s == FX_CMD_SENT && !awaitsConfirmation);
+}
+
+typedef std::function<void(int devId, FxCommandStatus status)> FxCommandCallback;
+
+/// \brief completion state shared by a command's handle and the comm thread
+class FxCommandState
+{
+public:
+    FxCommandState(int devId, bool awaitConfirmation, std::chrono::steady_clock::time_point deadline);
+
+    const int devId;
+    const bool awaitsConfirmation;
+    const std::chrono::steady_clock::time_point deadline;
+
+    /// bitmap the device should report once a writeDeviceMap is applied
+    uint32_t expectedBitmap[FX_BITMAP_WIDTH];
+
+    FxCommandStatus getStatus() const;
+    bool isFinal() const { return fxCommandIsFinal(getStatus(), awaitsConfirmation); }
+
+    /// \brief moves the command forward to status; ignored once the command is final
+    /// on reaching a final status the future is resolved and callbacks run, on the calling thread
+    void resolve(FxCommandStatus status);
+
+    void addCallback(const FxCommandCallback &cb);
+    std::shared_future<FxCommandStatus> getFuture() const { return future; }
+
+    /// \brief blocks until the command is final, or until timeout; returns the status at that point
+    FxCommandStatus wait(std::chrono::milliseconds timeout) const;
+
+private:
+    mutable std::mutex mutex;
+    mutable std::condition_variable cv;
+    FxCommandStatus status;
+    std::vector<FxCommandCallback> callbacks;
+    std::promise<FxCommandStatus> promise;
+    std::shared_future<FxCommandStatus> future;
+};
+
+typedef std::shared_ptr<FxCommandState> FxCommandStatePtr;
+
+/// \brief handle returned by the asynchronous command API
+/// cheap to copy; an invalid (default) handle means the command couldn't be submitted
+class FxCommandHandle
+{
+public:
+    FxCommandHandle() {}
+    explicit FxCommandHandle(const FxCommandStatePtr &s) : state(s) {}
+
+    bool isValid() const { return state != nullptr; }
+    int getDevId() const { return state ? state->devId : -1; }
+    FxCommandStatus getStatus() const { return state ? state->getStatus() : FX_CMD_FAILED; }
+    bool isDone() const { return !state || state->isFinal(); }
+
+    /// \brief future resolved with the final status
+    std::shared_future<FxCommandStatus> getFuture() const;
+
+    /// \brief blocks until the command is final; the command's own deadline bounds the wait
+    FxCommandStatus wait() const { return state ? state->wait(std::chrono::milliseconds::max()) : FX_CMD_FAILED; }
+    FxCommandStatus waitFor(std::chrono::milliseconds timeout) const { return state ? state->wait(timeout) : FX_CMD_FAILED; }
+
+    /// \brief calls cb once the command is final (immediately if it already is)
+    /// cb may run on the comm thread, it must not block
+    void then(const FxCommandCallback &cb) const;
+
+private:
+    FxCommandStatePtr state;
+};
+
+#endif // FXCOMMAND_H
@@ -3,27 +3,56 @@
 
 #include <cstdint>
 #include <cstring>
+#include <chrono>
+
+#include "fxmempool.h"
+
+/// \brief host side bookkeeping stored alongside each row of an FxDevData
+struct FxRowInfo {
+    /// monotonic per-device sequence number, assigned when the row is written
+    uint64_t seq;
+    /// host steady_clock time at which the row was written, in ns
+    int64_t rxTimeNs;
+    /// device timestamp unwrapped onto a monotonic 64 bit timeline (see FxClockModel)
+    uint64_t deviceTs;
+    /// device timestamp mapped onto host steady_clock time, in ns; comparable across devices
+    int64_t alignedNs;
+};
 
 /// \brief a data structure used for storing data received from flexsea devices
 /// FxDevData returns int32_t*, but owns all the memory pointed to by these return values
 /// the point of this structure is to provide a convenience 2D buffer (circular in first dimension) and avoid continuous memory allocations
+/// each row also carries an FxRowInfo, stamped by getWrite, so readers can tell which rows they missed by sequence number
 struct FxDevData {
 
+    /// rows and their info share one block from the deviceData pool (see FxMemoryPools)
     FxDevData(uint32_t rows, uint32_t cols)
 	: _rows(rows) , _cols(cols)
-	, data( new uint32_t[rows*cols] ) 
+	, info( (FxRowInfo*)FxMemoryPools::instance().deviceData.acquire(rows * (sizeof(FxRowInfo) + sizeof(uint32_t) * cols)) )
+	, data( (uint32_t*)(info + rows) )
 	, wIdx(0), rIdx(0), size(0)
+	, nextSeq(0)
     {
         memset(data, 0, sizeof(uint32_t) * rows * cols);
+        memset(info, 0, sizeof(FxRowInfo) * rows);
     }
 
-	~FxDevData() { delete[] data; }
+	~FxDevData() { FxMemoryPools::instance().deviceData.release(info); }
+
+	FxDevData(const FxDevData&) = delete;
+	FxDevData& operator=(const FxDevData&) = delete;
 
     /// \brief Get the next pointer to write to
+	/// the row's FxRowInfo is stamped with the next sequence number and the current host time
 	uint32_t* getWrite() 
 	{ 
 		uint32_t *p = data + wIdx * _cols;
 
+		FxRowInfo &ri = info[wIdx];
+		ri.seq = nextSeq++;
+		ri.rxTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now().time_since_epoch()).count();
+
 		// advance write index
 		if((++wIdx) >= _rows) 
 			wIdx = 0;
@@ -33,7 +62,7 @@ struct FxDevData {
         if((++size) > _rows)
 		{
 			--size;
-			if((++rIdx) >= _rows) 
+			if((++rIdx) >= _rows)
 				rIdx = 0;
 		}
 
@@ -59,18 +88,39 @@ struct FxDevData {
 		return data + t * _cols;
 	}
 
+    /// \brief Get the row info at the corresponding index
+    const FxRowInfo* getInfo(unsigned int i) const
+	{
+		if(!size || i >= size) return nullptr;
+
+		unsigned int t = (rIdx + i);
+
+		if(t >= _rows)
+			t -= _rows;
+
+		return info + t;
+	}
+
+    /// \brief Get the row info of the last row returned by getWrite()
+    FxRowInfo* peekBackInfo() { return size ? const_cast<FxRowInfo*>(getInfo(size-1)) : nullptr; }
+
     /// \brief Get number of valid data pointers
     size_t count() const { return size; }
 
+    /// \brief Get the sequence number the next written row will receive
+    uint64_t nextSequence() const { return nextSeq; }
+
     /// \brief Check if the container contains any data
     bool empty()  const { return size == 0; }
 
 private:
 
 	uint32_t _rows, _cols;
+	FxRowInfo *info;
     uint32_t *data;
 	uint32_t wIdx, rIdx;
 	size_t size;
+	uint64_t nextSeq;
 
 };
 
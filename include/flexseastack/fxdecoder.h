@@ -0,0 +1,73 @@
+#ifndef FXDECODER_H
+#define FXDECODER_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "flexseadevicetypes.h"
+#include "flexsea_device_spec.h"
+
+/// \brief FxDecoder unpacks sysdata payloads into FxDevData rows
+///
+/// The decode strategy is selected once, when the device is added.
+/// For device types described by deviceSpecs, the decoder is specialized to the type's layout:
+/// the active fields are grouped into runs of one wire format landing in consecutive row slots,
+/// each decoded by a loop instantiated for that format (a run of 32 bit fields is a single memcpy).
+/// The receive path never consults deviceSpecs or walks inactive fields.
+/// The runs are rebuilt only when the device's bitmap changes.
+/// Devices without a spec (FX_CUSTOM) are left unspecialized and use the generic path.
+class FxDecoder
+{
+public:
+    explicit FxDecoder(FlexseaDeviceType type);
+
+    /// \brief returns true if this decoder can decode payloads for its type
+    /// if false, the caller should fall back to the generic spec driven decode
+    bool isSpecialized() const { return specialized; }
+
+    /// \brief rebuilds the decode plan for the given bitmap (uint32_t[FX_BITMAP_WIDTH])
+    void setBitmap(const uint32_t *bitmap);
+
+    /// \brief decodes the field section of a payload into row
+    /// @param payload points at the first active field in the received message, holding at least payloadSize() bytes
+    /// @param row points at the first field slot of an FxDevData row (ie: after the timestamp)
+    void decode(const uint8_t *payload, int32_t *row) const { decodeRuns(runs.data(), runs.size(), payload, row); }
+
+    /// \brief number of payload bytes expected for the current bitmap, shorter payloads must not be decoded
+    uint16_t payloadSize() const { return _payloadSize; }
+
+private:
+    /// kinds of field conversion, one per supported wire format
+    enum OpKind : uint8_t { OP_32 = 0, OP_16S, OP_16U, OP_8S, OP_8U, OP_RAW };
+
+    /// consecutive active fields of one format, stored in consecutive row slots
+    struct FieldRun {
+        uint16_t src;       // byte offset into payload
+        uint16_t dst;       // field index in row of the first field
+        uint16_t count;     // number of fields
+        uint8_t kind;       // OpKind
+        uint8_t width;      // bytes per field on the wire
+    };
+
+    /// \brief converts count fields of wire type T, packed at src, to int32 row slots
+    template<typename T>
+    static inline void decodeRun(const uint8_t *src, int32_t *dst, uint16_t count)
+    {
+        for(uint16_t i = 0; i < count; ++i, src += sizeof(T))
+        {
+            T v;
+            memcpy(&v, src, sizeof(T));
+            dst[i] = static_cast<int32_t>(v);
+        }
+    }
+
+    static void decodeRuns(const FieldRun *runs, size_t n, const uint8_t *payload, int32_t *row);
+
+    const FlexseaDeviceType type;
+    bool specialized;
+    std::vector<FieldRun> runs;
+    uint16_t _payloadSize;
+};
+
+#endif // FXDECODER_H
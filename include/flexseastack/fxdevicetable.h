@@ -0,0 +1,46 @@
+#ifndef FXDEVICETABLE_H
+#define FXDEVICETABLE_H
+
+#include <cstdint>
+#include <memory>
+#include <atomic>
+
+class FlexseaDevice;
+
+/// \brief flat, directly indexed table of device pointers used on the receive path
+///
+/// Long device ids are built as (shortId << 6) | port, so they are small and dense.
+/// Resolving a device from an incoming frame is a single array load, with no hashing
+/// and no shared_ptr reference count traffic.
+/// FxDeviceTable does not own the devices it points to; the owner must erase an entry
+/// before the corresponding device is destroyed.
+/// Slots are atomic so the table may be updated while the comm thread reads it.
+class FxDeviceTable
+{
+public:
+    /// 8 bit short id, 6 bit port
+    static const int CAPACITY = 1 << 14;
+
+    FxDeviceTable() : slots(new std::atomic<FlexseaDevice*>[CAPACITY]()) {}
+
+    /// \brief returns true if id can be stored in this table
+    static bool inRange(int id) { return id >= 0 && id < CAPACITY; }
+
+    /// \brief returns the device with matching id, or nullptr if there is none
+    FlexseaDevice* find(int id) const { return inRange(id) ? slots[id].load(std::memory_order_acquire) : nullptr; }
+
+    /// \brief stores d at id, returns false if id is out of range
+    bool insert(int id, FlexseaDevice *d)
+    {
+        if(!inRange(id)) return false;
+        slots[id].store(d, std::memory_order_release);
+        return true;
+    }
+
+    void erase(int id) { if(inRange(id)) slots[id].store(nullptr, std::memory_order_release); }
+
+private:
+    std::unique_ptr<std::atomic<FlexseaDevice*>[]> slots;
+};
+
+#endif // FXDEVICETABLE_H
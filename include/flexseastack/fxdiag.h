@@ -0,0 +1,106 @@
+#ifndef FXDIAG_H
+#define FXDIAG_H
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+/// \brief severity of a diagnostic message
+enum FxDiagLevel {
+    FX_DIAG_OFF = 0,
+    FX_DIAG_ERROR,
+    FX_DIAG_WARN,
+    FX_DIAG_INFO,
+    FX_DIAG_DEBUG
+};
+
+/// \brief receives flushed messages instead of the output file, see FxDiagLog::setCallback
+typedef void (*FxDiagCallback)(int level, const char *message);
+
+/// \brief rate limit state of one FX_DIAG call site
+struct FxDiagSite {
+    std::atomic<int64_t> windowStart;
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> suppressed;
+};
+
+#define FX_DIAG_RING_SIZE 256
+#define FX_DIAG_MSG_LEN 192
+/// messages a call site may emit per second, the rest are counted and reported with the next one emitted
+#define FX_DIAG_SITE_LIMIT 10
+
+/// \brief leveled diagnostic messages, written out by a background thread
+///
+/// Posting formats into a slot of a fixed ring claimed with a compare and swap: no lock, no allocation,
+/// and it never waits on the output. Messages posted while the ring is full are dropped and counted.
+/// The flusher thread, started with the first message, writes them out (stdout by default) every few ms.
+class FxDiagLog
+{
+public:
+    static FxDiagLog& instance();
+    ~FxDiagLog();
+
+    void setLevel(FxDiagLevel l) { level.store(l, std::memory_order_relaxed); }
+    FxDiagLevel getLevel() const { return (FxDiagLevel)level.load(std::memory_order_relaxed); }
+    bool enabled(FxDiagLevel l) const { return l != FX_DIAG_OFF && l <= level.load(std::memory_order_relaxed); }
+
+    /// \brief appends messages to the file at path, or to stdout if path is null or empty
+    /// @returns false if the file can't be opened, the output is left unchanged
+    bool setOutput(const char *path);
+    /// \brief hands messages to cb (on the flusher thread) instead of writing them, null restores the output
+    void setCallback(FxDiagCallback cb);
+
+    /// \brief formats and queues a message; site (may be null) rate limits its call site
+    void post(FxDiagLevel l, FxDiagSite *site, const char *fmt, ...)
+#ifdef __GNUC__
+        __attribute__((format(printf, 4, 5)))
+#endif
+    ;
+
+    /// \brief writes out everything queued so far, from the calling thread
+    void flush();
+
+    uint64_t getDropped() const { return dropped; }
+
+private:
+    FxDiagLog();
+
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        uint8_t level;
+        char text[FX_DIAG_MSG_LEN];
+    };
+
+    bool allow(FxDiagSite *site, uint32_t *suppressed);
+    void run();
+    void write(int level, const char *text);
+
+    Slot slots[FX_DIAG_RING_SIZE];
+    std::atomic<uint64_t> enqueuePos;
+    uint64_t dequeuePos;
+    std::atomic<uint64_t> dropped;
+    uint64_t reportedDrops;
+    std::atomic<int> level;
+
+    /// guards the output and dequeuing, only ever taken by the flusher or flush()
+    std::mutex outputMutex;
+    FILE *out;
+    FxDiagCallback callback;
+
+    std::atomic<bool> quit;
+    std::once_flag flusherStarted;
+    std::thread flusher;
+};
+
+/// \brief posts a diagnostic message, rate limited per call site; the arguments aren't evaluated if the level is off
+#define FX_DIAG(lvl, ...) \
+    do { \
+        if(FxDiagLog::instance().enabled(lvl)) { \
+            static FxDiagSite fxDiagSite_; \
+            FxDiagLog::instance().post(lvl, &fxDiagSite_, __VA_ARGS__); \
+        } \
+    } while(0)
+
+#endif // FXDIAG_H
@@ -0,0 +1,90 @@
+#ifndef FXEVENTNOTIFIER_H
+#define FXEVENTNOTIFIER_H
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+/// \brief events a client can subscribe to, usable as a bit mask
+enum FxEventType : uint8_t {
+    FX_EVENT_DEVICE_CONNECTED   = 0x01,
+    FX_EVENT_DEVICE_REMOVED     = 0x02,
+    FX_EVENT_BITMAP_CHANGED     = 0x04,
+    FX_EVENT_NEW_DATA           = 0x08,
+    /// the device's port failed, the device was removed and its configuration is being recovered
+    FX_EVENT_LINK_LOST          = 0x10,
+    /// the device is back after a link loss, with its field map and streams restored
+    FX_EVENT_LINK_RESTORED      = 0x20,
+    FX_EVENT_ALL                = 0x3F
+};
+
+/// \brief describes one (possibly coalesced) event
+struct FxEvent {
+    FxEventType type;
+    int devId;
+    /// number of occurrences folded into this event (ie: rows received for FX_EVENT_NEW_DATA)
+    uint32_t count;
+};
+
+typedef std::function<void(const FxEvent&)> FxEventCallback;
+
+/// \brief dispatches device events to subscribed callbacks on a dedicated thread
+///
+/// post() never blocks on a callback: events are queued and dispatched by the notifier thread.
+/// The queue is bounded; consecutive events of the same type for the same device are coalesced while pending,
+/// and once the queue is full further distinct events are dropped and counted.
+/// The notifier thread is only started once the first subscription is made.
+class FxEventNotifier
+{
+public:
+    explicit FxEventNotifier(size_t maxPending = 256);
+    ~FxEventNotifier();
+
+    /// \brief registers cb for every event type in eventMask, returns a handle for unsubscribe
+    int subscribe(uint8_t eventMask, const FxEventCallback &cb);
+
+    /// \brief removes the subscription. cb may still be running on the notifier thread when this returns
+    void unsubscribe(int handle);
+
+    /// \brief returns true if any subscriber is interested in type. cheap enough for the rx path
+    bool wants(FxEventType type) const { return (activeMask.load(std::memory_order_relaxed) & type) != 0; }
+
+    /// \brief queues an event for dispatch (safe from any thread)
+    void post(FxEventType type, int devId, uint32_t count = 1);
+
+    /// \brief number of events dropped because the queue was full
+    uint64_t getDroppedCount() const { return dropped; }
+
+private:
+    struct Subscriber {
+        int handle;
+        uint8_t mask;
+        FxEventCallback cb;
+    };
+    typedef std::vector<Subscriber> SubscriberList;
+
+    void run();
+    void updateMask();
+
+    const size_t maxPending;
+
+    std::mutex queueMutex;
+    std::condition_variable queueCV;
+    std::vector<FxEvent> pending;
+    bool quit;
+
+    std::mutex subscriberMutex;
+    std::shared_ptr<const SubscriberList> subscribers;
+    int nextHandle;
+    std::atomic<uint8_t> activeMask;
+    std::atomic<uint64_t> dropped;
+
+    std::thread worker;
+};
+
+#endif // FXEVENTNOTIFIER_H
@@ -0,0 +1,46 @@
+#ifndef FXFIELDINTEREST_H
+#define FXFIELDINTEREST_H
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+
+#include "flexseadevicetypes.h"
+
+/// \brief thread safe registry of the fields each consumer needs from each device
+///
+/// Every consumer (the user's stream variables, a merged stream, on demand reads...) holds
+/// one interest per device, a bitmap of the fields it reads. The union of a device's interests
+/// is the smallest bitmap that serves all of them.
+class FxFieldInterests
+{
+public:
+    FxFieldInterests() : nextHandle(1) {}
+
+    /// \brief registers an interest in the fields of map (uint32_t[FX_BITMAP_WIDTH]), returns its handle
+    int add(int devId, const uint32_t *map);
+    /// \brief replaces the fields of an interest
+    void set(int handle, const uint32_t *map);
+    /// \brief adds fields to an interest
+    void widen(int handle, const uint32_t *map);
+    /// \brief removes an interest, returns the device it was for (-1 if the handle is unknown)
+    int remove(int handle);
+
+    /// \brief writes the union of the device's interests into out
+    /// @returns false if nothing is registered for the device
+    bool getUnion(int devId, uint32_t *out) const;
+    std::vector<int> getDeviceIds() const;
+
+private:
+    struct Entry {
+        int handle;
+        int devId;
+        uint32_t map[FX_BITMAP_WIDTH];
+    };
+
+    mutable std::mutex mutex;
+    std::vector<Entry> entries;
+    int nextHandle;
+};
+
+#endif // FXFIELDINTEREST_H
@@ -0,0 +1,80 @@
+#ifndef FXHOTPLUG_H
+#define FXHOTPLUG_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+
+#include "periodictask.h"
+
+class FlexseaSerial;
+
+/// \brief selects which USB serial devices are opened automatically
+/// a zero vid/pid or an empty serial number matches anything
+struct FxHotplugRule {
+    uint16_t vid;
+    uint16_t pid;
+    std::string serialNumber;
+};
+
+/// \brief opens and closes ports automatically as matching USB serial devices come and go
+///
+/// Watches /dev with inotify for ttyACM / ttyUSB nodes being added or removed, then enumerates
+/// ports (serial::list_ports) and matches each one's hardware id (VID:PID, serial number) against the rules.
+/// A matching port is opened on a free port index, the same index it had before if it reconnects,
+/// so its device ids don't change. A port whose node disappeared, or that was closed
+/// after an I/O error while its node is still there, is closed or reopened on the next scan.
+/// Ports are also rescanned every second, which is all that is done where inotify isn't available.
+/// Ports opened by hand with FlexseaSerial::open are left alone.
+class FxHotplugWatcher : public PeriodicTask
+{
+public:
+    explicit FxHotplugWatcher(FlexseaSerial *fs);
+    virtual ~FxHotplugWatcher();
+
+    /// \brief starts watching, opening any matching port already present
+    bool start(const std::vector<FxHotplugRule> &rules);
+    void stop();
+    bool isActive() const { return worker.joinable(); }
+
+    /// \brief parses a serial::PortInfo hardware id ("USB VID:PID=0483:5740 SNR=...")
+    /// @returns false if it isn't a USB device
+    static bool parseHardwareId(const std::string &hwId, uint16_t *vid, uint16_t *pid, std::string *serialNumber);
+
+protected:
+    virtual void periodicTask();
+    virtual bool wakeFromLongSleep() { return false; }
+    virtual bool goToLongSleep() { return false; }
+
+private:
+    /// a port this watcher opened
+    struct Managed {
+        std::string portName;
+        std::string serialNumber;
+        int portIdx;
+        bool present;
+    };
+
+    bool readEvents();
+    void scan();
+    bool matches(const std::string &hwId, std::string *serialNumber) const;
+    int choosePortIdx(const std::string &serialNumber) const;
+
+    FlexseaSerial *fxSerial;
+
+    std::mutex startMutex;
+    std::thread worker;
+    std::vector<FxHotplugRule> rules;
+    int inotifyFd;
+
+    std::vector<Managed> managed;
+    /// last port index used by a device, by serial number (or port name when it has none)
+    std::vector<std::pair<std::string, int>> lastPortIdx;
+
+    std::chrono::steady_clock::time_point nextScan;
+};
+
+#endif // FXHOTPLUG_H
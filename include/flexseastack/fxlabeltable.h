@@ -0,0 +1,55 @@
+#ifndef FXLABELTABLE_H
+#define FXLABELTABLE_H
+
+#include <cstdint>
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "flexseadevicetypes.h"
+#include "flexsea_device_spec.h"
+
+/// \brief the fields selected by one bitmap, in field id order
+struct FxActiveFields {
+    std::vector<int> fieldIds;
+    std::vector<std::string> labels;
+};
+
+/// \brief immutable field labels of a device type, shared by every device of that type
+///
+/// Tables for the types in deviceSpecs are built once and kept for the life of the process,
+/// custom devices with identical labels share a table as long as one of them exists.
+/// The active field view of each distinct bitmap is built the first time it is asked for
+/// and kept with the table, so references to it stay valid as long as the table does.
+class FxLabelTable
+{
+public:
+    /// \brief interned table of a type from deviceSpecs
+    /// throws std::invalid_argument if the spec has a missing label
+    static std::shared_ptr<const FxLabelTable> forType(FlexseaDeviceType type);
+    /// \brief interned table of a custom device's labels
+    static std::shared_ptr<const FxLabelTable> forLabels(const std::vector<std::string> &labels);
+
+    explicit FxLabelTable(const std::vector<std::string> &labels) : labels(labels) {}
+
+    const std::vector<std::string>& all() const { return labels; }
+    size_t size() const { return labels.size(); }
+
+    /// \brief the fields set in bitmap (uint32_t[FX_BITMAP_WIDTH])
+    const FxActiveFields& active(const uint32_t *bitmap) const;
+
+private:
+    typedef std::array<uint32_t, FX_BITMAP_WIDTH> Key;
+
+    const std::vector<std::string> labels;
+
+    mutable std::mutex viewMutex;
+    mutable std::map<Key, std::unique_ptr<const FxActiveFields>> views;
+};
+
+typedef std::shared_ptr<const FxLabelTable> FxLabelTablePtr;
+
+#endif // FXLABELTABLE_H
@@ -0,0 +1,42 @@
+#ifndef FXLINKBUDGET_H
+#define FXLINKBUDGET_H
+
+#include <cstdint>
+
+#include "flexseadevicetypes.h"
+#include "flexsea_device_spec.h"
+
+/// bytes per second a 115200 baud 8N1 link carries in each direction
+#define FX_DEFAULT_PORT_CAPACITY (115200 / 10)
+
+/// \brief what CommManager does with a stream the port can't carry
+enum FxRatePolicy {
+    /// start it anyway, only report the utilization
+    FX_RATE_REPORT = 0,
+    /// refuse to start it
+    FX_RATE_REJECT,
+    /// start it at the highest streaming frequency that fits (refuse if none does)
+    FX_RATE_DOWNSCALE,
+    /// start it, then thin out every stream on the port by a common factor until they all fit
+    FX_RATE_DECIMATE
+};
+
+/// \brief load of a port, in fractions of its capacity (device to host direction)
+struct FxPortUtilization {
+    /// bytes per second the port can carry
+    uint32_t capacity;
+    /// predicted from the streams' frequencies and the devices' active fields
+    float predicted;
+    /// measured over the last second
+    float measuredRx;
+    float measuredTx;
+    /// every stream on the port sends 1 sample out of this many (FX_RATE_DECIMATE)
+    int decimation;
+};
+
+/// \brief bytes on the wire for one data message of a device of this type with this bitmap
+/// active field sizes come from FORMAT_SIZE_MAP, plus message header and multi frame overhead
+/// @returns 0 for device types without a spec
+uint32_t fxSampleWireBytes(FlexseaDeviceType type, const uint32_t *bitmap);
+
+#endif // FXLINKBUDGET_H
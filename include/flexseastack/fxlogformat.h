@@ -0,0 +1,94 @@
+#ifndef FXLOGFORMAT_H
+#define FXLOGFORMAT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// \brief layout of the data written to log files
+enum FxLogFormat {
+    /// comma separated text, a new file whenever the logged fields change
+    FX_LOG_CSV = 0,
+    /// checksummed binary blocks, see below
+    FX_LOG_BLOCKS = 1
+};
+
+/// \brief block log format
+///
+/// A file starts with an 8 byte header ("FXLOG", 0, version, 0) followed by blocks.
+/// Each block is a 16 byte block header followed by its payload:
+///     uint32 magic (FX_LOG_BLOCK_MAGIC), uint8 type, uint8[3] reserved,
+///     uint32 payload length, uint32 CRC-32 of the payload
+/// Blocks are self describing, so a reader can validate each one and a file that was
+/// cut off (e.g. by a crash) is valid up to its last complete block.
+/// A SCHEMA block describes the columns of the DATA blocks following it, so a change of
+/// the logged fields is recorded in-band rather than by starting a new file.
+/// All integers are little endian.
+///
+/// SCHEMA payload: uint32 devId, uint16 devType, uint16 numColumns,
+///     then per column: int16 fieldId (-1 for additional columns), NUL terminated label
+/// DATA payload:   uint32 numRows, uint16 numColumns,
+///     then per row: uint32 timestamp, int32 value per column
+/// DEVICE_DATA payload: uint32 devId followed by a DATA payload. Used by streams carrying
+///     several devices (see FxTelemetryPublisher), where it belongs to that device's last SCHEMA
+#define FX_LOG_FILE_MAGIC "FXLOG"
+#define FX_LOG_FORMAT_VERSION 1
+#define FX_LOG_FILE_HEADER_SIZE 8
+#define FX_LOG_BLOCK_MAGIC 0x4B425846   // "FXBK"
+#define FX_LOG_BLOCK_HEADER_SIZE 16
+/// largest payload a reader accepts, anything bigger is treated as corruption
+#define FX_LOG_MAX_BLOCK_SIZE (64 << 20)
+
+enum FxLogBlockType {
+    FX_LOG_BLOCK_SCHEMA = 1,
+    FX_LOG_BLOCK_DATA = 2,
+    FX_LOG_BLOCK_DEVICE_DATA = 3
+};
+
+/// \brief one column of a SCHEMA block
+struct FxLogColumn {
+    int fieldId;
+    std::string label;
+};
+
+/// \brief appends the file header to out
+void fxLogAppendFileHeader(std::string &out);
+
+/// \brief appends a SCHEMA block to out
+void fxLogAppendSchema(std::string &out, int devId, int devType, const std::vector<FxLogColumn> &columns);
+
+/// \brief incrementally builds a DATA block
+class FxLogDataBlock
+{
+public:
+    explicit FxLogDataBlock(int numColumns);
+    /// \brief empties the block and sets its column count, keeping its buffer for reuse
+    void reset(int numColumns);
+
+    void beginRow(uint32_t timestamp);
+    void add(int32_t value);
+
+    /// \brief appends the block to out, if it holds any rows, and clears it
+    void appendTo(std::string &out);
+    /// \brief same as appendTo, as a DEVICE_DATA block
+    void appendTo(std::string &out, int devId);
+
+    uint32_t getNumRows() const { return numRows; }
+
+private:
+    std::string payload;
+    uint32_t numRows;
+    uint16_t numColumns;
+};
+
+/// \brief validates a block log file and truncates it after its last complete, valid block
+/// @param truncate if false, the file is only validated
+/// @returns the number of valid bytes (file header included), or -1 if the file is not a block log
+int64_t fxRecoverLog(const std::string &path, bool truncate = true);
+
+/// \brief converts the valid part of a block log file to CSV
+/// a new header line is written each time the schema changes
+/// @returns false if the input is not a block log or the output can't be written
+bool fxConvertLogToCsv(const std::string &inPath, const std::string &outPath);
+
+#endif // FXLOGFORMAT_H
@@ -0,0 +1,131 @@
+#ifndef FXLOGWRITER_H
+#define FXLOGWRITER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+#include "fxmempool.h"
+
+/// \brief compression applied to log files
+enum FxLogCompression {
+    FX_LOG_PLAIN = 0,
+    /// zstd streaming compression, one frame per file (requires building with FX_HAVE_ZSTD)
+    FX_LOG_ZSTD = 1
+};
+
+/// \brief how log file bytes reach the disk
+enum FxLogBackend {
+    /// buffered stdio writes
+    FX_LOG_STDIO = 0,
+    /// preallocated segments written through a memory mapping, synced asynchronously (Linux only)
+    FX_LOG_MMAP = 1
+};
+
+/// \brief everything needed to create a log file's sink
+struct FxLogSinkConfig {
+    FxLogCompression compression;
+    FxLogBackend backend;
+    /// size of the segments preallocated and mapped at a time by FX_LOG_MMAP, rounded up to whole pages
+    size_t segmentSize;
+};
+
+#define FX_LOG_DEFAULT_SEGMENT_SIZE (4 << 20)
+
+/// \brief returns whether the given compression is available in this build
+bool fxLogCompressionAvailable(FxLogCompression c);
+
+/// \brief returns whether the given backend is available on this platform
+bool fxLogBackendAvailable(FxLogBackend b);
+
+/// \brief returns the extension appended to a log file name for the given compression ("" for plain)
+const char* fxLogCompressionExtension(FxLogCompression c);
+
+/// \brief destination of a log file's bytes: a file, possibly compressed
+class FxLogSink
+{
+public:
+    virtual ~FxLogSink() {}
+
+    virtual bool open(const std::string &path) = 0;
+    virtual bool write(const char *data, size_t len) = 0;
+    virtual bool flush() = 0;
+    /// \brief finishes the file; for compressed sinks this ends the frame
+    virtual void close() = 0;
+
+    /// \brief bytes written to disk so far
+    virtual uint64_t bytesOnDisk() const = 0;
+
+    /// \brief creates a sink for the given configuration, or nullptr if it is not available
+    static FxLogSink* create(const FxLogSinkConfig &config);
+};
+
+/// \brief writes log files on a background thread
+///
+/// Callers format rows into text and hand over whole chunks; opening, compressing,
+/// writing and closing all happen on the writer's thread, in the order they were requested.
+/// The amount of data waiting to be written is bounded, chunks beyond that are dropped and counted.
+class FxAsyncLogWriter
+{
+public:
+    explicit FxAsyncLogWriter(size_t maxQueuedBytes = 64 << 20);
+    ~FxAsyncLogWriter();
+
+    /// \brief queues opening a file. The sink is created here, but opened on the writer's thread,
+    /// so preallocating or creating the file never stalls the caller
+    /// @returns a handle for the file, or -1 if the configuration isn't available.
+    /// A file that then fails to open counts as an error (see getErrorCount), and writes to it are dropped
+    int openFile(const std::string &path, const FxLogSinkConfig &config);
+    /// \brief queues data to append to an open file
+    /// @returns false if the data was dropped because the queue is full
+    bool write(int handle, std::string &&data);
+    /// \brief an empty string to format the next chunk into, reusing the buffer of a chunk already written
+    std::string takeBuffer();
+    /// \brief queues flushing a file
+    void flushFile(int handle);
+    /// \brief queues closing a file; the handle must not be used afterwards
+    void closeFile(int handle);
+
+    /// \brief blocks until everything queued so far has been written
+    void drain();
+
+    uint64_t getDroppedBytes() const { return droppedBytes; }
+    uint32_t getErrorCount() const { return errors; }
+
+private:
+    struct Command {
+        enum Op { ADOPT, WRITE, FLUSH, CLOSE } op;
+        int handle;
+        FxLogSink *sink;
+        std::string data;
+    };
+
+    void run();
+    void execute(Command &cmd);
+    void push(Command &&cmd);
+
+    std::mutex queueMutex;
+    std::condition_variable queueCV, drainedCV;
+    FxRingQueue<Command> queue;
+    size_t queuedBytes, maxQueuedBytes;
+    /// buffers of written chunks, handed back out by takeBuffer
+    std::vector<std::string> spareBuffers;
+    bool busy, quit;
+
+    // only accessed by the writer thread
+    std::unordered_map<int, std::unique_ptr<FxLogSink>> sinks;
+
+    int nextHandle;
+    std::atomic<uint64_t> droppedBytes;
+    std::atomic<uint32_t> errors;
+
+    std::thread worker;
+};
+
+#endif // FXLOGWRITER_H
@@ -0,0 +1,170 @@
+#ifndef FXMEMPOOL_H
+#define FXMEMPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/// \brief usage counters of a block pool
+struct FxPoolStats {
+    size_t blockSize;
+    size_t numBlocks;
+    size_t inUse;
+    size_t peakInUse;
+    /// allocations served from the heap because the pool was empty, unconfigured or the request too large
+    uint64_t heapFallbacks;
+};
+
+/// \brief fixed size blocks carved out of one preallocated arena
+///
+/// Requests that don't fit a block, or arrive while every block is in use, fall back to the heap
+/// and are counted, so a pool that is too small shows up in its stats rather than as a failure.
+class FxBlockPool
+{
+public:
+    explicit FxBlockPool(const char *name);
+    ~FxBlockPool();
+
+    /// \brief (re)allocates the arena; fails while any block is in use
+    bool reserve(size_t blockSize, size_t numBlocks);
+
+    void* acquire(size_t size);
+    void release(void *p);
+
+    FxPoolStats getStats() const;
+    /// \brief prints a message the first time this pool falls back to the heap
+    void setReportFallbacks(bool report) { reportFallbacks = report; }
+
+private:
+    const char *name;
+    mutable std::mutex mutex;
+    char *arena;
+    size_t blockSize, numBlocks;
+    /// reserved to numBlocks, so acquire and release never allocate
+    std::vector<void*> freeBlocks;
+
+    size_t inUse, peakInUse;
+    uint64_t heapFallbacks;
+    bool reportFallbacks;
+
+    bool owns(const void *p) const { return arena && p >= arena && p < arena + blockSize * numBlocks; }
+};
+
+/// \brief unique_ptr deleter returning memory to its pool
+struct FxPoolDeleter {
+    FxBlockPool *pool;
+    void operator()(void *p) const { if(p) pool->release(p); }
+};
+
+/// \brief std allocator over a block pool, for allocate_shared
+template<class T>
+struct FxPoolAllocator {
+    typedef T value_type;
+
+    explicit FxPoolAllocator(FxBlockPool *p) : pool(p) {}
+    template<class U> FxPoolAllocator(const FxPoolAllocator<U> &o) : pool(o.pool) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(pool->acquire(n * sizeof(T))); }
+    void deallocate(T *p, size_t) { pool->release(p); }
+
+    template<class U> bool operator==(const FxPoolAllocator<U> &o) const { return pool == o.pool; }
+    template<class U> bool operator!=(const FxPoolAllocator<U> &o) const { return pool != o.pool; }
+
+    FxBlockPool *pool;
+};
+
+/// \brief sizes of the preallocated pools, see FxMemoryPools::configure
+struct FxMemoryConfig {
+    /// outgoing frame buffers, shared by all ports
+    uint32_t messageBlocks;
+    /// devices connected at the same time; each one takes a device block and a data buffer block
+    uint32_t maxDevices;
+    /// counting mode: report the first heap fallback of each pool
+    bool reportHeapFallbacks;
+};
+
+#define FX_MESSAGE_BLOCK_SIZE 256
+#define FX_DEFAULT_MESSAGE_BLOCKS 1024
+#define FX_DEFAULT_MAX_DEVICES 16
+
+/// \brief the pools the stack allocates its long lived and per frame objects from
+///
+/// messages: outgoing frame buffers (CommManager::Message)
+/// devices: FlexseaDevice objects along with their shared_ptr control block
+/// deviceData: the data buffers (FxDevData) of devices, sized for FX_DATA_BUFFER_SIZE rows of the largest device type
+class FxMemoryPools
+{
+public:
+    static FxMemoryPools& instance();
+
+    /// \brief allocates the pools; pools with blocks in use keep their current arena
+    /// @returns false if any pool couldn't be resized
+    bool configure(const FxMemoryConfig &config);
+    bool isConfigured() const { return configured; }
+
+    /// \brief heap fallbacks summed over all pools; stays constant in a steady state that fits the pools
+    uint64_t getHeapFallbacks() const;
+
+    FxBlockPool messages;
+    FxBlockPool devices;
+    FxBlockPool deviceData;
+
+private:
+    FxMemoryPools();
+    bool configured;
+};
+
+/// \brief FIFO over a ring of preallocated slots
+/// only allocates when pushed while full, in which case it doubles its capacity
+template<class T>
+class FxRingQueue
+{
+public:
+    explicit FxRingQueue(size_t capacity = 16) : slots(capacity ? capacity : 1), head(0), count(0) {}
+
+    size_t size() const { return count; }
+    bool empty() const { return !count; }
+
+    T& front() { return slots[head]; }
+    T& back() { return slots[(head + count - 1) % slots.size()]; }
+
+    void push(T &&item)
+    {
+        if(count == slots.size())
+            grow();
+        slots[(head + count) % slots.size()] = std::move(item);
+        ++count;
+    }
+
+    /// \brief removes the front item, releasing what it holds right away
+    void pop()
+    {
+        slots[head] = T();
+        head = (head + 1) % slots.size();
+        --count;
+    }
+
+    void reserve(size_t capacity)
+    {
+        while(slots.size() < capacity)
+            grow();
+    }
+
+private:
+    void grow()
+    {
+        std::vector<T> next(slots.size() * 2);
+        for(size_t i = 0; i < count; ++i)
+            next[i] = std::move(slots[(head + i) % slots.size()]);
+        slots.swap(next);
+        head = 0;
+    }
+
+    std::vector<T> slots;
+    size_t head, count;
+};
+
+#endif // FXMEMPOOL_H
@@ -0,0 +1,132 @@
+#ifndef FXMERGEDSTREAM_H
+#define FXMERGEDSTREAM_H
+
+#include <cstdint>
+#include <climits>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+
+#include "flexseadeviceprovider.h"
+#include "fxlogwriter.h"
+
+/// \brief one column of a merged stream: a field of a device
+struct FxMergedColumn {
+    int devId;
+    int fieldId;
+};
+
+/// value of a column whose device has no sample at or before the row's time (left empty in the log file)
+#define FX_MERGE_MISSING INT32_MIN
+
+/// \brief how a column's value is picked for a bucket
+enum FxMergePolicy {
+    /// latest sample at or before the bucket time
+    FX_MERGE_LATEST = 0,
+    /// linear interpolation between the samples around the bucket time
+    FX_MERGE_INTERPOLATE = 1
+};
+
+/// \brief merges several devices' data into a single, time aligned stream
+///
+/// Samples are placed on the host timeline using each device's aligned time (see FxClockModel).
+/// Rows are emitted at a fixed period; each row holds one value per selected column.
+/// Merging is incremental: service() only consumes rows received since the previous call,
+/// and emits every bucket that all (non stalled) devices have data past.
+/// Emitted rows go to an in-memory ring, for control loops, and optionally to a single CSV log file,
+/// written by an FxAsyncLogWriter so service() never waits on the disk.
+class FxMergedStream
+{
+public:
+    FxMergedStream(FlexseaDeviceProvider *fdp, FxAsyncLogWriter *writer);
+    ~FxMergedStream();
+
+    /// \brief configures and starts merging. Returns false if a column is invalid or periodUs < 1
+    /// @param logPath if not empty, merged rows are also written to this file
+    bool start(const std::vector<FxMergedColumn> &columns, int periodUs, FxMergePolicy policy,
+               const std::string &logPath = "", size_t ringRows = 4096);
+    void stop();
+    bool isActive() const { return active; }
+
+    /// \brief consumes newly received data and emits completed rows (must be called periodically)
+    void service();
+
+    /// \brief number of columns in each row
+    size_t getNumColumns() const { return columns.size(); }
+
+    /// \brief labels of the columns, in the form "<devId>_<field label>"
+    std::vector<std::string> getColumnLabels() const;
+
+    /// \brief index the next emitted row will get. Row indices increase by one per row
+    uint64_t getNextRowIndex() const;
+
+    /// \brief copies rows with index >= fromRow into the output arrays, oldest first
+    /// @param times receives the host steady_clock time of each row, in ns (at least maxRows long)
+    /// @param values receives getNumColumns() values per row (at least maxRows * getNumColumns() long),
+    /// FX_MERGE_MISSING where the column's device had no sample yet at the row's time
+    /// @returns the number of rows copied. Rows that already left the ring are skipped
+    size_t getRows(uint64_t fromRow, size_t maxRows, int64_t *times, int32_t *values) const;
+
+private:
+    /// fixed capacity ring of a source's samples, allocated once when merging starts
+    struct History {
+        std::vector<int64_t> times;
+        std::vector<int32_t> values;    // numFields per sample
+        size_t numFields = 0, head = 0, count = 0;
+
+        void init(size_t fields, size_t capacity);
+        size_t size() const { return count; }
+        bool empty() const { return !count; }
+        int64_t t(size_t k) const { return times[(head + k) % times.size()]; }
+        const int32_t* v(size_t k) const { return &values[((head + k) % times.size()) * numFields]; }
+        /// \brief appends a sample, dropping the oldest one when full; returns where its values go
+        int32_t* push(int64_t t);
+        void dropFront(size_t k);
+    };
+
+    /// per device merge state
+    struct Source {
+        int devId;
+        std::weak_ptr<FlexseaDevice> dev;  // device nextSeq refers to; a re-added device restarts its sequence
+        std::vector<int> fieldIds;      // fields of this device that are selected
+        std::vector<size_t> colIdx;     // where they go in a merged row
+        uint64_t nextSeq;               // first row sequence number not consumed yet
+        History history;                // samples from just before the last emitted bucket onwards
+        int64_t lastArrivalNs;          // host time at which the source last produced a sample
+    };
+
+    void pull(Source &src, int64_t nowNs);
+    void emit(int64_t t);
+    void stopLocked();
+    void closeLog();
+    std::vector<std::string> labelsLocked() const;
+
+    FlexseaDeviceProvider *devProvider;
+
+    // serializes configuration changes against service()
+    mutable std::mutex stateMutex;
+
+    bool active;
+    std::vector<FxMergedColumn> columns;
+    std::vector<Source> sources;
+    FxMergePolicy policy;
+    int64_t periodNs;
+    int64_t nextBucketNs;
+
+    std::vector<int32_t> rowScratch;
+
+    // ring of emitted rows
+    mutable std::mutex ringMutex;
+    size_t ringRows, ringCols;
+    std::vector<int64_t> ringTimes;
+    std::vector<int32_t> ringValues;
+    uint64_t rowsEmitted;
+
+    FxAsyncLogWriter *logWriter;
+    int logHandle;                      // -1 if no log file is open
+    std::string logChunk;               // rows formatted during the current service() call
+    int64_t lastFlushNs;
+};
+
+#endif // FXMERGEDSTREAM_H
@@ -0,0 +1,59 @@
+#ifndef FXSHMEXPORTER_H
+#define FXSHMEXPORTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+#include "flexseadeviceprovider.h"
+#include "fxshmring.h"
+
+/// \brief mirrors every device's received rows into named POSIX shared memory rings
+///
+/// Lets other processes (a recorder, a dashboard...) read the latest samples and history
+/// while this process owns the serial ports. See fxshmring.h for the layout and the reader.
+/// Only new rows are copied on each service() call, following each device's sequence numbers.
+/// Linux only; start() fails elsewhere.
+class FxShmExporter
+{
+public:
+    explicit FxShmExporter(FlexseaDeviceProvider *fdp);
+    ~FxShmExporter();
+
+    /// \brief creates the directory segment "/prefix" and starts exporting
+    /// @param numSlots number of rows kept per device
+    bool start(const std::string &prefix, uint32_t numSlots = FX_SHM_DEFAULT_SLOTS);
+    void stop();
+    bool isActive() const { return active; }
+
+    /// \brief copies newly received rows into the rings (must be called periodically)
+    void service();
+
+private:
+    struct Segment {
+        FxShmDeviceHeader *hdr;
+        size_t size;
+        uint64_t nextSeq;       // first device row sequence number not exported yet
+        std::vector<int> fieldIds;
+    };
+
+    bool createSegment(const FxDevicePtr &dev, Segment &seg);
+    void releaseSegment(int devId, Segment &seg);
+    void exportRows(const FxDevicePtr &dev, Segment &seg);
+    void writeSchema(Segment &seg, const std::vector<int> &fids);
+    void writeDirectory();
+
+    FlexseaDeviceProvider *devProvider;
+
+    std::mutex stateMutex;
+    bool active;
+    std::string prefix;
+    uint32_t numSlots;
+
+    FxShmDirectory *dir;
+    std::unordered_map<int, Segment> segments;
+};
+
+#endif // FXSHMEXPORTER_H
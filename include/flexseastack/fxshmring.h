@@ -0,0 +1,273 @@
+#ifndef FXSHMRING_H
+#define FXSHMRING_H
+
+/// \file fxshmring.h
+/// \brief layout of the shared memory device rings, and a header-only reader for them
+///
+/// The process running the CommManager can export every device's received rows into named
+/// POSIX shared memory (see FxShmExporter). Other processes read them with FxShmDeviceReader,
+/// directly out of the mapping: this header has no dependency on the rest of the stack, link with -lrt.
+///
+/// Segments, for an export prefix P:
+///  - "/P"          directory: FxShmDirectory, the ids of the exported devices
+///  - "/P_<devId>"  one per device: FxShmDeviceHeader, then numSlots slots of FxShmSlotHeader + row
+///
+/// Rows are the device's raw rows: column 0 is the device timestamp, column 1 + i is field i.
+/// Only the fields listed in the header's active field ids carry data.
+///
+/// Reader protocol (seqlock per slot, single writer):
+///  - row n (0 based, counted since the export started) lives in slot n % numSlots
+///  - the writer sets the slot's seq to 2n+1, writes the row, then sets seq to 2n+2
+///  - a reader loads seq, uses the row, then loads seq again: the row is valid iff both loads are 2n+2
+///  - writeCount is the number of complete rows; rows older than writeCount - numSlots are gone
+/// The directory and a device's schema (labels, active fields) use the same scheme with a generation counter.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define FX_SHM_MAGIC 0x4D485346     // "FSHM"
+#define FX_SHM_VERSION 1
+#define FX_SHM_MAX_DEVICES 64
+#define FX_SHM_MAX_FIELDS 512
+#define FX_SHM_DEFAULT_SLOTS 4096
+/// room for all of a device's field labels, NUL separated
+#define FX_SHM_LABELS_SIZE 8192
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "shared memory rings need lock free (address free) atomics");
+
+struct FxShmDirectory {
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> generation;   // odd while the list is being changed
+    uint32_t numDevices;
+    int32_t devIds[FX_SHM_MAX_DEVICES];
+};
+
+struct FxShmDeviceHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t devId;
+    uint16_t devType;
+    uint16_t numColumns;                // 1 + number of fields
+    uint32_t numSlots;
+    uint32_t slotSize;                  // bytes, slot header included
+    /// cleared by the writer when the device is removed or the export stops
+    std::atomic<uint32_t> alive;
+    uint32_t reserved;
+    /// number of complete rows written
+    std::atomic<uint64_t> writeCount;
+
+    /// schema, odd while being changed
+    std::atomic<uint32_t> schemaGeneration;
+    uint32_t numActiveFields;
+    uint16_t activeFieldIds[FX_SHM_MAX_FIELDS];
+    char labels[FX_SHM_LABELS_SIZE];
+};
+
+struct FxShmSlotHeader {
+    std::atomic<uint64_t> seq;
+    /// device timestamp unwrapped onto a monotonic 64 bit timeline
+    uint64_t deviceTs;
+    /// device time mapped onto the writer's host steady_clock, in ns
+    int64_t alignedNs;
+};
+
+inline std::string fxShmDeviceName(const std::string &prefix, int devId)
+{
+    return "/" + prefix + "_" + std::to_string(devId);
+}
+
+inline size_t fxShmSlotSize(int numColumns)
+{
+    size_t s = sizeof(FxShmSlotHeader) + sizeof(uint32_t) * numColumns;
+    return (s + 7) & ~(size_t)7;
+}
+
+inline size_t fxShmDeviceSegmentSize(int numColumns, uint32_t numSlots)
+{
+    return sizeof(FxShmDeviceHeader) + fxShmSlotSize(numColumns) * numSlots;
+}
+
+#ifdef __linux__
+
+/// \brief maps a shared memory segment read only
+inline void* fxShmMapReadOnly(const std::string &name, size_t *size)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0) return nullptr;
+
+    struct stat st;
+    void *p = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && st.st_size > 0)
+        p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(p == MAP_FAILED) return nullptr;
+    *size = st.st_size;
+    return p;
+}
+
+/// \brief lists the devices exported under a prefix
+inline std::vector<int> fxShmListDevices(const std::string &prefix)
+{
+    std::vector<int> ids;
+    size_t size;
+    const FxShmDirectory *dir = (const FxShmDirectory*)fxShmMapReadOnly("/" + prefix, &size);
+    if(!dir) return ids;
+
+    if(size >= sizeof(FxShmDirectory) && dir->magic == FX_SHM_MAGIC && dir->version == FX_SHM_VERSION)
+    {
+        uint32_t g1, g2;
+        do {
+            g1 = dir->generation.load(std::memory_order_acquire);
+            uint32_t n = dir->numDevices < FX_SHM_MAX_DEVICES ? dir->numDevices : FX_SHM_MAX_DEVICES;
+            ids.assign(dir->devIds, dir->devIds + n);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            g2 = dir->generation.load(std::memory_order_relaxed);
+        } while((g1 & 1) || g1 != g2);
+    }
+
+    munmap((void*)dir, size);
+    return ids;
+}
+
+/// \brief reads one device's ring out of shared memory, without any copy other than the rows asked for
+class FxShmDeviceReader
+{
+public:
+    FxShmDeviceReader() : hdr(nullptr), size(0) {}
+    ~FxShmDeviceReader() { close(); }
+
+    FxShmDeviceReader(const FxShmDeviceReader&) = delete;
+    FxShmDeviceReader& operator=(const FxShmDeviceReader&) = delete;
+
+    bool open(const std::string &prefix, int devId)
+    {
+        close();
+        hdr = (const FxShmDeviceHeader*)fxShmMapReadOnly(fxShmDeviceName(prefix, devId), &size);
+        if(!hdr) return false;
+
+        if(size < sizeof(FxShmDeviceHeader) || hdr->magic != FX_SHM_MAGIC || hdr->version != FX_SHM_VERSION
+           || size < fxShmDeviceSegmentSize(hdr->numColumns, hdr->numSlots))
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if(hdr) munmap((void*)hdr, size);
+        hdr = nullptr;
+    }
+
+    bool isOpen() const { return hdr != nullptr; }
+    /// \brief false once the writer removed the device or stopped exporting
+    bool isAlive() const { return hdr && hdr->alive.load(std::memory_order_acquire); }
+
+    int getNumColumns() const { return hdr->numColumns; }
+    uint32_t getNumSlots() const { return hdr->numSlots; }
+
+    /// \brief index of the next row to be written (ie: one past the latest complete row)
+    uint64_t getWriteCount() const { return hdr->writeCount.load(std::memory_order_acquire); }
+
+    /// \brief copies row n into out (getNumColumns() values) and its times into the optional outputs
+    /// @returns false if the row isn't written yet or was overwritten (before or while reading)
+    bool readRow(uint64_t n, uint32_t *out, uint64_t *deviceTs = nullptr, int64_t *alignedNs = nullptr) const
+    {
+        const FxShmSlotHeader *slot = slotFor(n);
+        uint64_t expect = 2 * n + 2;
+
+        if(slot->seq.load(std::memory_order_acquire) != expect) return false;
+
+        memcpy(out, rowOf(slot), sizeof(uint32_t) * hdr->numColumns);
+        uint64_t ts = slot->deviceTs;
+        int64_t t = slot->alignedNs;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot->seq.load(std::memory_order_relaxed) != expect) return false;
+
+        if(deviceTs) *deviceTs = ts;
+        if(alignedNs) *alignedNs = t;
+        return true;
+    }
+
+    /// \brief zero copy access: pointer to row n in the mapping
+    /// the values read through it must be discarded unless isValid(n) still holds after reading them
+    const uint32_t* peekRow(uint64_t n) const { return rowOf(slotFor(n)); }
+    bool isValid(uint64_t n) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slotFor(n)->seq.load(std::memory_order_relaxed) == 2 * n + 2;
+    }
+
+    /// \brief reads the latest complete row, returns its index or -1 if there is none
+    int64_t readLatest(uint32_t *out, uint64_t *deviceTs = nullptr, int64_t *alignedNs = nullptr) const
+    {
+        for(int attempt = 0; attempt < 4; ++attempt)
+        {
+            uint64_t wc = getWriteCount();
+            if(!wc) return -1;
+            if(readRow(wc - 1, out, deviceTs, alignedNs)) return (int64_t)(wc - 1);
+        }
+        return -1;
+    }
+
+    /// \brief reads the active field ids and all field labels (indexed by field id)
+    void getSchema(std::vector<int> &activeFieldIds, std::vector<std::string> &labels) const
+    {
+        uint32_t g1, g2;
+        do {
+            g1 = hdr->schemaGeneration.load(std::memory_order_acquire);
+
+            uint32_t n = hdr->numActiveFields < FX_SHM_MAX_FIELDS ? hdr->numActiveFields : FX_SHM_MAX_FIELDS;
+            activeFieldIds.assign(hdr->activeFieldIds, hdr->activeFieldIds + n);
+
+            labels.clear();
+            const char *p = hdr->labels, *end = hdr->labels + FX_SHM_LABELS_SIZE;
+            for(int i = 0; i + 1 < hdr->numColumns && p < end; ++i)
+            {
+                size_t len = strnlen(p, end - p);
+                labels.emplace_back(p, len);
+                p += len + 1;
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            g2 = hdr->schemaGeneration.load(std::memory_order_relaxed);
+        } while((g1 & 1) || g1 != g2);
+    }
+
+    /// \brief schema generation, changes whenever getSchema would return something different
+    uint32_t getSchemaGeneration() const { return hdr->schemaGeneration.load(std::memory_order_acquire); }
+
+private:
+    const FxShmSlotHeader* slotFor(uint64_t n) const
+    {
+        const char *base = (const char*)hdr + sizeof(FxShmDeviceHeader);
+        return (const FxShmSlotHeader*)(base + (n % hdr->numSlots) * hdr->slotSize);
+    }
+
+    static const uint32_t* rowOf(const FxShmSlotHeader *slot)
+    {
+        return (const uint32_t*)(slot + 1);
+    }
+
+    const FxShmDeviceHeader *hdr;
+    size_t size;
+};
+
+#endif // __linux__
+
+#endif // FXSHMRING_H
@@ -0,0 +1,63 @@
+#ifndef FXSTREAMHEALTH_H
+#define FXSTREAMHEALTH_H
+
+#include <cstdint>
+#include <memory>
+
+#include "flexseadeviceprovider.h"
+
+/// \brief measured health of a stream
+struct FxStreamHealth {
+    int devId;
+    int cmdCode;
+    int requestedHz;
+    /// rows received per second over the last measurement window
+    float measuredHz;
+    /// standard deviation of the time between rows over the last window, in us
+    /// taken from the device's timestamps (aligned to host time), so it doesn't depend on when rows are read
+    float jitterUs;
+    bool isAuto;
+    /// an autostream the device stopped honouring, now polled with sysdata reads instead
+    bool polledFallback;
+    /// times the autostream command was sent again because of a low rate
+    uint32_t resends;
+};
+
+/// \brief what the stream health monitor does when a stream runs too slow
+struct FxStreamHealthPolicy {
+    /// a stream is unhealthy once measuredHz < minRateRatio * requestedHz
+    float minRateRatio;
+    /// measurement window, at least a few periods of the slowest stream should fit in it
+    int windowMs;
+    /// autostream commands re-sent before falling back to polling
+    int maxResends;
+    /// if false, unhealthy autostreams are only re-sent
+    bool allowFallback;
+};
+
+/// \brief measures a device's achieved row rate and timing jitter, window by window
+/// follows the device's row sequence numbers, so rows are counted even if they were overwritten before being read
+/// starts over when the device is replaced (ie: removed and added again), whose sequence restarts at 0
+class FxRateMeter
+{
+public:
+    FxRateMeter();
+
+    /// \brief consumes the rows received since the previous call
+    /// @returns true when a window of windowMs completed, rateHz and jitterUs then hold its results
+    bool update(const FxDevicePtr &dev, int windowMs, float *rateHz, float *jitterUs);
+
+private:
+    bool started;
+    std::weak_ptr<FlexseaDevice> device;
+    uint64_t nextSeq;
+    int64_t windowStartNs;
+    /// alignedNs of the last row seen
+    int64_t lastRowNs;
+
+    uint64_t rows;
+    uint64_t intervals;
+    double sum, sumSq;
+};
+
+#endif // FXSTREAMHEALTH_H
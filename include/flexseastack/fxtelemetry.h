@@ -0,0 +1,79 @@
+#ifndef FXTELEMETRY_H
+#define FXTELEMETRY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include "periodictask.h"
+#include "flexseadeviceprovider.h"
+
+/// \brief publishes received device data to other processes over a Unix domain (stream) socket
+///
+/// Any number of clients can connect to the socket. Each client receives the block log format
+/// described in fxlogformat.h, without a file header:
+///  - a SCHEMA block per device on connect and whenever the device's active fields change,
+///    labels come from FlexseaDevice::getActiveFieldLabels. A SCHEMA with no columns means the device was removed
+///  - DEVICE_DATA blocks holding the rows received since the previous batch
+/// Publishing runs on its own thread and never blocks on a client: a client that falls too far
+/// behind loses whole batches (counted), followed by its schemas being resent.
+/// Unix domain sockets are only supported on Linux; start() fails elsewhere.
+class FxTelemetryPublisher : public PeriodicTask
+{
+public:
+    explicit FxTelemetryPublisher(FlexseaDeviceProvider *fdp);
+    virtual ~FxTelemetryPublisher();
+
+    /// \brief creates the socket at socketPath (replacing a stale one) and starts publishing
+    /// @param periodMs how often received rows are batched and sent
+    bool start(const std::string &socketPath, unsigned int periodMs = 5);
+    void stop();
+    bool isActive() const { return listenFd >= 0; }
+
+    size_t getNumClients() const { return numClients; }
+    /// \brief number of batches not delivered because a client was too slow
+    uint64_t getDroppedBatches() const { return droppedBatches; }
+
+protected:
+    virtual void periodicTask();
+    virtual bool wakeFromLongSleep() { return false; }
+    virtual bool goToLongSleep() { return false; }
+
+private:
+    struct Client {
+        int fd;
+        std::string backlog;    // bytes not accepted by the socket yet
+        bool needsSchemas;
+    };
+
+    /// per device publishing state
+    struct Source {
+        uint64_t nextSeq;
+        std::vector<int> fieldIds;
+        std::string schema;     // SCHEMA block currently describing the device
+    };
+
+    void acceptClients();
+    void collect(std::string &batch);
+    void send(Client &c, const std::string &data);
+    void closeClient(Client &c);
+
+    FlexseaDeviceProvider *devProvider;
+
+    std::mutex startMutex;
+    std::string path;
+    int listenFd;
+    std::thread worker;
+
+    std::vector<Client> clients;
+    std::unordered_map<int, Source> sources;
+
+    std::atomic<size_t> numClients;
+    std::atomic<uint64_t> droppedBatches;
+};
+
+#endif // FXTELEMETRY_H
@@ -7,6 +7,9 @@
 #include <string>
 #include <mutex>
 
+// bound on a single write, so a port whose device doesn't read (ie: still booting) can't hold up the caller
+#define FX_SERIAL_WRITE_TIMEOUT_MS 10
+
 /// /brief class that handles thread-safe management of n serial ports
 ///
 /// SerialDriver wraps the libserialc library (serial/serial.h)
@@ -31,8 +34,10 @@ public:
     /// \brief writes to the corresponding port
     /// @param serial_tx_data is an array of data to write
     /// @param bytes_to_send is the length of the array serial_tx_data
+    /// returns false if the port isn't open, the write failed (the port is then closed)
+    /// or it didn't complete within FX_SERIAL_WRITE_TIMEOUT_MS
     /// throws std::out_of_range for invalid portIdx
-    virtual void write(uint8_t bytes_to_send, uint8_t *serial_tx_data, uint16_t portIdx);
+    virtual bool write(uint8_t bytes_to_send, uint8_t *serial_tx_data, uint16_t portIdx);
 
     /// \brief tries to force the serials rx/tx lines to push through any buffered data
     /// throws std::out_of_range for invalid portIdx
@@ -57,6 +62,10 @@ protected:
     /// throws std::out_of_range for invalid portIdx
     virtual bool tryOpen(const std::string &portName, uint16_t portIdx);
 
+    /// \brief called when the port fails (ie: the device was unplugged or browned out)
+    /// closes the port by default
+    virtual void portLost(uint16_t portIdx) { tryClose(portIdx); close(portIdx); }
+
     /// \brief returns the number of bytes available for reading from the corresponding port (if it is open)
     /// throws std::out_of_range for invalid portIdx
     size_t bytesAvailable(int portIdx) const;
@@ -30,6 +30,16 @@ public:
     //set high if you want more info coming through stdout
     bool runVerbose;
 
+    /// \brief adds a device with all of its fields active, fed with fake data whenever it is written to
+    /// @returns false if the id is taken
+    bool addSimulatedDevice(int id, FlexseaDeviceType type, int port=0);
+
+    /// \brief adds a device with all of its fields active, that answers whenever it is written to with
+    /// sysdata frames packed like a real device's, parsed by the regular receive path (processReceivedData)
+    /// the device's type must be described by deviceSpecs
+    /// @returns the device's id, or -1 if it is taken
+    int addPackedDevice(int shortId, FlexseaDeviceType type, int port=0);
+
     //  ***************************************
     //  overriding serial functions
     //  ***************************************
@@ -37,11 +47,11 @@ public:
     virtual bool tryOpen(const std::string &portName, uint16_t portIdx=0);
     virtual int isOpen(uint16_t portIdx=0) const;
     virtual void tryClose(uint16_t portIdx=0);
-    virtual void write(uint8_t bytes_to_send, uint8_t *serial_tx_data, uint16_t portIdx=0);
+    virtual bool write(uint8_t bytes_to_send, uint8_t *serial_tx_data, uint16_t portIdx=0);
     virtual void writeDevice(uint8_t bytes_to_send, uint8_t *serial_tx_data, const FlexseaDevice &d);
 
     // overriding flexseaserial functions
-    virtual int writeDeviceMap(const FxDevicePtr d, uint32_t* map);
+    virtual int writeDeviceMap(const FxDevicePtr d, uint32_t* map, const FxCommandStatePtr &completion = FxCommandStatePtr());
     virtual void sendDeviceWhoAmI(int port);
     virtual void serviceOpenPorts() {} // do nothing as data is fake received when written to
 
@@ -91,10 +101,16 @@ private:
     void testChangeDeviceMap();
     void testReceiveData();
     void testReceiveDataFromDevice(int id, uint32_t timestamp);
+    void receivePackedRow(const FlexseaDevice &d, uint32_t timestamp);
+
+    /// devices added by addPackedDevice
+    std::vector<int> packedDevices;
+    /// frames of a packed device's reply
+    MultiWrapper packedOut;
 
     void printData(int id,  int numFields, FX_DataPtr data);
     void printBitMap(const uint32_t* map, int numFields);
-    void printDeviceMaps(const std::vector<int>& deviceIds, const std::unordered_map<int, FxDevicePtr> &connectedDevices);
+    void printDeviceMaps(const FxDeviceRegistry &reg);
     const char TAB = '\t';
 
     std::vector<std::string> fakePortList = {"COM3", "COM2", "ttyACM0", "ttyACM1", "ttyACM2" };
@@ -1,11 +1,14 @@
 
 #include "commanager.h"
+#include "fxalloccheck.h"
+#include "fxdiag.h"
 #include "cmd-ActPack.h"
 #include "flexsea_system.h"
 #include "flexsea_comm_def.h"
 #include "revision.h"
 
 #include <thread>
+#include <mutex>
 #include <iostream>
 #include <unordered_map>
 #include <tuple>
@@ -36,15 +39,34 @@ extern "C"
 
 	typedef std::tuple<uint8_t, int32_t, uint8_t, int16_t, int16_t, int16_t, int16_t, uint8_t> CtrlParams;
 	static std::unordered_map<int, CtrlParams> ctrlsMap;
+	// ctrlsMap is written by the API functions, and read by restoreCtrls on the comm thread
+	// held only while touching the map, never across enqueueCommand (which calls sendCommandMessage)
+	static std::mutex ctrlsMutex;
 
 	CommManager* fxGetManager(void)
 	{
 		return &commManager;
 	}
 
+	void sendCommandMessage(uint8_t* buf, uint8_t* cmdCode, uint8_t* cmdType, uint16_t* len, int devId);
+
+	// a device recovered after a link loss gets its last controller settings back
+	static void restoreCtrls(int devId)
+	{
+		{
+			std::lock_guard<std::mutex> lk(ctrlsMutex);
+			if(!ctrlsMap.count(devId)) return;
+		}
+		commManager.enqueueCommand(devId, sendCommandMessage, devId);
+	}
+
 	void fxSetup()
 	{
+			if(!FxMemoryPools::instance().isConfigured())
+				FxMemoryPools::instance().configure({FX_DEFAULT_MESSAGE_BLOCKS, FX_DEFAULT_MAX_DEVICES, false});
+
 			initFlexSEAStack_minimalist(FLEXSEA_PLAN_1);
+			commManager.setRecoveryHook(restoreCtrls);
 			commManager.taskPeriod = 2;
 			commThread = new std::thread(&CommManager::runPeriodicTask, &commManager);
 	}
@@ -60,6 +82,50 @@ extern "C"
 		}
 	}
 
+	uint8_t fxSetMemoryPools(uint32_t messageBlocks, uint32_t maxDevices, bool countingMode)
+	{
+		return FxMemoryPools::instance().configure({messageBlocks, maxDevices, countingMode});
+	}
+
+	uint64_t fxGetHeapFallbacks()
+	{
+		return FxMemoryPools::instance().getHeapFallbacks();
+	}
+
+	static void readSimulatedDevice(CommManager &manager, int devId);
+
+	int64_t fxRunAllocationCheck(int numDevices, int freq, int durationMs)
+	{
+		// allocations are counted on every thread, the library's own comm thread must not be running
+		if(commThread)
+		{
+			FX_DIAG(FX_DIAG_ERROR, "fxRunAllocationCheck can't run after fxSetup");
+			return -1;
+		}
+		initFlexSEAStack_minimalist(FLEXSEA_PLAN_1);
+
+		FxSteadyStateConfig config = {numDevices, freq, true, 500, durationMs, true, readSimulatedDevice};
+		FxSteadyStateResult r = fxCheckSteadyStateAllocations(config);
+		return r.ran ? (int64_t)r.allocations : -1;
+	}
+
+	void fxSetDiagLevel(int level)
+	{
+		if(level < FX_DIAG_OFF) level = FX_DIAG_OFF;
+		if(level > FX_DIAG_DEBUG) level = FX_DIAG_DEBUG;
+		FxDiagLog::instance().setLevel((FxDiagLevel)level);
+	}
+
+	uint8_t fxSetDiagOutput(const char* path)
+	{
+		return FxDiagLog::instance().setOutput(path);
+	}
+
+	void fxSetDiagCallback(void (*callback)(int level, const char* message))
+	{
+		FxDiagLog::instance().setCallback(callback);
+	}
+
 	// open serial port named portName at portIdx [0-3],
 	void fxOpen(char* portName, int portIdx)
 	{
@@ -79,6 +145,37 @@ extern "C"
 		commManager.close(portIdx);
 	}
 
+	uint8_t fxStartAutoConnect(int vid, int pid, const char* serialNumber)
+	{
+		FxHotplugRule rule = {(uint16_t)vid, (uint16_t)pid, serialNumber ? serialNumber : ""};
+		return commManager.startAutoConnect({rule});
+	}
+
+	void fxStopAutoConnect()
+	{
+		commManager.stopAutoConnect();
+	}
+
+	void fxSetLinkRecovery(uint8_t enable, int timeoutMs)
+	{
+		commManager.setLinkRecovery(enable, timeoutMs);
+	}
+
+	int fxGetLastDowntime(int portIdx)
+	{
+		return commManager.getLinkStats(portIdx).lastDowntimeMs;
+	}
+
+	int fxGetDiscoveryTime(int portIdx)
+	{
+		return commManager.getPortDiscovery(portIdx).timeToMetadataMs;
+	}
+
+	uint32_t fxGetResyncCount(int portIdx)
+	{
+		return commManager.getPortRxStats(portIdx).resyncs;
+	}
+
 	// get the ids of all connected FlexSEA devices
 	// idarray should contain enough space for the function to read into it
 	// n should provide the length of the input idarray
@@ -106,29 +203,37 @@ extern "C"
 
 	void sendCommandMessage(uint8_t* buf, uint8_t* cmdCode, uint8_t* cmdType, uint16_t* len, int devId)
 	{
-		if(!ctrlsMap.count(devId))
+		CtrlParams ctrls;
 		{
-			std::cout << "Something wrong, no ctrls map for selected device\n";
-			return;
-		}
+			std::lock_guard<std::mutex> lk(ctrlsMutex);
+			auto it = ctrlsMap.find(devId);
+			if(it == ctrlsMap.end())
+			{
+				FX_DIAG(FX_DIAG_WARN, "Something wrong, no ctrls map for device %d", devId);
+				return;
+			}
 
-		auto ctrls = ctrlsMap.at(devId);
+			ctrls = it->second;
+			// gains are sent once
+			std::get<2>(it->second) = KEEP;
+		}
 
 		tx_cmd_actpack_rw(buf, cmdCode, cmdType, len,
 				0,					std::get<0>(ctrls), std::get<1>(ctrls),
 				std::get<2>(ctrls), std::get<3>(ctrls), std::get<4>(ctrls),
 				std::get<5>(ctrls), std::get<6>(ctrls), std::get<7>(ctrls)
 				);
-
-		std::get<2>(ctrlsMap.at(devId)) = KEEP;
 	}
 
 	// start streaming data from device with id: devId, with given configuration
 	uint8_t fxStartStreaming(int devId, int freq, bool shouldLog, int shouldAuto)
 	{
 		if(!commManager.haveDevice(devId)) return 0;
-		if(!ctrlsMap.count(devId))
+		{
+			std::lock_guard<std::mutex> lk(ctrlsMutex);
+			if(!ctrlsMap.count(devId))
 				ctrlsMap.insert({devId, defaultCtrlParams()});
+		}
 
 		// stream reading and commands at same rate
 		commManager.startStreaming(devId, freq, shouldLog, shouldAuto);
@@ -154,33 +259,55 @@ extern "C"
 		return !commManager.writeDeviceMap(devId, m);
 	}
 
+	void fxSetBitmapMinimizer(uint8_t enable)
+	{
+		commManager.setBitmapMinimizer(enable);
+	}
+
+	// with the bitmap minimizer, fields read but not streamed are streamed from now on
+	// the minimizer is only asked when a field is missing, so a steady read takes no lock
+	static void widenForRead(CommManager &manager, int devId, const std::vector<int> &activeIds, const int *fieldIds, int n)
+	{
+		if(!manager.isBitmapMinimizerOn()) return;
+
+		for(int i = 0; i < n; i++)
+		{
+			if(std::find(activeIds.begin(), activeIds.end(), fieldIds[i]) == activeIds.end())
+			{
+				manager.widenFieldMap(devId, fieldIds, n);
+				return;
+			}
+		}
+	}
+
 	const int MAX_L = 100;
 	int devData[MAX_L];
 	int devDataPriv[MAX_L];
 
-	int* fxReadDevice(int devId, int* fieldIds, uint8_t* success, int n)
+	// fxReadDevice and fxReadDeviceEx on a given manager, fxRunAllocationCheck reads its simulated devices with them
+	static int* readDevice(CommManager &manager, int devId, int* fieldIds, uint8_t* success, int n)
 	{
-		auto dev = commManager.getDevicePtr(devId);
+		auto dev = manager.getDevicePtr(devId);
 		memset(success, 0, n);
 		if(!dev)
 		{
-			std::cout << "Device does not exist" << std::endl;
+			FX_DIAG(FX_DIAG_WARN, "Device %d does not exist", devId);
 			return &devData[0];
 		}
 		if(!dev->hasData())
 		{
-			std::cout << "Device does not have data" << std::endl;
+			FX_DIAG(FX_DIAG_WARN, "Device %d does not have data", devId);
 			return &devData[0];
 		}
 		if(dev->getDataPtr( dev->dataCount()-1, (FX_DataPtr)devDataPriv, MAX_L ) == 0)
 		{
-			std::cout << "Failed to read device data" << std::endl;
+			FX_DIAG(FX_DIAG_ERROR, "Failed to read device %d data", devId);
 			return &devData[0];
 		}
 
-		auto activeIds = dev->getActiveFieldIds();
+		const auto &activeIds = dev->getActiveFieldIds();
+		widenForRead(manager, devId, activeIds, fieldIds, n);
 
-		
 		for(int i = 0; i < n; i++)
 		{
 			auto it = std::find(activeIds.begin(), activeIds.end(), fieldIds[i]);
@@ -191,14 +318,13 @@ extern "C"
 			}
 			else
 			{
-				std::cout << "Requested field not found" << std::endl;
+				FX_DIAG(FX_DIAG_WARN, "Requested field %d not found", fieldIds[i]);
 				devData[i] = 0;
 			}
 		}
-		fflush(stdout);
 		return &devData[0];
 	}
-	int fxReadDeviceEx(int devId, int* fieldIds, uint8_t* success, int* dataBuffer, int n)
+	static int readDeviceEx(CommManager &manager, int devId, int* fieldIds, uint8_t* success, int* dataBuffer, int n)
 	{
 		// Initialize return values (ensure theya re all set to false)
 		memset(success, 0, n);
@@ -207,28 +333,29 @@ extern "C"
 		// Check input parameters
 		if(!dataBuffer)
 		{
-			std::cout << "Invalid Input buffer or size" << std::endl;
+			FX_DIAG(FX_DIAG_ERROR, "Invalid Input buffer or size");
 			return returnCount;
 		}
-		auto dev = commManager.getDevicePtr(devId);
+		auto dev = manager.getDevicePtr(devId);
 		if(!dev)
 		{
-			std::cout << "Device does not exist" << std::endl;
+			FX_DIAG(FX_DIAG_WARN, "Device %d does not exist", devId);
 			return returnCount;
 		}
 		if(!dev->hasData())
 		{
-			std::cout << "Device does not have data" << std::endl;
+			FX_DIAG(FX_DIAG_WARN, "Device %d does not have data", devId);
 			return returnCount;
 		}
 		if(dev->getDataPtr( dev->dataCount()-1, (FX_DataPtr)devDataPriv, MAX_L ) == 0)
 		{
-			std::cout << "Failed to read device data" << std::endl;
+			FX_DIAG(FX_DIAG_ERROR, "Failed to read device %d data", devId);
 			return returnCount;
 		}
 
 		// We know we have data and a place to put it
-		auto activeIds = dev->getActiveFieldIds();
+		const auto &activeIds = dev->getActiveFieldIds();
+		widenForRead(manager, devId, activeIds, fieldIds, n);
 		for(int i = 0; i < n; i++)
 		{
 			auto it = std::find(activeIds.begin(), activeIds.end(), fieldIds[i]);
@@ -239,7 +366,7 @@ extern "C"
 			}
 			else
 			{
-				std::cout << "Requested field not found ex" << std::endl;
+				FX_DIAG(FX_DIAG_WARN, "Requested field %d not found", fieldIds[i]);
 				dataBuffer[i] = 0;
 			}
 
@@ -247,22 +374,47 @@ extern "C"
 			returnCount++;
 		}
 
-		fflush(stdout);
 		return returnCount;
 	}
 
+	int* fxReadDevice(int devId, int* fieldIds, uint8_t* success, int n)
+	{
+		return readDevice(commManager, devId, fieldIds, success, n);
+	}
+	int fxReadDeviceEx(int devId, int* fieldIds, uint8_t* success, int* dataBuffer, int n)
+	{
+		return readDeviceEx(commManager, devId, fieldIds, success, dataBuffer, n);
+	}
+
+	// reads a simulated device the way an application does, see fxRunAllocationCheck
+	static void readSimulatedDevice(CommManager &manager, int devId)
+	{
+		static int fieldIds[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+		static uint8_t success[16];
+		static int data[16];
+
+		readDevice(manager, devId, fieldIds, success, 16);
+		readDeviceEx(manager, devId, fieldIds, success, data, 16);
+	}
+
 	// -- control functions
 	void setControlMode(int devId, int ctrlMode)
 	{
-		if(!ctrlsMap.count(devId)) return;
-		std::get<0> ( ctrlsMap.at(devId) ) = ctrlMode;
+		{
+			std::lock_guard<std::mutex> lk(ctrlsMutex);
+			if(!ctrlsMap.count(devId)) return;
+			std::get<0> ( ctrlsMap.at(devId) ) = ctrlMode;
+		}
 		commManager.enqueueCommand(devId, sendCommandMessage, devId);
 	}
 
 	void setMotorVoltage(int devId, int mV)
 	{
-		if(!ctrlsMap.count(devId)) return;
-		std::get<1> ( ctrlsMap.at(devId) ) = mV;
+		{
+			std::lock_guard<std::mutex> lk(ctrlsMutex);
+			if(!ctrlsMap.count(devId)) return;
+			std::get<1> ( ctrlsMap.at(devId) ) = mV;
+		}
 		commManager.enqueueCommand(devId, sendCommandMessage, devId);
 	}
 	
@@ -290,28 +442,40 @@ extern "C"
 	
 	void setMotorCurrent(int devId, int cur)
 	{
-		if(!ctrlsMap.count(devId)) return;
-		std::get<1> ( ctrlsMap.at(devId) ) = cur;
+		{
+			std::lock_guard<std::mutex> lk(ctrlsMutex);
+			if(!ctrlsMap.count(devId)) return;
+			std::get<1> ( ctrlsMap.at(devId) ) = cur;
+		}
 		commManager.enqueueCommand(devId, sendCommandMessage, devId);
 	}
 
 	void setPosition( int devId, int pos )
 	{
-		if(!ctrlsMap.count(devId)) return;
-		std::get<1> ( ctrlsMap.at(devId) ) = pos;
+		{
+			std::lock_guard<std::mutex> lk(ctrlsMutex);
+			if(!ctrlsMap.count(devId)) return;
+			std::get<1> ( ctrlsMap.at(devId) ) = pos;
+		}
 		commManager.enqueueCommand(devId, sendCommandMessage, devId);
 	}
 
 	void setGains(int devId, int g0, int g1, int g2, int g3)
 	{
-		if(!ctrlsMap.count(devId)) return;
-		get_tuple<2,3,4,5,6>( ctrlsMap.at(devId) ) = std::make_tuple(CHANGE, g0, g1, g2, g3);
+		{
+			std::lock_guard<std::mutex> lk(ctrlsMutex);
+			if(!ctrlsMap.count(devId)) return;
+			get_tuple<2,3,4,5,6>( ctrlsMap.at(devId) ) = std::make_tuple(CHANGE, g0, g1, g2, g3);
+		}
 		commManager.enqueueCommand(devId, sendCommandMessage, devId);
 	}
 
 	void actPackFSM2(int devId, int on)
 	{
-		get_tuple<0,7>( ctrlsMap.at(devId) ) = std::make_tuple(CTRL_NONE, on ? SYS_NORMAL : SYS_DISABLE_FSM2);
+		{
+			std::lock_guard<std::mutex> lk(ctrlsMutex);
+			get_tuple<0,7>( ctrlsMap.at(devId) ) = std::make_tuple(CTRL_NONE, on ? SYS_NORMAL : SYS_DISABLE_FSM2);
+		}
 		commManager.enqueueCommand(devId, sendCommandMessage, devId);
 	}
 
@@ -331,6 +495,69 @@ extern "C"
 		}
 	}
 
+	uint8_t fxGetStreamHealth(int devId, float* measuredHz, float* jitterUs)
+	{
+		for(auto &&h : commManager.getStreamHealth())
+		{
+			if(h.devId != devId) continue;
+
+			if(measuredHz) *measuredHz = h.measuredHz;
+			if(jitterUs) *jitterUs = h.jitterUs;
+			return 1;
+		}
+		return 0;
+	}
+
+	void fxSetRatePolicy(int policy, float maxUtilization)
+	{
+		if(policy < FX_RATE_REPORT || policy > FX_RATE_DECIMATE) return;
+		commManager.setRateControl(static_cast<FxRatePolicy>(policy), maxUtilization);
+	}
+
+	uint8_t fxGetPortUtilization(int portIdx, float* predicted, float* measured)
+	{
+		if(portIdx < 0 || portIdx >= FX_NUMPORTS) return 0;
+
+		FxPortUtilization u = commManager.getPortUtilization(portIdx);
+		if(predicted) *predicted = u.predicted;
+		if(measured) *measured = u.measuredRx;
+		return 1;
+	}
+
+	uint8_t fxStartTelemetry(const char* socketPath)
+	{
+		if(!socketPath) return 0;
+		return commManager.startTelemetry(socketPath);
+	}
+
+	void fxStopTelemetry()
+	{
+		commManager.stopTelemetry();
+	}
+
+	uint8_t fxStartSharedMemoryExport(const char* prefix)
+	{
+		if(!prefix) return 0;
+		return commManager.startSharedMemoryExport(prefix);
+	}
+
+	void fxStopSharedMemoryExport()
+	{
+		commManager.stopSharedMemoryExport();
+	}
+
+	int64_t fxRecoverLogFile(const char* path)
+	{
+		if(!path) return -1;
+		return fxRecoverLog(path);
+	}
+
+	uint8_t fxLogFileToCsv(const char* inPath, const char* outPath)
+	{
+		if(!inPath || !outPath) return 0;
+		return fxConvertLogToCsv(inPath, outPath);
+	}
+
 	const char* fxGetRevision( LIB_REVISION_E whichLib )
 	{
 		std::string ptr;
@@ -2,7 +2,6 @@
 
 #include <chrono>
 #include <thread>
-#include <iostream>
 #include <cstring>
 #include "comm_string_generation.h"
 
@@ -16,7 +15,42 @@ extern "C" {
 namespace csg = CommStringGeneration;
 
 CommManager::CommManager() : FlexseaSerial()
+	, linkRecoveryEnabled(false)
+	, recoveryTimeoutMs(10000)
+	, recoveryHookHandle(-1)
+	, ratePolicy(FX_RATE_REPORT)
+	, maxUtilization(0.9f)
+	, lastUtilUpdate(std::chrono::steady_clock::now())
+	, minimizeBitmaps(false)
 {
+	for(int i = 0; i < FX_NUMPORTS; i++)
+	{
+		portCapacity[i] = FX_DEFAULT_PORT_CAPACITY;
+		portDecimation[i] = 1;
+		portUtil[i] = FxPortUtilization();
+		portUtil[i].capacity = FX_DEFAULT_PORT_CAPACITY;
+		portUtil[i].decimation = 1;
+		portTxBytes[i] = 0;
+		lastRxBytes[i] = lastTxBytes[i] = 0;
+		// a multi frame packet may briefly push a queue past MAX_Q_SIZE
+		outgoingBuffer[i].reserve(MAX_Q_SIZE + 16);
+	}
+
+	healthPolicy.minRateRatio = 0.5f;
+	healthPolicy.windowMs = 1000;
+	healthPolicy.maxResends = 2;
+	healthPolicy.allowFallback = true;
+	healthStreamed.reserve(FX_DEFAULT_MAX_DEVICES);
+	healthFallbacks.reserve(FX_DEFAULT_MAX_DEVICES);
+	healthScratch.reserve(4 * FX_DEFAULT_MAX_DEVICES);
+	healthReport.reserve(4 * FX_DEFAULT_MAX_DEVICES);
+
+	for(int i = 0; i < FX_NUMPORTS; i++)
+	{
+		linkStats[i] = FxLinkStats();
+		linkStats[i].lastDowntimeMs = -1;
+	}
+
 	//this needs to be in order from smallest to largest
 	int timerFreqsInHz[NUM_TIMER_FREQS] = {1, 5, 10, 20, 33, 50, 100, 200, 300, 500, 1000};
 	for(int i = 0; i < NUM_TIMER_FREQS; i++)
@@ -30,16 +64,33 @@ CommManager::CommManager() : FlexseaSerial()
 	streamCount = 0;
 
 	dataLogger = new DataLogger(this);
+	mergedStream = new FxMergedStream(this, dataLogger->getWriter());
+	telemetry = new FxTelemetryPublisher(this);
+	shmExporter = new FxShmExporter(this);
+	hotplug = new FxHotplugWatcher(this);
 }
 
 CommManager::~CommManager(){
 
+	// first, so that nothing gets reopened
+	if(hotplug) delete hotplug;
+	hotplug = nullptr;
+
 	for(int i = 0; i < FX_NUMPORTS; ++i)
 	{
 		if(isOpen(i))
 			close(i);
 	}
 
+	if(shmExporter) delete shmExporter;
+	shmExporter = nullptr;
+
+	if(telemetry) delete telemetry;
+	telemetry = nullptr;
+
+	if(mergedStream) delete mergedStream;
+	mergedStream = nullptr;
+
 	if(dataLogger) delete dataLogger;
 	dataLogger = nullptr;
 }
@@ -88,15 +139,24 @@ bool CommManager::startStreaming(int devId, int freq, bool shouldLog, int should
 		return false;
 	}
 
-	std::cout << "Started " << (shouldLog ? " logged " : "") << (shouldAuto ? "auto" : "") << "streaming cmd: " << (int)cmdCode << ", for slave id: " << devId << " at frequency: " << freq << std::endl;
-	if(shouldAuto)
 	{
-		sendAutoStream(devId, cmdCode, 1000 / freq, true);
-		autoStreamLists[indexOfFreq].emplace_back(devId, (int)cmdCode, shouldLog, nullptr);
-	}
-	else
-	{
-		streamLists[indexOfFreq].emplace_back(devId, (int)cmdCode, shouldLog, nullptr);
+		std::lock_guard<std::recursive_mutex> lk(streamMutex);
+		freq = admitStream(devId, freq);
+		if(freq < 0)
+			return false;
+		indexOfFreq = getIndexOfFrequency(freq);
+
+		FX_DIAG(FX_DIAG_INFO, "Started %s%sstreaming cmd: %d, for slave id: %d at frequency: %d",
+				shouldLog ? "logged " : "", shouldAuto ? "auto" : "", (int)cmdCode, devId, freq);
+		if(shouldAuto)
+		{
+			sendAutoStream(devId, cmdCode, 1000 / freq, true);
+			autoStreamLists[indexOfFreq].emplace_back(devId, (int)cmdCode, shouldLog, nullptr);
+		}
+		else
+		{
+			streamLists[indexOfFreq].emplace_back(devId, (int)cmdCode, shouldLog, nullptr);
+		}
 	}
 
 	// increase stream count only for regular streaming
@@ -119,6 +179,9 @@ bool CommManager::startStreaming(int devId, int freq, bool shouldLog, int should
 		dataLogger->startLogging(devId, true);
 	}
 
+	FxDevicePtr d = getDevicePtr(devId);
+	if(d) rebalancePort(d->port);
+
 	return true;
 }
 
@@ -127,13 +190,17 @@ int CommManager::startStreaming(int devId, int freq, bool shouldLog, const Strea
 	static int cmdCodeBase = CMD_CODE_BASE;
 
 	int idx = getIndexOfFrequency(freq);
-	if(idx < 0 || !connectedDevices.count(devId))
+	if(idx < 0 || !haveDevice(devId))
 		return -1;
 
 	++cmdCodeBase;
 
-	std::cout << "Started " << (shouldLog ? " logged " : "") << "streaming cmd: custom for slave id: " << devId << " at frequency: " << freq << std::endl;
-	streamLists[idx].emplace_back(devId, cmdCodeBase, shouldLog, new StreamFunc(streamFunc));
+	FX_DIAG(FX_DIAG_INFO, "Started %sstreaming cmd: custom for slave id: %d at frequency: %d",
+			shouldLog ? "logged " : "", devId, freq);
+	{
+		std::lock_guard<std::recursive_mutex> lk(streamMutex);
+		streamLists[idx].emplace_back(devId, cmdCodeBase, shouldLog, new StreamFunc(streamFunc));
+	}
 
 	if(shouldLog)
 	{
@@ -158,9 +225,12 @@ int CommManager::startStreaming(int devId, int freq, bool shouldLog, const Strea
 
 bool CommManager::stopStreaming(int devId, int cmdCode)
 {
+	FxDevicePtr d = getDevicePtr(devId);
+
 	StreamList* listArray[2] = {autoStreamLists, streamLists};
 
 	bool found = false;
+	std::lock_guard<std::recursive_mutex> lk(streamMutex);
 
 	for(int listIndex = 0; listIndex < 2; listIndex++)
 	{
@@ -187,12 +257,12 @@ bool CommManager::stopStreaming(int devId, int cmdCode)
 						streamCount--;
 					}
 
-					std::cout << "Stopped " << (listIndex == 0 ? "autostreaming" : "streaming");
-					if(record.cmdCode > 0) std::cout << " cmd: " << record.cmdCode;
-					else std::cout << " cmd: custom";
-
-					std::cout << ", for slave id: " << devId
-							  << " at frequency: " << timerFrequencies[indexOfFreq] << std::endl;
+					if(record.cmdCode > 0)
+						FX_DIAG(FX_DIAG_INFO, "Stopped %s cmd: %d, for slave id: %d at frequency: %d",
+								listIndex == 0 ? "autostreaming" : "streaming", record.cmdCode, devId, timerFrequencies[indexOfFreq]);
+					else
+						FX_DIAG(FX_DIAG_INFO, "Stopped %s cmd: custom, for slave id: %d at frequency: %d",
+								listIndex == 0 ? "autostreaming" : "streaming", devId, timerFrequencies[indexOfFreq]);
 
 					found = true;
 
@@ -205,22 +275,34 @@ bool CommManager::stopStreaming(int devId, int cmdCode)
 		}
 	}
 
+	if(found && d)
+		rebalancePort(d->port);
+
 	return found;
 }
 
 void CommManager::periodicTask()
 {
+	reclaimRetiredDevices();
 	serviceStreams(taskPeriod);
-	serviceOpenAttempts(taskPeriod);
+	serviceOpenAttempts();
+	serviceRecoveries();
 
 	if(serviceCount % 4 == 0)
 	{
 	   serviceOpenPorts();
+	   mergedStream->service();
+	   shmExporter->service();
 	}
 	if(dataLogger && serviceCount % 10 == 0)
 	{
 		dataLogger->serviceLogs();
 	}
+	if(serviceCount % 10 == 5)
+	{
+		serviceStreamHealth();
+		serviceUtilization();
+	}
 
 	serviceCount++;
 }
@@ -230,6 +312,7 @@ void CommManager::serviceStreams(uint8_t milliseconds)
 	const float TOLERANCE = 0.0001;
 	int i;
 
+	std::unique_lock<std::recursive_mutex> streamLock(streamMutex);
 	for(i = 0; i < NUM_TIMER_FREQS; i++)
 	{
 		if(!streamLists[i].size()) continue;
@@ -246,19 +329,651 @@ void CommManager::serviceStreams(uint8_t milliseconds)
 				msSinceLast[i] -= timerInterval;
 		}
 	}
+	streamLock.unlock();
 
     for(i = 0; i < FX_NUMPORTS; ++i)
     {
+		FxCommandStatePtr sent;
+		bool written = false;
 		mtOGBuffer.lock();
         if(outgoingBuffer[i].size())
         {
             auto& m = outgoingBuffer[i].front();
-            this->write(m.numBytes, m.dataPacket.get(), i);
+			// a command that already timed out is not sent late
+			if(!m.completion || !m.completion->isFinal())
+			{
+				written = this->write(m.numBytes, m.dataPacket.get(), i);
+				if(written)
+					portTxBytes[i] += m.numBytes;
+			}
+			sent = m.completion;
             outgoingBuffer[i].pop();
         }
 		mtOGBuffer.unlock();
+
+		// resolved outside the lock, callbacks may enqueue more commands
+		if(sent)
+			sent->resolve(written ? FX_CMD_SENT : FX_CMD_FAILED);
     }
 
+	serviceCommands();
+}
+
+FxCommandStatePtr CommManager::newCommand(int devId, bool awaitConfirmation, int timeoutMs) const
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs > 0 ? timeoutMs : 0);
+	return std::make_shared<FxCommandState>(devId, awaitConfirmation, deadline);
+}
+
+void CommManager::trackCommand(const FxCommandStatePtr &cmd)
+{
+	{
+		std::lock_guard<std::mutex> lk(commandMutex);
+		trackedCommands.push_back(cmd);
+	}
+
+	// make sure the comm thread is awake to send it and to time it out
+	wakeCV.notify_all();
+}
+
+void CommManager::serviceCommands()
+{
+	std::vector<FxCommandStatePtr> expired;
+	{
+		std::lock_guard<std::mutex> lk(commandMutex);
+		if(trackedCommands.empty()) return;
+
+		auto now = std::chrono::steady_clock::now();
+		auto it = trackedCommands.begin();
+		while(it != trackedCommands.end())
+		{
+			if((*it)->isFinal())
+			{
+				it = trackedCommands.erase(it);
+			}
+			else if(now >= (*it)->deadline)
+			{
+				expired.push_back(*it);
+				it = trackedCommands.erase(it);
+			}
+			else
+				++it;
+		}
+	}
+
+	for(auto &&c : expired)
+		c->resolve(FX_CMD_TIMEOUT);
+}
+
+void CommManager::deviceMetadataReceived(int devId)
+{
+	FxDevicePtr d = getDevicePtr(devId);
+	if(!d) return;
+
+	uint32_t bitmap[FX_BITMAP_WIDTH];
+	d->getBitmap(bitmap);
+
+	std::vector<FxCommandStatePtr> confirmed;
+	{
+		std::lock_guard<std::mutex> lk(commandMutex);
+		for(auto &&c : trackedCommands)
+		{
+			if(c->devId == devId && c->awaitsConfirmation && c->getStatus() == FX_CMD_SENT
+			   && !memcmp(c->expectedBitmap, bitmap, sizeof(bitmap)))
+				confirmed.push_back(c);
+		}
+	}
+
+	for(auto &&c : confirmed)
+		c->resolve(FX_CMD_CONFIRMED);
+
+	// a device coming back after a link loss, restored by serviceRecoveries once out of the packet handler
+	bool haveRestore = false;
+	int downtimeMs = -1;
+	{
+		std::lock_guard<std::mutex> lk(recoveryMutex);
+		for(auto it = recoveries.begin(); it != recoveries.end(); ++it)
+		{
+			if(it->portIdx != d->port) continue;
+
+			bool allRestored = true;
+			for(auto &s : it->devices)
+			{
+				if(s.devId == devId && !s.restored)
+				{
+					pendingRestores.push_back(s);
+					s.restored = true;
+					haveRestore = true;
+				}
+				allRestored &= s.restored;
+			}
+
+			if(allRestored && haveRestore)
+			{
+				auto dt = std::chrono::steady_clock::now() - it->lostAt;
+				downtimeMs = (int)std::chrono::duration_cast<std::chrono::milliseconds>(dt).count();
+
+				FxLinkStats &st = linkStats[it->portIdx];
+				st.recoveries++;
+				st.lastDowntimeMs = downtimeMs;
+				st.totalDowntimeMs += downtimeMs;
+				st.recovering = false;
+
+				recoveries.erase(it);
+			}
+			break;
+		}
+	}
+
+	if(downtimeMs >= 0)
+		FX_DIAG(FX_DIAG_INFO, "Port %d recovered after %d ms", d->port, downtimeMs);
+}
+
+void CommManager::portLost(uint16_t portIdx)
+{
+	LinkRecovery r;
+	bool recover;
+	{
+		std::lock_guard<std::mutex> lk(recoveryMutex);
+		recover = linkRecoveryEnabled;
+	}
+
+	std::vector<int> ids = getDeviceIds(portIdx);
+	if(recover && !ids.empty())
+	{
+		r.portIdx = portIdx;
+		r.portName = getPortName(portIdx);
+
+		// remember what close() is about to tear down
+		for(int id : ids)
+		{
+			FxDevicePtr d = getDevicePtr(id);
+			if(!d) continue;
+
+			SavedDevice s;
+			s.devId = id;
+			s.restored = false;
+			d->getBitmap(s.bitmap);
+
+			StreamList* listArray[2] = {autoStreamLists, streamLists};
+			std::lock_guard<std::recursive_mutex> streamLock(streamMutex);
+			for(int listIndex = 0; listIndex < 2; listIndex++)
+			{
+				for(int indexOfFreq = 0; indexOfFreq < NUM_TIMER_FREQS; indexOfFreq++)
+				{
+					for(auto &&record : listArray[listIndex][indexOfFreq])
+					{
+						if(record.devId != id) continue;
+						SavedStream ss = {timerFrequencies[indexOfFreq], record.cmdCode, record.shouldLog,
+										  listIndex == 0, record.func ? *record.func : StreamFunc()};
+						s.streams.push_back(ss);
+					}
+				}
+			}
+
+			r.devices.push_back(s);
+		}
+	}
+
+	tryClose(portIdx);
+	close(portIdx);
+
+	for(int id : ids)
+		events.post(FX_EVENT_LINK_LOST, id);
+
+	if(r.devices.empty()) return;
+
+	FX_DIAG(FX_DIAG_WARN, "Lost port %d, trying to recover %d device(s)", (int)portIdx, (int)r.devices.size());
+	r.lostAt = std::chrono::steady_clock::now();
+	r.nextAttempt = r.lostAt;
+
+	std::lock_guard<std::mutex> lk(recoveryMutex);
+	linkStats[portIdx].linkLosses++;
+	linkStats[portIdx].recovering = true;
+	recoveries.push_back(r);
+}
+
+void CommManager::serviceRecoveries()
+{
+	std::vector<std::pair<std::string, int>> toOpen;
+	std::vector<SavedDevice> toRestore;
+	auto now = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lk(recoveryMutex);
+		toRestore.swap(pendingRestores);
+		if(recoveries.empty() && toRestore.empty()) return;
+
+		for(auto it = recoveries.begin(); it != recoveries.end(); )
+		{
+			if(now - it->lostAt > std::chrono::milliseconds(recoveryTimeoutMs))
+			{
+				FX_DIAG(FX_DIAG_WARN, "Giving up on recovering port %d", it->portIdx);
+				linkStats[it->portIdx].failedRecoveries++;
+				linkStats[it->portIdx].recovering = false;
+				it = recoveries.erase(it);
+				continue;
+			}
+
+			if(now >= it->nextAttempt)
+			{
+				toOpen.emplace_back(it->portName, it->portIdx);
+				it->nextAttempt = now + std::chrono::milliseconds(250);
+			}
+			++it;
+		}
+	}
+
+	for(auto &&s : toRestore)
+	{
+		restoreDevice(s);
+		// the recovery hook is subscribed to this event
+		events.post(FX_EVENT_LINK_RESTORED, s.devId);
+	}
+
+	// open() does I/O, so it's called without holding recoveryMutex
+	for(auto &&p : toOpen)
+	{
+		if(!isOpen(p.second) && getPortState(p.second) != serial::state_opening)
+			open(p.first, p.second);
+	}
+}
+
+void CommManager::restoreDevice(const SavedDevice &saved)
+{
+	FxDevicePtr d = getDevicePtr(saved.devId);
+	if(!d) return;
+
+	uint32_t bitmap[FX_BITMAP_WIDTH];
+	d->getBitmap(bitmap);
+	if(memcmp(bitmap, saved.bitmap, sizeof(bitmap)))
+	{
+		uint32_t map[FX_BITMAP_WIDTH];
+		memcpy(map, saved.bitmap, sizeof(map));
+		writeDeviceMap(d, map);
+	}
+
+	for(auto &&s : saved.streams)
+	{
+		if(!s.func)
+		{
+			startStreaming(saved.devId, s.freq, s.shouldLog, s.isAuto, (uint8_t)s.cmdCode);
+			continue;
+		}
+
+		// custom streams keep their command code, it's the caller's handle for stopStreaming
+		int idx = getIndexOfFrequency(s.freq);
+		{
+			std::lock_guard<std::recursive_mutex> lk(streamMutex);
+			streamLists[idx].emplace_back(saved.devId, s.cmdCode, s.shouldLog, new StreamFunc(s.func));
+		}
+		if(s.shouldLog)
+			dataLogger->startLogging(saved.devId, true);
+
+		std::lock_guard<std::mutex> l(conditionMutex);
+		streamCount++;
+	}
+}
+
+void CommManager::serviceStreamHealth()
+{
+	FxStreamHealthPolicy policy;
+	{
+		std::lock_guard<std::mutex> lk(healthMutex);
+		policy = healthPolicy;
+	}
+
+	StreamList* listArray[2] = {autoStreamLists, streamLists};
+	std::unique_lock<std::recursive_mutex> streamLock(streamMutex);
+
+	// devices currently streamed
+	std::vector<std::pair<int, bool>> &streamed = healthStreamed;
+	auto findStreamed = [&streamed](int devId) {
+		for(auto &s : streamed)
+			if(s.first == devId) return &s;
+		return (std::pair<int, bool>*)nullptr;
+	};
+
+	streamed.clear();
+	for(int listIndex = 0; listIndex < 2; listIndex++)
+		for(int indexOfFreq = 0; indexOfFreq < NUM_TIMER_FREQS; indexOfFreq++)
+			for(auto &&record : listArray[listIndex][indexOfFreq])
+				if(!findStreamed(record.devId))
+					streamed.emplace_back(record.devId, false);
+
+	for(auto it = deviceHealth.begin(); it != deviceHealth.end(); )
+	{
+		if(findStreamed(it->first)) ++it;
+		else it = deviceHealth.erase(it);
+	}
+
+	bool anyWindow = false;
+	for(auto &s : streamed)
+	{
+		FxDevicePtr d = getDevicePtr(s.first);
+		if(!d) continue;
+
+		DeviceHealth &h = deviceHealth[s.first];
+		float rate, jitter;
+		if(h.meter.update(d, policy.windowMs, &rate, &jitter))
+		{
+			h.rateHz = rate;
+			h.jitterUs = jitter;
+			s.second = true;
+			anyWindow = true;
+		}
+	}
+	if(!anyWindow) return;
+
+	// rows can't be told apart by stream, so every stream of a device shares its measurement
+	std::vector<std::pair<int, int>> &fallbacks = healthFallbacks;
+	std::vector<FxStreamHealth> &report = healthScratch;
+	fallbacks.clear();
+	report.clear();
+	for(int listIndex = 0; listIndex < 2; listIndex++)
+	{
+		for(int indexOfFreq = 0; indexOfFreq < NUM_TIMER_FREQS; indexOfFreq++)
+		{
+			int freq = timerFrequencies[indexOfFreq];
+			for(auto &record : listArray[listIndex][indexOfFreq])
+			{
+				const DeviceHealth &h = deviceHealth[record.devId];
+				// a decimated stream is only expected to deliver a fraction of its frequency
+				float expectedHz = (float)freq / record.decimation;
+				report.push_back({record.devId, record.cmdCode, (int)expectedHz, h.rateHz, h.jitterUs,
+								  listIndex == 0, record.polledFallback, record.resends});
+
+				// the first window may start before the device got the command
+				if(listIndex != 0 || !findStreamed(record.devId)->second || ++record.healthWindows < 2)
+					continue;
+
+				if(h.rateHz >= policy.minRateRatio * expectedHz)
+				{
+					record.resends = 0;
+				}
+				else if(record.resends < (uint32_t)policy.maxResends)
+				{
+					FX_DIAG(FX_DIAG_WARN, "Autostream for slave id: %d at %.1f Hz instead of %.1f Hz, sending it again",
+							record.devId, h.rateHz, expectedHz);
+					sendAutoStream(record.devId, record.cmdCode, 1000 * record.decimation / freq, true);
+					record.resends++;
+				}
+				else if(policy.allowFallback && record.cmdCode == CMD_SYSDATA)
+				{
+					fallbacks.emplace_back(record.devId, record.cmdCode);
+				}
+			}
+		}
+	}
+
+	for(auto &&f : fallbacks)
+		fallBackToPolling(f.first, f.second);
+	streamLock.unlock();
+
+	std::lock_guard<std::mutex> lk(healthMutex);
+	healthReport.swap(report);
+}
+
+void CommManager::fallBackToPolling(int devId, int cmdCode)
+{
+	std::lock_guard<std::recursive_mutex> lk(streamMutex);
+	for(int indexOfFreq = 0; indexOfFreq < NUM_TIMER_FREQS; indexOfFreq++)
+	{
+		StreamList &l = autoStreamLists[indexOfFreq];
+		for(unsigned int i = 0; i < l.size(); i++)
+		{
+			if(l[i].devId != devId || l[i].cmdCode != cmdCode) continue;
+
+			StreamRcd record = l[i];
+			l.erase(l.begin() + i);
+
+			int freq = timerFrequencies[indexOfFreq];
+			sendAutoStream(devId, cmdCode, 1000 / freq, false);
+
+			record.polledFallback = true;
+			record.resends = 0;
+			streamLists[indexOfFreq].push_back(record);
+
+			// polled streams keep the comm thread awake, logged autostreams were already counted
+			if(!record.shouldLog)
+			{
+				std::lock_guard<std::mutex> lk(conditionMutex);
+				streamCount++;
+			}
+
+			FX_DIAG(FX_DIAG_WARN, "Autostream for slave id: %d still too slow, polling at %d Hz instead", devId, freq);
+			return;
+		}
+	}
+}
+
+void CommManager::setStreamHealthPolicy(const FxStreamHealthPolicy &policy)
+{
+	std::lock_guard<std::mutex> lk(healthMutex);
+	healthPolicy = policy;
+	if(healthPolicy.windowMs < 1) healthPolicy.windowMs = 1;
+}
+
+std::vector<FxStreamHealth> CommManager::getStreamHealth() const
+{
+	std::lock_guard<std::mutex> lk(healthMutex);
+	return healthReport;
+}
+
+float CommManager::predictLoad(int portIdx, bool raw, int extraDevId, int extraFreq) const
+{
+	const StreamList* listArray[2] = {autoStreamLists, streamLists};
+	float load = 0;
+	std::lock_guard<std::recursive_mutex> lk(streamMutex);
+
+	auto sampleBytes = [this](int devId) -> uint32_t {
+		FxDevicePtr d = getDevicePtr(devId);
+		if(!d) return 0;
+		uint32_t bitmap[FX_BITMAP_WIDTH];
+		d->getBitmap(bitmap);
+		return fxSampleWireBytes(d->type, bitmap);
+	};
+
+	for(int listIndex = 0; listIndex < 2; listIndex++)
+	{
+		for(int indexOfFreq = 0; indexOfFreq < NUM_TIMER_FREQS; indexOfFreq++)
+		{
+			for(auto &&record : listArray[listIndex][indexOfFreq])
+			{
+				// only sysdata replies have a known size
+				if(record.cmdCode != CMD_SYSDATA) continue;
+
+				FxDevicePtr d = getDevicePtr(record.devId);
+				if(!d || d->port != portIdx) continue;
+
+				float hz = (float)timerFrequencies[indexOfFreq];
+				if(!raw) hz /= record.decimation;
+				load += hz * sampleBytes(record.devId);
+			}
+		}
+	}
+
+	if(extraDevId >= 0)
+		load += (float)extraFreq * sampleBytes(extraDevId);
+
+	return load;
+}
+
+int CommManager::admitStream(int devId, int freq)
+{
+	FxDevicePtr d = getDevicePtr(devId);
+	if(!d) return freq;
+
+	FxRatePolicy policy;
+	float limit;
+	{
+		std::lock_guard<std::mutex> lk(rateMutex);
+		policy = ratePolicy;
+		limit = maxUtilization * portCapacity[d->port];
+	}
+
+	if(policy == FX_RATE_REPORT || policy == FX_RATE_DECIMATE)
+		return freq;
+
+	if(predictLoad(d->port, false, devId, freq) <= limit)
+		return freq;
+
+	if(policy == FX_RATE_DOWNSCALE)
+	{
+		for(int i = getIndexOfFrequency(freq) - 1; i >= 0; --i)
+		{
+			if(predictLoad(d->port, false, devId, timerFrequencies[i]) <= limit)
+			{
+				FX_DIAG(FX_DIAG_WARN, "Port %d can't carry %d Hz for slave id: %d, streaming at %d Hz",
+						d->port, freq, devId, timerFrequencies[i]);
+				return timerFrequencies[i];
+			}
+		}
+	}
+
+	FX_DIAG(FX_DIAG_WARN, "Port %d can't carry another stream for slave id: %d", d->port, devId);
+	return -1;
+}
+
+void CommManager::rebalancePort(int portIdx)
+{
+	FxRatePolicy policy;
+	float limit;
+	{
+		std::lock_guard<std::mutex> lk(rateMutex);
+		policy = ratePolicy;
+		limit = maxUtilization * portCapacity[portIdx];
+	}
+
+	// decimation and decimCount are read by sendCommands on the comm thread
+	std::lock_guard<std::recursive_mutex> streamLock(streamMutex);
+
+	int n = 1;
+	if(policy == FX_RATE_DECIMATE && limit > 0)
+	{
+		float raw = predictLoad(portIdx, true);
+		while(raw / n > limit) n++;
+	}
+
+	StreamList* listArray[2] = {autoStreamLists, streamLists};
+	for(int listIndex = 0; listIndex < 2; listIndex++)
+	{
+		for(int indexOfFreq = 0; indexOfFreq < NUM_TIMER_FREQS; indexOfFreq++)
+		{
+			for(auto &record : listArray[listIndex][indexOfFreq])
+			{
+				FxDevicePtr d = getDevicePtr(record.devId);
+				if(!d || d->port != portIdx || record.decimation == n) continue;
+
+				record.decimation = n;
+				record.decimCount = 0;
+
+				// the device paces autostreams itself, so it is sent the longer period
+				if(listIndex == 0)
+					sendAutoStream(record.devId, record.cmdCode, 1000 * n / timerFrequencies[indexOfFreq], true);
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> lk(rateMutex);
+	if(portDecimation[portIdx] != n)
+		FX_DIAG(FX_DIAG_INFO, "Port %d streams decimated by %d", portIdx, n);
+	portDecimation[portIdx] = n;
+}
+
+void CommManager::serviceUtilization()
+{
+	auto now = std::chrono::steady_clock::now();
+	float elapsed = std::chrono::duration<float>(now - lastUtilUpdate).count();
+	if(elapsed < 1.0f) return;
+	lastUtilUpdate = now;
+
+	float predicted[FX_NUMPORTS];
+	for(int i = 0; i < FX_NUMPORTS; i++)
+		predicted[i] = predictLoad(i, false);
+
+	std::lock_guard<std::mutex> lk(rateMutex);
+	for(int i = 0; i < FX_NUMPORTS; i++)
+	{
+		uint64_t rx = portRxBytes[i], tx = portTxBytes[i];
+		float cap = (float)portCapacity[i];
+
+		FxPortUtilization &u = portUtil[i];
+		u.capacity = portCapacity[i];
+		u.predicted = cap > 0 ? predicted[i] / cap : 0;
+		u.measuredRx = cap > 0 ? (rx - lastRxBytes[i]) / elapsed / cap : 0;
+		u.measuredTx = cap > 0 ? (tx - lastTxBytes[i]) / elapsed / cap : 0;
+		u.decimation = portDecimation[i];
+
+		lastRxBytes[i] = rx;
+		lastTxBytes[i] = tx;
+	}
+}
+
+void CommManager::setRateControl(FxRatePolicy policy, float maxU)
+{
+	{
+		std::lock_guard<std::mutex> lk(rateMutex);
+		ratePolicy = policy;
+		maxUtilization = maxU > 0 ? maxU : 0;
+	}
+
+	for(int i = 0; i < FX_NUMPORTS; i++)
+		rebalancePort(i);
+}
+
+void CommManager::setPortCapacity(int portIdx, uint32_t bytesPerSecond)
+{
+	if(portIdx < 0 || portIdx >= FX_NUMPORTS) return;
+	{
+		std::lock_guard<std::mutex> lk(rateMutex);
+		portCapacity[portIdx] = bytesPerSecond;
+	}
+	rebalancePort(portIdx);
+}
+
+FxPortUtilization CommManager::getPortUtilization(int portIdx) const
+{
+	if(portIdx < 0 || portIdx >= FX_NUMPORTS) return FxPortUtilization();
+
+	std::lock_guard<std::mutex> lk(rateMutex);
+	return portUtil[portIdx];
+}
+
+void CommManager::setLinkRecovery(bool enable, int timeoutMs)
+{
+	std::lock_guard<std::mutex> lk(recoveryMutex);
+	linkRecoveryEnabled = enable;
+	recoveryTimeoutMs = timeoutMs > 0 ? timeoutMs : 0;
+}
+
+void CommManager::setRecoveryHook(const FxRecoveryHook &hook)
+{
+	std::lock_guard<std::mutex> lk(recoveryMutex);
+	if(recoveryHookHandle >= 0)
+		events.unsubscribe(recoveryHookHandle);
+	recoveryHookHandle = -1;
+
+	if(hook)
+		recoveryHookHandle = events.subscribe(FX_EVENT_LINK_RESTORED, [hook](const FxEvent &e) { hook(e.devId); });
+}
+
+FxLinkStats CommManager::getLinkStats(int portIdx) const
+{
+	FxLinkStats st = FxLinkStats();
+	st.lastDowntimeMs = -1;
+	if(portIdx < 0 || portIdx >= FX_NUMPORTS) return st;
+
+	std::lock_guard<std::mutex> lk(recoveryMutex);
+	return linkStats[portIdx];
+}
+
+void CommManager::dropOldestMessage(int port, std::vector<FxCommandStatePtr> &dropped)
+{
+	// mtOGBuffer must be held, dropped commands are to be failed once it is released
+	if(outgoingBuffer[port].front().completion)
+		dropped.push_back(outgoingBuffer[port].front().completion);
+
+	outgoingBuffer[port].pop();
 }
 
 bool CommManager::wakeFromLongSleep()
@@ -275,17 +990,38 @@ bool CommManager::wakeFromLongSleep()
 }
 bool CommManager::goToLongSleep()
 {
-	return streamCount == 0 && FlexseaSerial::goToLongSleep();
+	bool haveCommands, recovering;
+	{
+		std::lock_guard<std::mutex> lk(commandMutex);
+		haveCommands = !trackedCommands.empty();
+	}
+	{
+		std::lock_guard<std::mutex> lk(recoveryMutex);
+		recovering = !recoveries.empty() || !pendingRestores.empty();
+	}
+	return streamCount == 0 && !haveCommands && !recovering && FlexseaSerial::goToLongSleep();
 }
 
 void CommManager::close(uint16_t portIdx)
 {
-	for(auto &kvp : connectedDevices)
+	// closing by hand cancels any recovery in progress
 	{
-		if(kvp.second->port == portIdx)
-			stopStreaming(kvp.second->id);
+		std::lock_guard<std::mutex> lk(recoveryMutex);
+		for(auto it = recoveries.begin(); it != recoveries.end(); )
+		{
+			if(it->portIdx == portIdx)
+			{
+				linkStats[portIdx].recovering = false;
+				it = recoveries.erase(it);
+			}
+			else
+				++it;
+		}
 	}
 
+	for(int id : getDeviceIds(portIdx))
+		stopStreaming(id);
+
 	// -- Forcing remaining messages allows us to stop auto streaming when we disconnect
 	// -- However over bluetooth, we risk trying to send a message to a bluetooth port that's actually not open
 	// -- ie: connected over bluetooth, turn off device, then call into close()
@@ -323,7 +1059,96 @@ bool CommManager::setDefaultLogFolder()
 	return dataLogger->setDefaultLogFolder();
 }
 
-int CommManager::writeDeviceMap(const FxDevicePtr d, uint32_t *map)
+bool CommManager::setLogFormat(FxLogFormat f)
+{
+	return dataLogger->setFormat(f);
+}
+
+bool CommManager::setLogCompression(FxLogCompression c)
+{
+	return dataLogger->setCompression(c);
+}
+
+bool CommManager::setLogBackend(FxLogBackend b, size_t segmentSize)
+{
+	return dataLogger->setBackend(b, segmentSize);
+}
+
+void CommManager::setLogRotation(const FxLogRotation &r)
+{
+	dataLogger->setRotation(r);
+}
+
+bool CommManager::startMergedStream(const std::vector<FxMergedColumn> &columns, int periodUs, FxMergePolicy policy, bool shouldLog)
+{
+	std::string logPath;
+	if(shouldLog)
+		logPath = dataLogger->generateMergedFileName();
+
+	if(!mergedStream->start(columns, periodUs, policy, logPath))
+		return false;
+
+	// the merged stream's columns are one consumer per device
+	std::unordered_map<int, std::vector<int>> fieldsByDevice;
+	for(auto &&c : columns)
+		fieldsByDevice[c.devId].push_back(c.fieldId);
+
+	std::vector<int> handles;
+	for(auto &&f : fieldsByDevice)
+	{
+		int h = addFieldInterest(f.first, f.second);
+		if(h >= 0) handles.push_back(h);
+	}
+
+	std::lock_guard<std::mutex> lk(minimizerMutex);
+	mergedStreamInterests.swap(handles);
+	return true;
+}
+
+void CommManager::stopMergedStream()
+{
+	mergedStream->stop();
+
+	std::vector<int> handles;
+	{
+		std::lock_guard<std::mutex> lk(minimizerMutex);
+		handles.swap(mergedStreamInterests);
+	}
+	for(int h : handles)
+		removeFieldInterest(h);
+}
+
+bool CommManager::startTelemetry(const std::string &socketPath, unsigned int periodMs)
+{
+	return telemetry->start(socketPath, periodMs);
+}
+
+void CommManager::stopTelemetry()
+{
+	telemetry->stop();
+}
+
+bool CommManager::startSharedMemoryExport(const std::string &prefix, uint32_t numSlots)
+{
+	return shmExporter->start(prefix, numSlots);
+}
+
+void CommManager::stopSharedMemoryExport()
+{
+	shmExporter->stop();
+}
+
+bool CommManager::startAutoConnect(const std::vector<FxHotplugRule> &rules)
+{
+	return hotplug->start(rules);
+}
+
+void CommManager::stopAutoConnect()
+{
+	hotplug->stop();
+}
+
+int CommManager::writeDeviceMap(const FxDevicePtr d, uint32_t *map, const FxCommandStatePtr &completion)
 {
 	uint16_t mapLen = 0;
 	for(short i=FX_BITMAP_WIDTH-1; i >= 0; i--)
@@ -337,25 +1162,160 @@ int CommManager::writeDeviceMap(const FxDevicePtr d, uint32_t *map)
 
 	mapLen = mapLen > 0 ? mapLen : 1;
 
-	enqueueCommand(	d,
-					tx_cmd_sysdata_w,
-					map, mapLen
-					);
+	bool ok = enqueueCommand(	d, completion,
+								tx_cmd_sysdata_w,
+								map, mapLen
+								);
 
-	return 0;
+	return ok ? 0 : -1;
 }
 
 int CommManager::writeDeviceMap(int devId, uint32_t *map)
 {
-	if(!connectedDevices.count(devId)) return -1;
-	FxDevicePtr d = connectedDevices.at(devId);
-	return writeDeviceMap(d, map);
+	FxDevicePtr d = getDevicePtr(devId);
+	if(!d) return -1;
+
+	if(!minimizeBitmaps)
+		return writeDeviceMap(d, map);
+
+	{
+		std::lock_guard<std::mutex> lk(minimizerMutex);
+		auto it = userInterests.find(devId);
+		if(it == userInterests.end())
+			userInterests[devId] = fieldInterests.add(devId, map);
+		else
+			fieldInterests.set(it->second, map);
+	}
+
+	applyFieldInterests(devId);
+	return 0;
 }
 
-int CommManager::writeDeviceMap(int devId, const std::vector<int> &fields)
+void CommManager::fieldsToMap(const FxDevicePtr &d, const int *fields, size_t n, uint32_t *map) const
+{
+	memset(map, 0, sizeof(uint32_t)*FX_BITMAP_WIDTH);
+	for(size_t i = 0; i < n; ++i)
+	{
+		int f = fields[i];
+		if(f >= 0 && f < d->numFields)
+		{
+			SET_FIELD_HIGH(f, map);
+		}
+	}
+}
+
+void CommManager::applyFieldInterests(int devId)
 {
-	if(!connectedDevices.count(devId)) return -1;
-	FxDevicePtr d = connectedDevices.at(devId);
+	if(!minimizeBitmaps) return;
+
+	FxDevicePtr d = getDevicePtr(devId);
+	if(!d) return;
+
+	uint32_t wanted[FX_BITMAP_WIDTH], current[FX_BITMAP_WIDTH];
+	if(!fieldInterests.getUnion(devId, wanted)) return;
+
+	d->getBitmap(current);
+	if(!memcmp(wanted, current, sizeof(wanted))) return;
+
+	// the device takes a round trip to apply a map, don't repeat it meanwhile
+	auto now = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lk(minimizerMutex);
+		SentMap &sent = sentMaps[devId];
+		if(!memcmp(sent.map, wanted, sizeof(wanted)) && now - sent.at < std::chrono::milliseconds(500))
+			return;
+
+		memcpy(sent.map, wanted, sizeof(wanted));
+		sent.at = now;
+	}
+
+	writeDeviceMap(d, wanted);
+}
+
+void CommManager::setBitmapMinimizer(bool enable)
+{
+	minimizeBitmaps = enable;
+	if(!enable) return;
+
+	for(int id : fieldInterests.getDeviceIds())
+		applyFieldInterests(id);
+}
+
+int CommManager::addFieldInterest(int devId, const std::vector<int> &fields)
+{
+	FxDevicePtr d = getDevicePtr(devId);
+	if(!d) return -1;
+
+	uint32_t map[FX_BITMAP_WIDTH];
+	fieldsToMap(d, fields.data(), fields.size(), map);
+
+	int handle = fieldInterests.add(devId, map);
+	applyFieldInterests(devId);
+	return handle;
+}
+
+void CommManager::removeFieldInterest(int handle)
+{
+	int devId = fieldInterests.remove(handle);
+	if(devId >= 0)
+		applyFieldInterests(devId);
+}
+
+bool CommManager::widenFieldMap(int devId, const int *fields, size_t n)
+{
+	if(!minimizeBitmaps) return false;
+
+	FxDevicePtr d = getDevicePtr(devId);
+	if(!d) return false;
+
+	uint32_t map[FX_BITMAP_WIDTH], wanted[FX_BITMAP_WIDTH];
+	fieldsToMap(d, fields, n, map);
+	fieldInterests.getUnion(devId, wanted);
+
+	bool missing = false;
+	for(int i = 0; i < FX_BITMAP_WIDTH; ++i)
+		missing |= (map[i] & ~wanted[i]) != 0;
+
+	if(!missing)
+	{
+		// already asked for, possibly not applied by the device yet
+		applyFieldInterests(devId);
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(minimizerMutex);
+		auto it = readerInterests.find(devId);
+		if(it == readerInterests.end())
+			readerInterests[devId] = fieldInterests.add(devId, map);
+		else
+			fieldInterests.widen(it->second, map);
+	}
+
+	applyFieldInterests(devId);
+	return true;
+}
+
+FxCommandHandle CommManager::writeDeviceMapAsync(int devId, uint32_t *map, int timeoutMs)
+{
+	FxDevicePtr d = getDevicePtr(devId);
+	if(!d) return FxCommandHandle();
+
+	FxCommandStatePtr cmd = newCommand(devId, true, timeoutMs);
+	memcpy(cmd->expectedBitmap, map, sizeof(cmd->expectedBitmap));
+
+	// tracked before it can be sent, so a quick response can't be missed
+	trackCommand(cmd);
+	if(writeDeviceMap(d, map, cmd))
+		cmd->resolve(FX_CMD_FAILED);
+
+	return FxCommandHandle(cmd);
+}
+
+FxCommandHandle CommManager::writeDeviceMapAsync(int devId, const std::vector<int> &fields, int timeoutMs)
+{
+	FxDevicePtr d = getDevicePtr(devId);
+	if(!d) return FxCommandHandle();
 
 	int nf = d->numFields;
 	uint32_t map[FX_BITMAP_WIDTH];
@@ -369,17 +1329,28 @@ int CommManager::writeDeviceMap(int devId, const std::vector<int> &fields)
 		}
 	}
 
-	return writeDeviceMap(d, map);
+	return writeDeviceMapAsync(devId, map, timeoutMs);
+}
+
+int CommManager::writeDeviceMap(int devId, const std::vector<int> &fields)
+{
+	FxDevicePtr d = getDevicePtr(devId);
+	if(!d) return -1;
+
+	uint32_t map[FX_BITMAP_WIDTH];
+	fieldsToMap(d, fields.data(), fields.size(), map);
+
+	return writeDeviceMap(devId, map);
 }
 
 int CommManager::enqueueMultiPacket(int devId, MultiWrapper *out)
 {
-	if(!connectedDevices.count(devId)) return -1;
-	FxDevicePtr d = connectedDevices.at(devId);
+	FxDevicePtr d = getDevicePtr(devId);
+	if(!d) return -1;
 	return enqueueMultiPacket(d->id, d->port, out);
 }
 
-int CommManager::enqueueMultiPacket(int, int port, MultiWrapper *out)
+int CommManager::enqueueMultiPacket(int, int port, MultiWrapper *out, const FxCommandStatePtr &completion)
 {
 	uint8_t frameId = 0, nb;
 	while(out->frameMap > 0)
@@ -392,33 +1363,44 @@ int CommManager::enqueueMultiPacket(int, int port, MultiWrapper *out)
             nb = MAX(nb, PACKET_WRAPPER_LEN * 2 / 3);
 		mtOGBuffer.lock();
         outgoingBuffer[port].push(Message( nb ,out->packed[frameId]  ));
+        // the command counts as sent once its last frame is
+        if(!out->frameMap)
+            outgoingBuffer[port].back().completion = completion;
         mtOGBuffer.unlock();
 		frameId++;
     }
 
     out->isMultiComplete = 1;
+	std::vector<FxCommandStatePtr> dropped;
 	mtOGBuffer.lock();
     while(outgoingBuffer[port].size() > MAX_Q_SIZE)
-        outgoingBuffer[port].pop();
+        dropOldestMessage(port, dropped);
 	mtOGBuffer.unlock();
 
+	for(auto &&c : dropped)
+		c->resolve(FX_CMD_FAILED);
+
 	return 0;
 }
 
 bool CommManager::enqueueCommand(uint8_t numb, uint8_t* dataPacket, int portIdx)
 {
     //If we are over a max size, clear the queue
+	std::vector<FxCommandStatePtr> dropped;
 	mtOGBuffer.lock();
     if(outgoingBuffer[portIdx].size() > MAX_Q_SIZE)
     {
-        std::cout << "ComManager::enqueueCommand, queue is above max size (" << MAX_Q_SIZE  << "), clearing queue..." << std::endl;
+        FX_DIAG(FX_DIAG_WARN, "ComManager::enqueueCommand, queue is above max size (%u), clearing queue...", MAX_Q_SIZE);
         while(outgoingBuffer[portIdx].size())
-            outgoingBuffer[portIdx].pop();
+            dropOldestMessage(portIdx, dropped);
     }
 
     outgoingBuffer[portIdx].push(Message(numb, dataPacket));
 	mtOGBuffer.unlock();
 
+	for(auto &&c : dropped)
+		c->resolve(FX_CMD_FAILED);
+
 	bool doNotify;
 	{
 		std::lock_guard<std::mutex> lk(conditionMutex);
@@ -438,6 +1420,9 @@ void CommManager::sendCommands(int index)
 	{
 		auto& record = streamLists[index].at(i);
 
+		if(record.decimation > 1 && (record.decimCount++ % record.decimation))
+			continue;
+
 		if(record.cmdCode == CMD_SYSDATA)
 			sendSysDataRead(record.devId);
 		else if(record.cmdCode >= CMD_CODE_BASE && record.func)
@@ -1,4 +1,5 @@
 #include "datalogger.h"
+#include "fxdiag.h"
 #include <chrono>
 #include <sstream>
 #include <string>
@@ -11,17 +12,28 @@
 #include<sys/stat.h>
 #endif
 
+// rows are flushed once this much data or time accumulated, so compressed logs keep large frames
+#define FX_LOG_FLUSH_BYTES (64 << 10)
+#define FX_LOG_FLUSH_INTERVAL std::chrono::seconds(1)
 
 DataLogger::DataLogger(FlexseaDeviceProvider* fdp)
     : devProvider(fdp)
     , numLogDevices(0)
     , isFirstLogFile(true)
+    , sinkConfig({FX_LOG_PLAIN, FX_LOG_STDIO, FX_LOG_DEFAULT_SEGMENT_SIZE})
+    , rotation({MAX_LOG_SIZE, 0, 0})
+    , format(FX_LOG_CSV)
     , _logFolderPath(DEFAULT_LOG_FOLDER)
 {
     loadLogFolderConfig();
     createFolder(_logFolderPath);
 }
 
+DataLogger::~DataLogger()
+{
+    stopAllLogs();
+}
+
 bool DataLogger::startLogging(int devId, bool logAdditionalFieldInit)
 {
     if(isFirstLogFile)
@@ -34,37 +46,35 @@ bool DataLogger::startLogging(int devId, bool logAdditionalFieldInit)
        dev->type == FX_NONE) return false;
 
     std::string fileName = generateFileName(dev);
-    std::ofstream* fout = nullptr;
 
     unsigned int numActiveFields = dev->getNumActiveFields();
-    unsigned int ts = 0;
+    LogRecord record = {devId, -1, 0, 0, 0, std::chrono::steady_clock::now(), 0, numActiveFields, logAdditionalFieldInit,
+                        FX_LOG_CSV, std::vector<int>(), 0, std::chrono::steady_clock::now()};
+
+    std::lock_guard<std::mutex> lk(resMutex);
+    record.format = format;
 
     if(numActiveFields)
     {
         std::replace(fileName.begin(), fileName.end(), '\\', '/');
-        fout = new std::ofstream(fileName);
+        record.fileHandle = writer.openFile(fileName, sinkConfig);
 
-        if(!fout || !fout->is_open())
+        if(record.fileHandle < 0)
         {
-            if(fout) delete fout;
-            fout = nullptr;
-            std::cout << "Can't open file" << std::endl;
+            FX_DIAG(FX_DIAG_ERROR, "Can't open file %s", fileName.c_str());
             throw std::bad_alloc();
         }
 
-        writeLogHeader(fout, dev, logAdditionalFieldInit);
+        writeLogHeader(record, dev, logAdditionalFieldInit);
     }
 
     if(dev->dataCount())
     {
-        ts = dev->getLatestTimestamp();
+        record.lastTimestamp = dev->getLatestTimestamp64();
     }
 
-    {
-        std::lock_guard<std::mutex> lk(resMutex);
-        logRecords.push_back( {devId, fout, ts, 0, 0, numActiveFields, logAdditionalFieldInit} );
-        numLogDevices++;
-    }
+    logRecords.push_back(record);
+    numLogDevices++;
 
     return true;
 }
@@ -105,6 +115,42 @@ bool DataLogger::setDefaultLogFolder()
    return setLogFolder(DEFAULT_LOG_FOLDER);
 }
 
+bool DataLogger::setCompression(FxLogCompression c)
+{
+    if(!fxLogCompressionAvailable(c)) return false;
+
+    std::lock_guard<std::mutex> lk(resMutex);
+    // recovery and conversion read block logs as raw bytes
+    if(c != FX_LOG_PLAIN && format == FX_LOG_BLOCKS) return false;
+    sinkConfig.compression = c;
+    return true;
+}
+
+bool DataLogger::setFormat(FxLogFormat f)
+{
+    std::lock_guard<std::mutex> lk(resMutex);
+    if(f == FX_LOG_BLOCKS && sinkConfig.compression != FX_LOG_PLAIN) return false;
+    format = f;
+    return true;
+}
+
+bool DataLogger::setBackend(FxLogBackend b, size_t segmentSize)
+{
+    if(!fxLogBackendAvailable(b)) return false;
+
+    std::lock_guard<std::mutex> lk(resMutex);
+    sinkConfig.backend = b;
+    if(segmentSize)
+        sinkConfig.segmentSize = segmentSize;
+    return true;
+}
+
+void DataLogger::setRotation(const FxLogRotation &r)
+{
+    std::lock_guard<std::mutex> lk(resMutex);
+    rotation = r;
+}
+
 // public, allows user to set values
 void DataLogger::setColumnValue(unsigned col, int val)
 {
@@ -115,16 +161,9 @@ bool DataLogger::removeRecord(int idx)
 {
     if((unsigned int)idx >= logRecords.size() ) return false;
 
-    std::ofstream* fout = logRecords.at(idx).fileObject;
-
+    closeFileObject(logRecords.at(idx));
     logRecords.erase(logRecords.begin() + idx);
 
-    if(fout)
-    {
-        fout->close();
-        delete fout;
-    }
-
     numLogDevices--;
     return true;
 }
@@ -142,62 +181,102 @@ bool DataLogger::logDevice(int idx)
     FxDevicePtr dev = devProvider->getDevicePtr(logRecords.at(idx).devId);
     if(!dev) return false;
 
-    auto fids = dev->getActiveFieldIds();
+    const auto &fids = dev->getActiveFieldIds();
     if(fids.size() < 1) return true;
 
     LogRecord& record = logRecords.at(idx);
-    int32_t ts = logRecords.at(idx).lastTimestamp;
+    uint64_t ts = logRecords.at(idx).lastTimestamp;
 
-    std::vector<uint32_t> stamps;
-    std::vector<std::vector<int32_t>> data;
-    ts = dev->getDataAfterTime(ts, stamps, data);
+    std::vector<uint32_t> &stamps = scratchStamps;
+    ts = dev->getDataAfterTime64(ts, stamps, scratchRows);
     logRecords.at(idx).lastTimestamp = ts;
 
     // if stamps and data mismatch in size, we have some kind of problem
-    if(stamps.size() != data.size())
+    if(stamps.size() * dev->numFields != scratchRows.size())
         return false;
 
+    // block logs describe their columns in-band, so a change of fields is just a new schema block
+    if(record.format == FX_LOG_BLOCKS && record.fileHandle >= 0 && record.loggedFieldIds != fids)
+    {
+        record.numActiveFields = writeLogHeader(record, dev, record.logAdditionalField);
+    }
     // if the record's active field num is different than current active field num
     // this indicates that we started a log file immediately after sending a configuration command
     // and we didn't receive configuration response until after starting the log file
     // in the spirit of being tolerant of async work flows, we just swap to a new file
-    if(record.numActiveFields != fids.size())
+    else if(record.numActiveFields != fids.size())
     {
         std::string nextFileName;
-        if(record.fileObject)
+        if(record.fileHandle >= 0)
             nextFileName = generateFileName(dev, std::to_string(++logRecords.at(idx).logFileSplitIndex));
         else
             nextFileName = generateFileName(dev);
 
-        std::cout << "Swapping files to new name: " << nextFileName << std::endl;
+        FX_DIAG(FX_DIAG_INFO, "Swapping files to new name: %s", nextFileName.c_str());
         swapFileObject(logRecords.at(idx), nextFileName, dev);
     }
 
-    std::ofstream *fout = logRecords.at(idx).fileObject;
+    if(record.fileHandle >= 0 && fids.size() && stamps.size() && record.format == FX_LOG_BLOCKS)
+    {
+        // one block per poll; a crash loses at most the blocks written since the last flush
+        size_t numAdditional = record.logAdditionalField ? additionalColumnValues.size() : 0;
+        FxLogDataBlock &block = scratchBlock;
+        block.reset(fids.size() + numAdditional);
+        for(unsigned int line = 0; line < stamps.size(); line++)
+        {
+            block.beginRow(stamps.at(line));
+
+            const int32_t *dataline = scratchRows.data() + line * dev->numFields;
+            for(auto&& fid : fids)
+                block.add(dataline[fid]);
+            for(size_t i = 0; i < numAdditional; ++i)
+                block.add(additionalColumnValues.at(i));
+        }
 
-    if(fout && fids.size())
+        std::string chunk = writer.takeBuffer();
+        block.appendTo(chunk);
+
+        record.logFileSize += stamps.size();
+        record.logFileBytes += chunk.size();
+
+        writer.write(record.fileHandle, std::move(chunk));
+        if(record.logFileBytes - record.flushedBytes >= FX_LOG_FLUSH_BYTES
+           || std::chrono::steady_clock::now() - record.lastFlush >= FX_LOG_FLUSH_INTERVAL)
+            flushFileObject(record);
+    }
+    else if(record.fileHandle >= 0 && fids.size() && stamps.size())
     {
+        // only formatting happens here, the writer's thread compresses and writes
+        std::string chunk = writer.takeBuffer();
         for(unsigned int line = 0; line < stamps.size(); line++)
         {
-            (*fout) << stamps.at(line);
+            chunk += std::to_string(stamps.at(line));
 
-            auto&& dataline = data.at(line);
+            const int32_t *dataline = scratchRows.data() + line * dev->numFields;
             for(auto&& fid : fids)
             {
-                (*fout) << ", " << dataline.at(fid);
+                chunk += ", ";
+                chunk += std::to_string(dataline[fid]);
             }
             if(record.logAdditionalField)
             {
                 for(auto&& l : additionalColumnValues)
-                    (*fout) << ", " << l;
+                {
+                    chunk += ", ";
+                    chunk += std::to_string(l);
+                }
             }
 
-            (*fout) << "\n";
+            chunk += "\n";
         }
 
-        logRecords.at(idx).logFileSize += stamps.size();
+        record.logFileSize += stamps.size();
+        record.logFileBytes += chunk.size();
 
-        fout->flush();
+        writer.write(record.fileHandle, std::move(chunk));
+        if(record.logFileBytes - record.flushedBytes >= FX_LOG_FLUSH_BYTES
+           || std::chrono::steady_clock::now() - record.lastFlush >= FX_LOG_FLUSH_INTERVAL)
+            flushFileObject(record);
     }
 
     return true;
@@ -233,15 +312,7 @@ bool DataLogger::createSessionFolder(std::string session_name)
 void DataLogger::clearRecords()
 {
     for(auto&& r : logRecords)
-    {
-        if(r.fileObject)
-        {
-            if(r.fileObject->is_open())
-                r.fileObject->close();
-
-            delete r.fileObject;
-        }
-    }
+        closeFileObject(r);
 
     logRecords.clear();
     numLogDevices = 0;
@@ -260,7 +331,7 @@ std::string DataLogger::generateFileName(FxDevicePtr dev, std::string suffix)
     if(suffix.compare("") != 0)
         ss << "_" << suffix;
 
-    ss << ".csv";
+    ss << (format == FX_LOG_BLOCKS ? ".fxlog" : ".csv") << fxLogCompressionExtension(sinkConfig.compression);
 
     std::string result = ss.str();
 
@@ -286,6 +357,24 @@ std::string DataLogger::generateFileName(FxDevicePtr dev, std::string suffix)
     return result;
 }
 
+std::string DataLogger::generateMergedFileName()
+{
+    if(isFirstLogFile)
+    {
+        createSessionFolder("");
+    }
+
+    time_t now = time(0);
+    struct tm * timeinfo = localtime(&now);
+    char dt[80];
+    strftime (dt,80,"%Y-%m-%d_%Hh%Mm%Ss_", timeinfo);
+
+    std::string result = _sessionPath + "/" + dt + "merged.csv";
+    std::replace(result.begin(), result.end(), '\\', '/');
+
+    return result;
+}
+
 bool DataLogger::createFolder(std::string path)
 {
    bool success = false;
@@ -376,10 +465,10 @@ void DataLogger::serviceLogs()
     }
 
     // for each record, we can check the new file size
-    // switch to a new log file if we have gone over the max number of lines
+    // switch to a new log file if we have gone over any of the rotation limits
     for(auto &r : logRecords)
     {
-        if(r.logFileSize > MAX_LOG_SIZE)
+        if(shouldRotate(r))
         {
             FxDevicePtr dev = devProvider->getDevicePtr(r.devId);
             std::string nextFileName = generateFileName(dev, std::to_string(++r.logFileSplitIndex));
@@ -388,20 +477,65 @@ void DataLogger::serviceLogs()
     }
 }
 
-unsigned int DataLogger::writeLogHeader(std::ofstream* fout, const FxDevicePtr dev, bool logAdditionalColumnsInit)
+bool DataLogger::shouldRotate(const LogRecord &r) const
+{
+    if(r.fileHandle < 0) return false;
+
+    if(rotation.maxLines && r.logFileSize > rotation.maxLines)
+        return true;
+    if(rotation.maxBytes && r.logFileBytes >= rotation.maxBytes)
+        return true;
+    if(rotation.maxSeconds &&
+       std::chrono::steady_clock::now() - r.logFileOpened >= std::chrono::seconds(rotation.maxSeconds))
+        return true;
+
+    return false;
+}
+
+unsigned int DataLogger::writeLogHeader(LogRecord &record, const FxDevicePtr dev, bool logAdditionalColumnsInit)
 {
-    std::vector<std::string> fieldLabels = dev->getActiveFieldLabels();
-    (*fout) << "timestamp";
+    const std::vector<std::string> &fieldLabels = dev->getActiveFieldLabels();
+    record.loggedFieldIds = dev->getActiveFieldIds();
+    if(record.fileHandle < 0) return fieldLabels.size();
+
+    if(record.format == FX_LOG_BLOCKS)
+    {
+        std::string header;
+        if(!record.logFileBytes)
+            fxLogAppendFileHeader(header);
+
+        std::vector<FxLogColumn> columns;
+        for(size_t i = 0; i < fieldLabels.size() && i < record.loggedFieldIds.size(); ++i)
+            columns.push_back({record.loggedFieldIds.at(i), fieldLabels.at(i)});
+        if(logAdditionalColumnsInit)
+        {
+            for(auto&& l : additionalColumnLabels)
+                columns.push_back({-1, l});
+        }
+
+        fxLogAppendSchema(header, dev->id, dev->type, columns);
+        record.logFileBytes += header.size();
+
+        writer.write(record.fileHandle, std::move(header));
+        flushFileObject(record);
+
+        return fieldLabels.size();
+    }
+
+    std::string header = "timestamp";
     for(auto&& l : fieldLabels)
-        (*fout) << ", " << l;
+        header += ", " + l;
     if(logAdditionalColumnsInit)
     {
         for(auto&& l : additionalColumnLabels)
-            (*fout) << ", " << l;
+            header += ", " + l;
     }
 
-    (*fout) << "\n";
-    fout->flush();
+    header += "\n";
+    record.logFileBytes += header.size();
+
+    writer.write(record.fileHandle, std::move(header));
+    flushFileObject(record);
 
     return fieldLabels.size();
 }
@@ -409,18 +543,38 @@ unsigned int DataLogger::writeLogHeader(std::ofstream* fout, const FxDevicePtr d
 
 void DataLogger::swapFileObject(LogRecord &record, std::string newFileName, const FxDevicePtr dev)
 {
-    // get rid of the old file object
-    if(record.fileObject)
-    {
-        record.fileObject->close();
-        delete record.fileObject;
-    }
+    // get rid of the old file object, closing it ends its compressed frame
+    closeFileObject(record);
 
     // generate the new file object
     std::replace(newFileName.begin(), newFileName.end(), '\\', '/');
-    record.fileObject = new std::ofstream(newFileName);
-    record.numActiveFields = writeLogHeader(record.fileObject, dev, record.logAdditionalField);
+    record.fileHandle = writer.openFile(newFileName, sinkConfig);
+    record.format = format;
+    if(record.fileHandle < 0)
+        FX_DIAG(FX_DIAG_ERROR, "Can't open file %s", newFileName.c_str());
+
     record.logFileSize = 0;
+    record.logFileBytes = 0;
+    record.flushedBytes = 0;
+    record.logFileOpened = std::chrono::steady_clock::now();
+    record.numActiveFields = writeLogHeader(record, dev, record.logAdditionalField);
+}
+
+void DataLogger::flushFileObject(LogRecord &record)
+{
+    if(record.fileHandle >= 0)
+        writer.flushFile(record.fileHandle);
+
+    record.flushedBytes = record.logFileBytes;
+    record.lastFlush = std::chrono::steady_clock::now();
+}
+
+void DataLogger::closeFileObject(LogRecord &record)
+{
+    if(record.fileHandle >= 0)
+        writer.closeFile(record.fileHandle);
+
+    record.fileHandle = -1;
 }
 
 bool DataLogger::wakeFromLongSleep()
@@ -1,8 +1,8 @@
 #include "flexseadevice.h"
+#include "fxdiag.h"
 #include "cstring"
 #include "flexsea_device_spec.h"
 
-#include <iostream>
 
 
 FlexseaDevice::FlexseaDevice(int _id, int _port, FlexseaDeviceType _type, int role, int dataBuffSize):
@@ -13,18 +13,16 @@ FlexseaDevice::FlexseaDevice(int _id, int _port, FlexseaDeviceType _type, int ro
 	, dataMutex(&_dataMutex)
 	, shortId(id)
 	, _role(role)
+	, _labels(FxLabelTable::forType(_type))
 	, _data(dataBuffSize, deviceSpecs[_type].numFields + 1 )
+	, _decoder(_type)
 {
 	memset(this->bitmap, 0, FX_BITMAP_WIDTH * sizeof(uint32_t));
-
-	for(int i = 0; i < numFields; ++i)
-	{
-		const char* c_str = deviceSpecs[_type].fieldLabels[i];
-		if(c_str)
-			fieldLabels.push_back(c_str);
-		else
-			throw std::invalid_argument("Device Spec for given type is invalid, causing null pointer access");
-	 }
+	memset(&_rxStats, 0, sizeof(FxRxStats));
+	_lastDeviceTimestamp = 0;
+	_consecutiveGaps = 0;
+	_gapRunDelta = 0;
+	_activeFields = &_labels->active(bitmap);
 }
 
 FlexseaDevice::FlexseaDevice(int _id, int _shortid, int _port, FlexseaDeviceType _type, int role, int dataBuffSize):
@@ -35,18 +33,16 @@ FlexseaDevice::FlexseaDevice(int _id, int _shortid, int _port, FlexseaDeviceType
 	, dataMutex(&_dataMutex)
 	, shortId(_shortid)
 	, _role(role)
+	, _labels(FxLabelTable::forType(_type))
 	, _data(dataBuffSize, deviceSpecs[_type].numFields + 1 )
+	, _decoder(_type)
 {
 	memset(this->bitmap, 0, FX_BITMAP_WIDTH * sizeof(uint32_t));
-
-	for(int i = 0; i < numFields; ++i)
-	{
-		const char* c_str = deviceSpecs[_type].fieldLabels[i];
-		if(c_str)
-			fieldLabels.push_back(c_str);
-		else
-			throw std::invalid_argument("Device Spec for given type is invalid, causing null pointer access");
-	 }
+	memset(&_rxStats, 0, sizeof(FxRxStats));
+	_lastDeviceTimestamp = 0;
+	_consecutiveGaps = 0;
+	_gapRunDelta = 0;
+	_activeFields = &_labels->active(bitmap);
 }
 
 FlexseaDevice::FlexseaDevice(int _id, int _port, std::vector<std::string> fieldLabels, int role, int dataBuffSize)
@@ -55,59 +51,16 @@ FlexseaDevice::FlexseaDevice(int _id, int _port, std::vector<std::string> fieldL
 	, dataMutex(&_dataMutex)
 	, shortId(id)
 	, _role(role)
-	, fieldLabels(fieldLabels)
+	, _labels(FxLabelTable::forLabels(fieldLabels))
 	, _data( dataBuffSize, fieldLabels.size() + 1 )
+	, _decoder(FX_CUSTOM)
 {
 	memset(this->bitmap, 0, FX_BITMAP_WIDTH * sizeof(uint32_t));
-}
-
-/* Returns a vector of strings which describe the fields specified by map  */
-std::vector<std::string> FlexseaDevice::getActiveFieldLabels() const
-{
-	bool equal = true;
-	for(int i = 0; i < FX_BITMAP_WIDTH && equal; i++)
-	{
-		if(lastFieldLabelMap[i] != this->bitmap[i])
-			equal = false;
-	}
-
-	if(equal)
-		return lastRequest;
-
-	uint16_t fieldId = 0;
-	lastRequest.clear();
-
-	 while(fieldId < 32*FX_BITMAP_WIDTH && fieldId < numFields)
-	{
-		if(IS_FIELD_HIGH(fieldId, this->bitmap))
-		{
-			lastRequest.push_back( fieldLabels.at(fieldId) );
-		}
-
-		fieldId++;
-	}
-	for(int i = 0; i < FX_BITMAP_WIDTH; i++)
-		lastFieldLabelMap[i] = this->bitmap[i];
-
-	return lastRequest;
-}
-
-std::vector<int> FlexseaDevice::getActiveFieldIds() const
-{
-	std::vector<int> r;
-	r.reserve(numFields);
-	for(int fieldId = 0; fieldId < numFields; ++fieldId)
-	{
-		if(IS_FIELD_HIGH(fieldId, this->bitmap))
-			r.push_back( fieldId );
-	}
-
-	return r;
-}
-
-std::vector<std::string> FlexseaDevice::getAllFieldLabels() const
-{
-	return fieldLabels;
+	memset(&_rxStats, 0, sizeof(FxRxStats));
+	_lastDeviceTimestamp = 0;
+	_consecutiveGaps = 0;
+	_gapRunDelta = 0;
+	_activeFields = &_labels->active(bitmap);
 }
 
 uint32_t FlexseaDevice::getData(int* fieldIds, int32_t* output, uint16_t outputSize)
@@ -161,18 +114,95 @@ uint32_t FlexseaDevice::getDataPtr(uint32_t index, FX_DataPtr ptr, uint16_t outp
 	}
 	catch(InvalidIndex& e)
 	{
-		std::cout << e.what() << std::endl;
+		FX_DIAG(FX_DIAG_WARN, "%s", e.what());
 		return 0;	
 	}
 	catch(InaccessiblePointer& e)
 	{
-		std::cout << e.what() << std::endl;
+		FX_DIAG(FX_DIAG_WARN, "%s", e.what());
 		return 0;
 	}
 
 	return srcPtr[0];
 }
 
+FX_DataPtr FlexseaDevice::writeRow(uint32_t deviceTimestamp)
+{
+	FX_DataPtr p = _data.getWrite();
+	p[0] = deviceTimestamp;
+
+	uint32_t resetsBefore = _clock.getResetCount();
+	uint64_t ts64 = _clock.unwrap(deviceTimestamp);
+	bool clockReset = _clock.getResetCount() != resetsBefore;
+
+	FxRowInfo *ri = _data.peekBackInfo();
+	_clock.addSample(ts64, ri->rxTimeNs);
+	ri->deviceTs = ts64;
+	ri->alignedNs = _clock.toHostNs(ts64);
+
+	FxRxStats &st = _rxStats;
+	if(clockReset)
+	{
+		// device reset, can't reason about the gap
+		st.timestampResets++;
+	}
+	else if(st.samplesReceived > 0 && ts64 > _lastDeviceTimestamp)
+	{
+		uint64_t delta = ts64 - _lastDeviceTimestamp;
+
+		if(!st.nominalPeriod)
+		{
+			st.nominalPeriod = delta;
+		}
+		else if(delta >= 2 * st.nominalPeriod)
+		{
+			// at least one sample period is missing
+			st.timestampGaps++;
+			st.samplesMissed += (delta + st.nominalPeriod / 2) / st.nominalPeriod - 1;
+
+			// a run of "gaps" of similar size (within 25% of the first one) means the stream rate went down
+			uint64_t diff = delta > _gapRunDelta ? delta - _gapRunDelta : _gapRunDelta - delta;
+			if(!_consecutiveGaps || 4 * diff > _gapRunDelta)
+			{
+				_gapRunDelta = delta;
+				_consecutiveGaps = 1;
+			}
+			else if(++_consecutiveGaps >= 4)
+			{
+				st.nominalPeriod = delta;
+				_consecutiveGaps = 0;
+			}
+		}
+		else
+		{
+			// track slow changes in the period
+			st.nominalPeriod = (7 * st.nominalPeriod + delta + 4) / 8;
+			if(!st.nominalPeriod) st.nominalPeriod = 1;
+			_consecutiveGaps = 0;
+		}
+	}
+
+	_lastDeviceTimestamp = ts64;
+	st.samplesReceived++;
+	return p;
+}
+
+bool FlexseaDevice::getRowInfo(uint32_t index, FxRowInfo *out) const
+{
+	std::lock_guard<std::recursive_mutex> lk(*dataMutex);
+	const FxRowInfo *ri = _data.getInfo(index);
+	if(!ri || !out) return false;
+
+	*out = *ri;
+	return true;
+}
+
+FxRxStats FlexseaDevice::getRxStats() const
+{
+	std::lock_guard<std::recursive_mutex> lk(*dataMutex);
+	return _rxStats;
+}
+
 uint32_t FlexseaDevice::getLatestTimestamp() const
 {
 	if(_data.count())
@@ -181,26 +211,30 @@ uint32_t FlexseaDevice::getLatestTimestamp() const
 	return 0;
 }
 
-uint16_t FlexseaDevice::getIndexAfterTime(uint32_t timestamp) const
+uint64_t FlexseaDevice::getLatestTimestamp64() const
 {
 	std::lock_guard<std::recursive_mutex> lk(*this->dataMutex);
+	return _data.count() ? _clock.latest() : 0;
+}
 
-	size_t lb = 0, ub = _data.count();
-	size_t i = ub/2;
-	uint32_t t = _data.peek(i)[0];
+int64_t FlexseaDevice::toHostTime(uint64_t timestamp64) const
+{
+	std::lock_guard<std::recursive_mutex> lk(*this->dataMutex);
+	return _clock.toHostNs(timestamp64);
+}
 
-	while(i != lb && lb != ub)
-	{
-		if(timestamp > t)
-			lb = i;             //go right
-		else
-			ub = i;             //go left
+double FlexseaDevice::getClockDriftPpm() const
+{
+	std::lock_guard<std::recursive_mutex> lk(*this->dataMutex);
+	return _clock.getDriftPpm();
+}
 
-		i = (lb + ub) / 2;
-		t = _data.peek(i)[0];
-	}
+uint16_t FlexseaDevice::getIndexAfterTime(uint32_t timestamp) const
+{
+	std::lock_guard<std::recursive_mutex> lk(*this->dataMutex);
 
-	return i + (t >= timestamp);
+	// searched on unwrapped timestamps, so wrap around and resets don't break the ordering
+	return findIndexAfterTime64(_clock.unwrapQuery(timestamp), true);
 }
 
 //uint32_t FlexseaDevice::getDataAfterTime(uint32_t timestamp, uint32_t *output, uint16_t outputSize) const
@@ -225,35 +259,27 @@ uint16_t FlexseaDevice::getIndexAfterTime(uint32_t timestamp) const
 
 inline size_t FlexseaDevice::findIndexAfterTime(uint32_t timestamp) const
 {
-// ---- Linear search O(n)
-//    size_t i=0;
-//    while(i < _data.count() && _data.peek(i)[0] <= timestamp)
-//        i++;
+	return findIndexAfterTime64(_clock.unwrapQuery(timestamp));
+}
 
-// ---- Binary search O(logn)
+size_t FlexseaDevice::findIndexAfterTime64(uint64_t timestamp, bool inclusive) const
+{
+// ---- Binary search O(logn) over the unwrapped timestamps, which are monotonic
 
 	size_t lb = 0, ub = _data.count();
 
-	if(ub == 0) return 0;
-
-	size_t i = ub / 2;
-	uint32_t t = _data.peek(i)[0];
-
-	while(i != lb && lb != ub)
+	while(lb < ub)
 	{
-		if(timestamp >= t)
-			lb = i;
-		else
-			ub = i;
+		size_t i = (lb + ub) / 2;
+		uint64_t t = _data.getInfo(i)->deviceTs;
 
-		i = (lb + ub) / 2;
-		t = _data.peek(i)[0];
+		if(inclusive ? (t < timestamp) : (t <= timestamp))
+			lb = i + 1;         //go right
+		else
+			ub = i;             //go left
 	}
 
-	return i + (timestamp >= t);
-
-// ---- std lib implementation ? would have to implement begin and end iterators.. one day!
-
+	return lb;
 }
 
 uint32_t FlexseaDevice::getDataAfterTime(int field, uint32_t timestamp, std::vector<uint32_t> &ts_output, std::vector<int32_t> &data_output) const
@@ -326,31 +352,63 @@ uint32_t FlexseaDevice::getDataAfterTime(const std::vector<int> &fieldIds, uint3
 
 uint32_t FlexseaDevice::getDataAfterTime(uint32_t timestamp, std::vector<uint32_t> &timestamps, std::vector<std::vector<int32_t>> &outputData) const
 {
-	size_t i = 0, sizeData = numFields * sizeof(int32_t);
 	std::lock_guard<std::recursive_mutex> lk(*this->dataMutex);
 
-	while(i < _data.count() && _data.peek(i)[0] <= timestamp)
-		i++;
+	uint64_t ts64 = _clock.unwrapQuery(timestamp);
+	uint64_t last = getDataAfterTime64(ts64, timestamps, outputData);
+
+	return last == ts64 ? timestamp : timestamps.back();
+}
+
+uint64_t FlexseaDevice::getDataAfterTime64(uint64_t timestamp, std::vector<uint32_t> &timestamps, std::vector<std::vector<int32_t>> &outputData) const
+{
+	size_t sizeData = numFields * sizeof(int32_t);
+	std::lock_guard<std::recursive_mutex> lk(*this->dataMutex);
+
+	size_t i = findIndexAfterTime64(timestamp);
 
 	timestamps.clear();
 	timestamps.reserve(_data.count() - i);
 	outputData.clear();
 	outputData.reserve(_data.count() - i);
 
-	FX_DataPtr p = nullptr;
+	uint64_t last = timestamp;
 
 	while(i < _data.count())
 	{
-		p = _data.peek(i++);
+		FX_DataPtr p = _data.peek(i);
+		last = _data.getInfo(i)->deviceTs;
+		i++;
+
 		timestamps.push_back(p[0]);
 		outputData.emplace_back(numFields);
 		memcpy(outputData.back().data(), p+1, sizeData);
 	}
 
-	if(p)
-		return p[0];
-	else
-		return timestamp;
+	return last;
+}
+
+uint64_t FlexseaDevice::getDataAfterTime64(uint64_t timestamp, std::vector<uint32_t> &timestamps, std::vector<int32_t> &outputData) const
+{
+	std::lock_guard<std::recursive_mutex> lk(*this->dataMutex);
+
+	size_t i = findIndexAfterTime64(timestamp);
+	size_t n = _data.count() - i;
+
+	timestamps.resize(n);
+	outputData.resize(n * numFields);
+
+	uint64_t last = timestamp;
+	for(size_t row = 0; row < n; ++row, ++i)
+	{
+		FX_DataPtr p = _data.peek(i);
+		last = _data.getInfo(i)->deviceTs;
+
+		timestamps[row] = p[0];
+		memcpy(outputData.data() + row * numFields, p+1, numFields * sizeof(int32_t));
+	}
+
+	return last;
 }
 
 // looks awful but works
@@ -386,7 +444,7 @@ double FlexseaDevice::getDataRate() const
 std::string FlexseaDevice::getName() const
 {
 	if(this->type < NUM_DEVICE_TYPES && this->type != FX_NONE)
-		return ( fieldLabels.at(0) );
+		return ( _labels->all().at(0) );
 	else if(this->type == FX_CUSTOM)
 		return ( "Custom Device" );
 
@@ -399,4 +457,6 @@ void FlexseaDevice::getBitmap(uint32_t* out) const {
 
 void FlexseaDevice::setBitmap(uint32_t* in) {
 	memcpy(bitmap, in, FX_BITMAP_WIDTH*sizeof(uint32_t));
+	_decoder.setBitmap(bitmap);
+	_activeFields = &_labels->active(bitmap);
 }
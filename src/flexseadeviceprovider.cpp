@@ -2,6 +2,7 @@
 #include <cstring>
 
 FlexseaDeviceProvider::FlexseaDeviceProvider() : defaultDevice(-1, -1, FX_NONE, FLEXSEA_MANAGE_1, 0)
+	, registry(std::make_shared<FxDeviceRegistry>())
 {}
 
 FlexseaDeviceProvider::~FlexseaDeviceProvider()
@@ -10,20 +11,23 @@ FlexseaDeviceProvider::~FlexseaDeviceProvider()
 	mapChangedFlags.clear();
 
 	// de-alloc all devices
-	while(deviceIds.size())
-		removeDevice(deviceIds.at(0));
+	std::vector<int> ids = getDeviceIds();
+	for(int id : ids)
+		removeDevice(id);
+
+	reclaimRetiredDevices();
 }
 
 std::vector<int> FlexseaDeviceProvider::getDeviceIds() const
 {
-	return deviceIds;
+	return snapshot()->deviceIds;
 }
 
 std::vector<int> FlexseaDeviceProvider::getDeviceIds(int portIdx) const
 {
+	FxRegistrySnapshot reg = snapshot();
 	std::vector<int> ids;
-	for(const auto &it : connectedDevices)
-	//for(auto it = connectedDevices.begin(); it != connectedDevices.end(); it++)
+	for(const auto &it : reg->devices)
 	{
 		if(it.second->port == portIdx)
 			ids.push_back(it.first);
@@ -33,45 +37,84 @@ std::vector<int> FlexseaDeviceProvider::getDeviceIds(int portIdx) const
 
 const FxDevicePtr FlexseaDeviceProvider::getDevicePtr(int id) const
 {
-	if(connectedDevices.count(id))
-		return connectedDevices.at(id);
+	return snapshot()->find(id);
+}
+
+FlexseaDevice* FlexseaDeviceProvider::findDevice(int id) const
+{
+	if(FxDeviceTable::inRange(id))
+		return rxTable.find(id);
 
-	return nullptr;
+	// ids outside the table's range (ie: custom devices) fall back to the registry
+	// devices only get released in reclaimRetiredDevices, so the raw pointer outlives the snapshot
+	return snapshot()->find(id).get();
+}
+
+void FlexseaDeviceProvider::publishAdd(const FxDevicePtr &devPtr)
+{
+	std::shared_ptr<FxDeviceRegistry> next = std::make_shared<FxDeviceRegistry>(*snapshot());
+	next->deviceIds.push_back(devPtr->id);
+	next->devices.insert({devPtr->id, devPtr});
+
+	rxTable.insert(devPtr->id, devPtr.get());
+	std::atomic_store(&registry, FxRegistrySnapshot(std::move(next)));
 }
 
 int FlexseaDeviceProvider::addDevice(int id, int port, FlexseaDeviceType type, int role)
 {
-	if(haveDevice(id)) return 1;
+	{
+		std::lock_guard<std::mutex> lk(writeMutex);
+		if(haveDevice(id)) return 1;
 
-	deviceIds.push_back(id);
-	FxDevicePtr devPtr(new FlexseaDevice(id, port, type, role));
-	connectedDevices.insert({id, devPtr});
+		FxDevicePtr devPtr = std::allocate_shared<FlexseaDevice>(FxPoolAllocator<FlexseaDevice>(&FxMemoryPools::instance().devices),
+																 id, port, type, role);
+		publishAdd(devPtr);
+	}
 
 	//Notify device connected
 	deviceConnectedFlags.notify();
+	events.post(FX_EVENT_DEVICE_CONNECTED, id);
 
 	return 0;
 }
 
 int FlexseaDeviceProvider::removeDevice(int id)
 {
-	int found = 0;
-	std::vector<int>::iterator it;
-	for(it = deviceIds.begin(); it != deviceIds.end() && !found; ++it)
 	{
-		if((*it) == id)
-			found = 1;
-	}
-	if(!found) return 1;
+		std::lock_guard<std::mutex> lk(writeMutex);
 
-	//remove record in device ids
-	deviceIds.erase(--it);
+		FxRegistrySnapshot current = snapshot();
+		FxDevicePtr dev = current->find(id);
+		if(!dev) return 1;
 
-	//remove record from connected devices
-	connectedDevices.erase(id);
+		std::shared_ptr<FxDeviceRegistry> next = std::make_shared<FxDeviceRegistry>(*current);
 
-	//Notify device connected
+		//remove record in device ids
+		next->deviceIds.erase(std::remove(next->deviceIds.begin(), next->deviceIds.end(), id), next->deviceIds.end());
+
+		//remove record from connected devices, table entry first so the rx path can't pick it up again
+		next->devices.erase(id);
+		rxTable.erase(id);
+		std::atomic_store(&registry, FxRegistrySnapshot(std::move(next)));
+
+		// the rx path may still hold a raw pointer to this device
+		std::lock_guard<std::mutex> rlk(retiredMutex);
+		retired.push_back(dev);
+	}
+
+	//Notify device removed
 	deviceConnectedFlags.notify();
+	events.post(FX_EVENT_DEVICE_REMOVED, id);
 
 	return 0;
 }
+
+void FlexseaDeviceProvider::reclaimRetiredDevices()
+{
+	std::vector<FxDevicePtr> toRelease;
+	{
+		std::lock_guard<std::mutex> lk(retiredMutex);
+		toRelease.swap(retired);
+	}
+	// devices are destroyed here, outside the lock, unless a user still holds a handle
+}
@@ -7,6 +7,7 @@
 #include "flexsea_comm_multi.h"
 #include "flexsea_multi_frame_packet_def.h"
 #include "comm_string_generation.h"
+#include "fxdiag.h"
 
 extern "C" {
 	#include "flexsea_device_spec.h"
@@ -21,17 +22,33 @@ extern "C" {
 
 #define LONG_ID(shortId, port) ((shortId << 6) | port)
 
+// bytes skipped one at a time looking for a valid frame when the receive buffer fills up with garbage
+#define FX_RESYNC_WINDOW 64
+
 FlexseaSerial::FlexseaSerial()
 	: SerialDriver(FX_NUMPORTS)
 	, haveOpenAttempts(0)
+	, nextOpenAttemptId(0)
+	, probeJitter((unsigned)std::chrono::steady_clock::now().time_since_epoch().count())
 {
+	// constructed before any port, so it outlives them and their messages
+	FxDiagLog::instance();
+
 	portPeriphs = new MultiCommPeriph[FX_NUMPORTS];
 	initializeDeviceSpecs();
+	rxBatch.reserve(16);
 
 	for(int i = 0; i < FX_NUMPORTS; i++)
 	{
 		initMultiPeriph(this->portPeriphs + i, PORT_USB, SLAVE);
 		devicesAtPort[i] = 0;
+		probesSent[i] = 0;
+		openTimeNs[i] = 0;
+		portRxBytes[i] = 0;
+		portResyncs[i] = 0;
+		portResyncFailures[i] = 0;
+		portDiscardedBytes[i] = 0;
+		timeToMetadataMs[i] = -1;
 	}
 }
 
@@ -52,21 +69,31 @@ inline int FlexseaSerial::updateDeviceMetadata(int port, uint8_t *buf)
 
 	int devId = LONG_ID(devShortId, port);
 
+	int64_t openedNs = openTimeNs[port];
+	if(timeToMetadataMs[port] < 0 && openedNs)
+	{
+		auto dt = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::nanoseconds(openedNs);
+		timeToMetadataMs[port] = (int)std::chrono::duration_cast<std::chrono::milliseconds>(dt).count();
+	}
+
 	bool addedDevice = false;
-	if(!connectedDevices.count(devId))
+	FlexseaDevice *dev = findDevice(devId);
+	if(!dev)
 	{
 		addedDevice = !addDevice(devId, devShortId, port, static_cast<FlexseaDeviceType>(devType), devRole);
 		devicesAtPort[port]++;
 	}
-	else if(connectedDevices.at(devId)->type != devType)
+	else if(dev->type != devType)
 	{
-		std::cout << "Device record's type does not match incoming message, something went wrong (two devices connected with same id?)" << std::endl;
+		FX_DIAG(FX_DIAG_WARN, "Device record's type does not match incoming message, something went wrong (two devices connected with same id?)");
 		removeDevice(devId);
 		addedDevice = !addDevice(devId, devShortId, port, static_cast<FlexseaDeviceType>(devType), devRole);
 	}
 
+	dev = findDevice(devId);
+	if(!dev) return -1;
+
 	uint32_t bitmap[FX_BITMAP_WIDTH];
-	auto dev = connectedDevices.at(devId);
 	dev->getBitmap(bitmap);
 	uint32_t temp;
 	// if bitmap is null something is very wrong
@@ -86,77 +113,115 @@ inline int FlexseaSerial::updateDeviceMetadata(int port, uint8_t *buf)
 		std::lock_guard<std::recursive_mutex> lk(*(dev->dataMutex));
 		dev->setBitmap(bitmap);
 		mapChangedFlags.notify();
+		events.post(FX_EVENT_BITMAP_CHANGED, devId);
 	}
 
 	if(addedDevice)
 	{
-		std::cout << "Added device\n";
-		fflush(stdout);
+		FX_DIAG(FX_DIAG_INFO, "Added device %d", devId);
 		deviceConnectedFlags.notify();
 	}
 
+	deviceMetadataReceived(devId);
 
 	return 0;
 }
-inline int FlexseaSerial::updateDeviceData(int port, uint8_t *buf)
+inline int FlexseaSerial::updateDeviceData(int port, uint8_t *buf, uint16_t len)
 {
 	uint8_t shortDevId = buf[MP_XID];
 	int devId = LONG_ID(shortDevId, port);
 
-	if(!connectedDevices.count(devId))
+	FlexseaDevice *d = findDevice(devId);
+	if(!d)
 		return -1;
 
-	FxDevicePtr d = connectedDevices.at(devId);
-	FlexseaDeviceSpec ds = deviceSpecs[d->type];
 	std::lock_guard<std::recursive_mutex> lk(*(d->dataMutex));
 
-	FxDevData *cb = d->getCircBuff();
-	FX_DataPtr fxDataPtr = cb->getWrite();
+	// fast path: decode plan selected when the device was added
+	const FxDecoder &decoder = d->getDecoder();
+
+	// a payload shorter than the active fields isn't turned into a row
+	uint16_t received = len > MP_DATA1 + 1 ? len - (MP_DATA1 + 1) : 0;
+	if(decoder.isSpecialized() && received < decoder.payloadSize())
+	{
+		FX_DIAG(FX_DIAG_WARN, "Device %d sent %d data bytes, %d expected", devId, (int)received, (int)decoder.payloadSize());
+		return -1;
+	}
+
+	uint32_t deviceTimestamp;
+	memcpy(&deviceTimestamp, buf+MP_TSTP, sizeof(uint32_t));
+	FX_DataPtr fxDataPtr = d->writeRow(deviceTimestamp);
+
+	if(events.wants(FX_EVENT_NEW_DATA))
+		countReceivedRow(devId);
+
+	if(decoder.isSpecialized())
+	{
+		decoder.decode(buf+MP_DATA1+1, (int32_t*)(fxDataPtr+1));
+		return 0;
+	}
+
+	// generic path: walk the device spec at runtime
+	if(d->type >= NUM_DEVICE_TYPES)
+		return -1;
+
+	const FlexseaDeviceSpec &ds = deviceSpecs[d->type];
 
 	uint32_t deviceBitmap[FX_BITMAP_WIDTH];
 	d->getBitmap(deviceBitmap);
 
 	// read into the rest of the data like a buffer
-	if(fxDataPtr)
+	uint8_t *dataPtr = (uint8_t*)(fxDataPtr+1);
+	uint16_t j, fieldOffset=0, index=MP_DATA1+1;
+	for(j = 0; j < ds.numFields; j++)
 	{
-		memcpy(fxDataPtr, buf+MP_TSTP, sizeof(uint32_t));
-		uint8_t *dataPtr = (uint8_t*)(fxDataPtr+1);
-		uint16_t j, fieldOffset=0, index=MP_DATA1+1;
-		for(j = 0; j < ds.numFields; j++)
+		if(IS_FIELD_HIGH(j, deviceBitmap))
 		{
-			if(IS_FIELD_HIGH(j, deviceBitmap))
-			{
-				uint8_t ft = ds.fieldTypes[j];
-				uint8_t fw = FORMAT_SIZE_MAP[ft];
-				memcpy(dataPtr + fieldOffset, buf + index, fw);
-
-				if( ft == FORMAT_16S || ft == FORMAT_8S )
-				{
-					uint8_t val = ( *(dataPtr + fieldOffset + fw - 1) >> 7 ) ? 0xFF : 0;
-					memset( dataPtr + fieldOffset + fw, val, sizeof(int32_t) - fw);
-				}
+			uint8_t ft = ds.fieldTypes[j];
+			uint8_t fw = FORMAT_SIZE_MAP[ft];
+			memcpy(dataPtr + fieldOffset, buf + index, fw);
 
-				index+=fw;
+			if( ft == FORMAT_16S || ft == FORMAT_8S )
+			{
+				uint8_t val = ( *(dataPtr + fieldOffset + fw - 1) >> 7 ) ? 0xFF : 0;
+				memset( dataPtr + fieldOffset + fw, val, sizeof(int32_t) - fw);
 			}
 
-			fieldOffset += 4; // storing each value as a separate int32
+			index+=fw;
 		}
 
+		fieldOffset += 4; // storing each value as a separate int32
 	}
-	else
+
+	return 0;
+}
+
+void FlexseaSerial::countReceivedRow(int devId)
+{
+	for(auto &r : rxBatch)
 	{
-		std::cout << "Couldn't allocate memory for reading data into FlexseaDevice " << devId << std::endl;
-		return -1;
+		if(r.first == devId)
+		{
+			r.second++;
+			return;
+		}
 	}
+	rxBatch.emplace_back(devId, 1);
+}
 
-	return 0;
+void FlexseaSerial::postReceivedRows()
+{
+	for(const auto &r : rxBatch)
+		events.post(FX_EVENT_NEW_DATA, r.first, r.second);
+
+	rxBatch.clear();
 }
 
 int FlexseaSerial::sysDataParser(int port)
 {
 	if(port < 0 || port >= FX_NUMPORTS)
 	{
-		std::cout << "invalid port" << std::endl;
+		FX_DIAG(FX_DIAG_ERROR, "sysDataParser: invalid port %d", port);
 		return 0;
 	}
 	MultiCommPeriph *cp = portPeriphs+port;
@@ -165,7 +230,7 @@ int FlexseaSerial::sysDataParser(int port)
 	bool isMeantForPlan = msgBuf[MP_RID] / 10 == 1;
 	if(!isMeantForPlan)
 	{
-		std::cout << "Received message with invalid RID, probably some kind of device-side error\n";
+		FX_DIAG(FX_DIAG_WARN, "Received message with invalid RID, probably some kind of device-side error");
 		return -1;
 	}
 
@@ -173,97 +238,132 @@ int FlexseaSerial::sysDataParser(int port)
 	if(isMetaData)
 		return updateDeviceMetadata(port, msgBuf);
 	else
-		return updateDeviceData(port, msgBuf);
+		return updateDeviceData(port, msgBuf, cp->in.unpackedIdx);
 }
 
 #define CALL_MEMBER_FN(object,ptrToMember)  ((object)->*(ptrToMember))
 
 void FlexseaSerial::processReceivedData(int port, size_t len)
 {
-	int totalBuffered = len + circ_buff_get_size(&(portPeriphs[port].circularBuff));
-	int numMessagesReceived = 0;
-//    int numMessagesExpected = (totalBuffered / COMM_STR_BUF_LEN);
+	MultiCommPeriph *cp = portPeriphs+port;
+	int totalBuffered = len + circ_buff_get_size(&cp->circularBuff);
 	int maxMessagesExpected = (totalBuffered / COMM_STR_BUF_LEN + (totalBuffered % COMM_STR_BUF_LEN != 0));
 
 	uint16_t bytesToWrite, cbSpace, bytesWritten=0;
-	int error, successfulParse;
+	int error;
 
 	while(len > 0)
 	{
-		cbSpace = CB_BUF_LEN - circ_buff_get_size(&(portPeriphs[port].circularBuff));
+		cbSpace = CB_BUF_LEN - circ_buff_get_size(&cp->circularBuff);
 		bytesToWrite = MIN(len, cbSpace);
 
-		error = circ_buff_write(&(portPeriphs[port].circularBuff), (largeRxBuffer+bytesWritten), bytesToWrite);
-		if(error) std::cout << "circ_buff_write error:" << error << std::endl;
+		error = circ_buff_write(&cp->circularBuff, (largeRxBuffer+bytesWritten), bytesToWrite);
+		if(error) FX_DIAG(FX_DIAG_ERROR, "circ_buff_write error: %d", error);
 
-		do {
-			portPeriphs[port].bytesReadyFlag = 1;
-			portPeriphs[port].in.isMultiComplete = 0;
+		unpackBuffered(port, &maxMessagesExpected);
 
-			MultiCommPeriph *cp = portPeriphs+port;
-			int convertedBytes = unpack_multi_payload_cb(&cp->circularBuff, &cp->in);
-			error = circ_buff_move_head(&cp->circularBuff, convertedBytes);
+		len -= bytesToWrite;
+		bytesWritten += bytesToWrite;
 
-			if(portPeriphs[port].in.isMultiComplete)
+		if(CB_BUF_LEN == circ_buff_get_size(&cp->circularBuff) && len)
+			resync(port, bytesToWrite);
+	}
+
+}
+
+bool FlexseaSerial::unpackBuffered(int port, int *budget)
+{
+	MultiCommPeriph *cp = portPeriphs+port;
+	bool progress = false;
+	int error, successfulParse;
+
+	do {
+		cp->bytesReadyFlag = 1;
+		cp->in.isMultiComplete = 0;
+
+		int convertedBytes = unpack_multi_payload_cb(&cp->circularBuff, &cp->in);
+		error = circ_buff_move_head(&cp->circularBuff, convertedBytes);
+
+		if(cp->in.isMultiComplete)
+		{
+			uint8_t cmd = MULTI_GET_CMD7(cp->in.unpacked);
+			int parseResult;
+
+			if(cmd == CMD_SYSDATA)
+			{
+				// use sys data handling
+				parseResult = sysDataParser(port);
+			}
+			else if(isCmdOverloaded(cmd))
+			{
+				// use user added Rx function
+				MultiPacketInfo info;
+				info.xid = cp->in.unpacked[MP_XID];
+				info.rid = cp->in.unpacked[MP_RID];
+				info.portIn = port;
+				info.portOut = port;
+
+				callRx(cmd, &info, cp->in.unpacked + MP_DATA1, cp->in.unpackedIdx);
+			}
+			else
 			{
-				uint8_t cmd = MULTI_GET_CMD7(portPeriphs[port].in.unpacked);
-				int parseResult;
-
-				if(cmd == CMD_SYSDATA)
-				{
-					// use sys data handling
-					parseResult = sysDataParser(port);
-				}
-				else if(isCmdOverloaded(cmd))
-				{
-					// use user added Rx function
-					MultiPacketInfo info;
-					info.xid = cp->in.unpacked[MP_XID];
-					info.rid = cp->in.unpacked[MP_RID];
-					info.portIn = port;
-					info.portOut = port;
-
-					callRx(cmd, &info, cp->in.unpacked + MP_DATA1, cp->in.unpackedIdx);
-				}
+				// use c stack function
+				// c stack functions use device roles as ids...
+				int shortId = cp->in.unpacked[MP_XID];
+				int devId = LONG_ID(shortId, port);
+				FlexseaDevice *dev = findDevice(devId);
+
+				if(dev)
+					cp->in.unpacked[MP_XID] = dev->getRole();
 				else
-				{
-					// use c stack function
-					// c stack functions use device roles as ids...
-					int shortId = cp->in.unpacked[MP_XID];
-					int devId = LONG_ID(shortId, port);
-					auto dev = getDevicePtr(devId);
-
-					if(dev)
-						cp->in.unpacked[MP_XID] = dev->getRole();
-					else
-						std::cout << "Problem in processReceivedData(), invalid dev";
-
-					parseResult = parseReadyMultiString(cp);
-				}
-
-				numMessagesReceived++;
-				(void) parseResult;
+					FX_DIAG(FX_DIAG_WARN, "Problem in processReceivedData(), invalid dev %d", devId);
+
+				parseResult = parseReadyMultiString(cp);
 			}
 
-			successfulParse = convertedBytes > 0 && !error;
-		} while(successfulParse && numMessagesReceived < maxMessagesExpected);
+			(*budget)--;
+			(void) parseResult;
+		}
 
-		len -= bytesToWrite;
-		bytesWritten += bytesToWrite;
+		successfulParse = convertedBytes > 0 && !error;
+		progress |= convertedBytes > 0;
+	} while(successfulParse && *budget > 0);
 
-		if(CB_BUF_LEN == circ_buff_get_size(&(portPeriphs[port].circularBuff)) && len)
-		{
-			std::cout << "circ buffer is full with non valid frames; clearing..." << std::endl;
-			// erase all the bytes except the ones we just wrote
-			circ_buff_move_head(&(portPeriphs[port].circularBuff), CB_BUF_LEN - bytesToWrite);
-		}
+	return progress;
+}
+
+void FlexseaSerial::resync(int port, uint16_t keepBytes)
+{
+	MultiCommPeriph *cp = portPeriphs+port;
+	portResyncs[port]++;
+
+	// the buffer is full of data that won't unpack, typically a corrupt header announcing a frame
+	// that never completes. Step past it a byte at a time, the unpacker only accepts a valid header
+	// and checksum, so frames behind the garbage are kept
+	for(int skipped = 0; skipped < FX_RESYNC_WINDOW; ++skipped)
+	{
+		circ_buff_move_head(&cp->circularBuff, 1);
+		portDiscardedBytes[port]++;
+
+		int budget = CB_BUF_LEN / COMM_STR_BUF_LEN + 1;
+		if(unpackBuffered(port, &budget))
+			return;
 	}
 
+	// nothing valid within the window: erase all the bytes except the ones just written
+	int size = circ_buff_get_size(&cp->circularBuff);
+	if(size > keepBytes)
+	{
+		circ_buff_move_head(&cp->circularBuff, size - keepBytes);
+		portDiscardedBytes[port] += size - keepBytes;
+	}
+	portResyncFailures[port]++;
 }
 
 void FlexseaSerial::periodicTask()
 {
-	serviceOpenAttempts(taskPeriod);
+	reclaimRetiredDevices();
+	serviceOpenAttempts();
 	serviceOpenPorts();
 }
 
@@ -280,9 +380,27 @@ void FlexseaSerial::serviceOpenPorts()
 			nr = nb > MAX_SERIAL_RX_LEN ? MAX_SERIAL_RX_LEN : nb;
 			nb -= nr;
 			readPort(i, largeRxBuffer, nr);
+			portRxBytes[i] += nr;
 			processReceivedData(i, nr);
 		}
 	}
+
+	// one new data event per device per pass, rather than per packet
+	if(!rxBatch.empty())
+		postReceivedRows();
+}
+
+void FlexseaSerial::receiveBytes(int port, const uint8_t *bytes, size_t n)
+{
+	while(n > 0)
+	{
+		size_t nr = n > MAX_SERIAL_RX_LEN ? MAX_SERIAL_RX_LEN : n;
+		memcpy(largeRxBuffer, bytes, nr);
+		portRxBytes[port] += nr;
+		processReceivedData(port, nr);
+		bytes += nr;
+		n -= nr;
+	}
 }
 
 bool FlexseaSerial::wakeFromLongSleep() { return numPortsOpen() > 0 || haveOpenAttempts; }
@@ -298,29 +416,42 @@ void FlexseaSerial::sendDeviceWhoAmI(int port)
 	error = CommStringGeneration::generateCommString(0, out, tx_cmd_sysdata_r, &flag, lenFlags);
 
 	if(error)
-		std::cout << "Error packing multipacket" << std::endl;
+		FX_DIAG(FX_DIAG_ERROR, "Error packing multipacket");
 	else
 	{
+		// writes are bounded (FX_SERIAL_WRITE_TIMEOUT_MS), a device that isn't reading yet just misses this probe
 		unsigned int frameId = 0;
+		bool written = true;
 		while(out->frameMap > 0)
 		{
-			write(PACKET_WRAPPER_LEN, out->packed[frameId], port);
+			if(written)
+				written = write(PACKET_WRAPPER_LEN, out->packed[frameId], port);
 			out->frameMap &= (   ~(1 << frameId)   );
 			frameId++;
 		}
 		out->isMultiComplete = 1;
-		std::cout << "Wrote who am i message" << std::endl;
+		if(written)
+			FX_DIAG(FX_DIAG_DEBUG, "Wrote who am i message on port %d", port);
+		else
+			FX_DIAG(FX_DIAG_DEBUG, "Who am i message on port %d not written, will retry", port);
 	}
 }
 
 
 void FlexseaSerial::open(std::string portName, int portIdx)
 {
+	if(portIdx >= 0 && portIdx < FX_NUMPORTS)
+	{
+		openTimeNs[portIdx] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now().time_since_epoch()).count();
+		probesSent[portIdx] = 0;
+		timeToMetadataMs[portIdx] = -1;
+	}
+
 	tryOpen(portName, portIdx);
 
 	std::lock_guard<std::mutex> lk(openAttemptMut_);
-	const int OPEN_DELAY = 250;
-	openAttempts.emplace_back(portIdx, portName, 0, 10, OPEN_DELAY, 0);
+	openAttempts.emplace_back(nextOpenAttemptId++, portIdx, portName);
 
 	if(!haveOpenAttempts)
 	{
@@ -338,32 +469,63 @@ void FlexseaSerial::writeDevice(uint8_t bytes_to_send, uint8_t *serial_tx_data,
 
 void FlexseaSerial::close(uint16_t portIdx)
 {
-	std::vector<int> idsToRemove;
-	idsToRemove.reserve(connectedDevices.size());
-
-	for(const auto &d : connectedDevices)
-	{
-		if(d.second->port == portIdx)
-			idsToRemove.push_back(d.first);
-	}
+	std::vector<int> idsToRemove = getDeviceIds(portIdx);
 
 	for(const int &id : idsToRemove)
 	{
 		this->removeDevice(id);
-		std::cout << "Removed device : " << id << std::endl;
+		FX_DIAG(FX_DIAG_INFO, "Removed device : %d", id);
 	}
 
 	devicesAtPort[portIdx] = 0;
 	tryClose(portIdx);
 }
 
-void FlexseaSerial::serviceOpenAttempts(uint8_t delayed)
+FxPortRxStats FlexseaSerial::getPortRxStats(int portIdx) const
+{
+	FxPortRxStats st = {0, 0, 0, 0};
+	if(portIdx < 0 || portIdx >= FX_NUMPORTS) return st;
+
+	st.bytes = portRxBytes[portIdx];
+	st.resyncs = portResyncs[portIdx];
+	st.resyncFailures = portResyncFailures[portIdx];
+	st.discardedBytes = portDiscardedBytes[portIdx];
+	return st;
+}
+
+FxPortDiscovery FlexseaSerial::getPortDiscovery(int portIdx) const
+{
+	FxPortDiscovery d = {0, -1};
+	if(portIdx < 0 || portIdx >= FX_NUMPORTS) return d;
+
+	d.probes = probesSent[portIdx];
+	d.timeToMetadataMs = timeToMetadataMs[portIdx];
+	return d;
+}
+
+int FlexseaSerial::nextProbeDelay(int delayMs)
+{
+	if(delayMs <= 0) return FX_WHOAMI_FIRST_DELAY_MS;
+
+	// +/- 25% so that ports opened together don't keep probing in lockstep
+	std::uniform_int_distribution<int> jitter(-delayMs / 4, delayMs / 4);
+	int next = 2 * delayMs + jitter(probeJitter);
+	return next < FX_WHOAMI_MAX_DELAY_MS ? next : FX_WHOAMI_MAX_DELAY_MS;
+}
+
+void FlexseaSerial::serviceOpenAttempts()
 {
-	std::lock_guard<std::mutex> lk(openAttemptMut_);
 	if(!haveOpenAttempts) return;
 
-	// iterate through and service each attempt
-	for(auto& attempt : openAttempts)
+	OpenAttemptList attempts;
+	{
+		std::lock_guard<std::mutex> lk(openAttemptMut_);
+		attempts = openAttempts;
+	}
+
+	// each port is probed on its own schedule, a silent port doesn't delay the others
+	auto now = std::chrono::steady_clock::now();
+	for(auto& attempt : attempts)
 	{
 		auto state = getPortState(attempt.portIdx);
 
@@ -373,11 +535,12 @@ void FlexseaSerial::serviceOpenAttempts(uint8_t delayed)
 		}
 		else if(state == serial::state_open && devicesAtPort[attempt.portIdx] < 1)
 		{
-			attempt.delayed += delayed;
-			if(attempt.delayed >= attempt.delay)
+			if(now >= attempt.nextProbe)
 			{
-				attempt.delayed -= attempt.delay;
 				sendDeviceWhoAmI(attempt.portIdx);
+				probesSent[attempt.portIdx]++;
+				attempt.delayMs = nextProbeDelay(attempt.delayMs);
+				attempt.nextProbe = now + std::chrono::milliseconds(attempt.delayMs);
 			}
 		}
 		else
@@ -390,10 +553,25 @@ void FlexseaSerial::serviceOpenAttempts(uint8_t delayed)
 		}
 	}
 
+	std::lock_guard<std::mutex> lk(openAttemptMut_);
+
+	// write back, attempts added by open() in the meantime are left alone
+	for(auto& attempt : openAttempts)
+	{
+		for(auto& serviced : attempts)
+		{
+			if(serviced.id == attempt.id)
+			{
+				attempt = serviced;
+				break;
+			}
+		}
+	}
+
 	// remove attempts that are complete
 	openAttempts.erase(
 				std::remove_if(openAttempts.begin(), openAttempts.end(),
-							   [=](OpenAttempt oa){return oa.markedToRemove;} ),
+							   [=](const OpenAttempt &oa){return oa.markedToRemove;} ),
 				openAttempts.end());
 
 	std::lock_guard<std::mutex> pTaskLock(conditionMutex);
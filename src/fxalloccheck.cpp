@@ -0,0 +1,295 @@
+#include "fxalloccheck.h"
+#include "testserial.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <thread>
+
+#if defined(FX_ALLOC_CHECK) && defined(__linux__)
+#include <execinfo.h>
+#define FX_ALLOC_BACKTRACE
+#endif
+
+// with glibc, malloc and friends are replaced too, so allocations made by the C parts of the stack are seen
+#if defined(FX_ALLOC_CHECK) && defined(__GLIBC__)
+#define FX_ALLOC_MALLOC
+extern "C" {
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t n, size_t size);
+	void* __libc_realloc(void *p, size_t size);
+	void __libc_free(void *p);
+}
+#endif
+
+// allocations whose call stack is kept, and the depth kept
+#define FX_ALLOC_MAX_RECORDS 32
+#define FX_ALLOC_MAX_FRAMES 16
+
+#ifdef FX_ALLOC_CHECK
+
+namespace {
+
+struct AllocRecord {
+	size_t size;
+	int depth;
+	void *frames[FX_ALLOC_MAX_FRAMES];
+};
+
+std::atomic<bool> armed(false);
+std::atomic<uint64_t> allocCount(0);
+std::atomic<uint32_t> numRecords(0);
+AllocRecord records[FX_ALLOC_MAX_RECORDS];
+
+// backtrace may allocate itself, those allocations aren't counted
+// initial exec TLS, since a dynamically allocated TLS block would be allocated by malloc
+#ifdef FX_ALLOC_MALLOC
+__thread bool inHook __attribute__((tls_model("initial-exec"))) = false;
+#else
+thread_local bool inHook = false;
+#endif
+
+void noteAllocation(size_t size)
+{
+	if(!armed.load(std::memory_order_relaxed) || inHook) return;
+
+	inHook = true;
+	allocCount++;
+
+	uint32_t i = numRecords.fetch_add(1);
+	if(i < FX_ALLOC_MAX_RECORDS)
+	{
+		records[i].size = size;
+#ifdef FX_ALLOC_BACKTRACE
+		records[i].depth = backtrace(records[i].frames, FX_ALLOC_MAX_FRAMES);
+#else
+		records[i].depth = 0;
+#endif
+	}
+	inHook = false;
+}
+
+// operator new allocates without going through the malloc hook, so it isn't counted twice
+void* rawMalloc(size_t size)
+{
+#ifdef FX_ALLOC_MALLOC
+	return __libc_malloc(size ? size : 1);
+#else
+	return malloc(size ? size : 1);
+#endif
+}
+
+void* allocate(size_t size)
+{
+	noteAllocation(size);
+	void *p = rawMalloc(size);
+	if(!p) throw std::bad_alloc();
+	return p;
+}
+
+}
+
+#ifdef FX_ALLOC_MALLOC
+extern "C" {
+
+void* malloc(size_t size)
+{
+	noteAllocation(size);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+	noteAllocation(n * size);
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void *p, size_t size)
+{
+	if(size) noteAllocation(size);
+	return __libc_realloc(p, size);
+}
+
+void free(void *p)
+{
+	__libc_free(p);
+}
+
+}
+#endif
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	noteAllocation(size);
+	return rawMalloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	noteAllocation(size);
+	return rawMalloc(size);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void *p, const std::nothrow_t&) noexcept { free(p); }
+
+bool FxAllocTracker::isAvailable() { return true; }
+
+void FxAllocTracker::arm()
+{
+#ifdef FX_ALLOC_BACKTRACE
+	// the first backtrace loads the unwinder, get that out of the way
+	void *frame;
+	backtrace(&frame, 1);
+#endif
+	allocCount = 0;
+	numRecords = 0;
+	armed = true;
+}
+
+uint64_t FxAllocTracker::disarm()
+{
+	armed = false;
+	return allocCount;
+}
+
+uint64_t FxAllocTracker::getCount() { return allocCount; }
+
+std::string FxAllocTracker::report()
+{
+	std::ostringstream out;
+	uint32_t n = numRecords;
+	if(n > FX_ALLOC_MAX_RECORDS) n = FX_ALLOC_MAX_RECORDS;
+
+	for(uint32_t i = 0; i < n; ++i)
+	{
+		out << "allocation of " << records[i].size << " bytes" << std::endl;
+#ifdef FX_ALLOC_BACKTRACE
+		char **symbols = backtrace_symbols(records[i].frames, records[i].depth);
+		// skip the hook's own frames
+		for(int f = 2; symbols && f < records[i].depth; ++f)
+			out << "\t" << symbols[f] << std::endl;
+		free(symbols);
+#endif
+	}
+
+	if(allocCount > n)
+		out << (allocCount - n) << " more allocations" << std::endl;
+	return out.str();
+}
+
+#else
+
+bool FxAllocTracker::isAvailable() { return false; }
+void FxAllocTracker::arm() {}
+uint64_t FxAllocTracker::disarm() { return 0; }
+uint64_t FxAllocTracker::getCount() { return 0; }
+std::string FxAllocTracker::report() { return std::string(); }
+
+#endif
+
+FxSteadyStateResult fxCheckSteadyStateAllocations(const FxSteadyStateConfig &config)
+{
+	FxSteadyStateResult result = {false, 0, std::string()};
+	if(!FxAllocTracker::isAvailable())
+	{
+		std::cout << "Allocation check: the library was built without FX_ALLOC_CHECK" << std::endl;
+		return result;
+	}
+
+	if(!FxMemoryPools::instance().isConfigured())
+		FxMemoryPools::instance().configure({FX_DEFAULT_MESSAGE_BLOCKS, FX_DEFAULT_MAX_DEVICES, true});
+
+	TestSerial sim;
+	sim.taskPeriod = 1;
+	sim.setBitmapMinimizer(config.minimizeBitmaps);
+	std::thread commThread(&CommManager::runPeriodicTask, &sim);
+
+	std::vector<int> ids;
+	for(int i = 0; i < config.numDevices; ++i)
+	{
+		int id = sim.addPackedDevice(i + 1, FX_RIGID);
+		if(id >= 0 && sim.startStreaming(id, config.freq, config.log, false))
+			ids.push_back(id);
+	}
+
+	// what is read without a readDevice, into buffers kept across polls
+	std::vector<uint32_t> timestamps;
+	std::vector<int32_t> rows;
+	std::vector<int32_t> latest(32 * FX_BITMAP_WIDTH + 1);
+	uint64_t lastTs[FX_DEFAULT_MAX_DEVICES] = {0};
+
+	auto poll = [&]() {
+		for(size_t i = 0; i < ids.size() && i < FX_DEFAULT_MAX_DEVICES; ++i)
+		{
+			if(config.readDevice)
+			{
+				config.readDevice(sim, ids[i]);
+				continue;
+			}
+
+			FxDevicePtr dev = sim.getDevicePtr(ids[i]);
+			if(!dev || !dev->dataCount()) continue;
+
+			dev->getDataPtr(dev->dataCount() - 1, (FX_DataPtr)latest.data(), latest.size());
+			const std::vector<int> &fids = dev->getActiveFieldIds();
+			(void)fids;
+			lastTs[i] = dev->getDataAfterTime64(lastTs[i], timestamps, rows);
+		}
+	};
+
+	auto runFor = [&](int ms) {
+		auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+		while(std::chrono::steady_clock::now() < end)
+		{
+			poll();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	};
+
+	runFor(config.warmupMs);
+
+	// a session where the frames never make it to the devices checks nothing
+	bool receiving = !ids.empty();
+	for(auto &&id : ids)
+	{
+		FxDevicePtr dev = sim.getDevicePtr(id);
+		receiving = receiving && dev && dev->dataCount();
+	}
+
+	if(receiving)
+	{
+		FxAllocTracker::arm();
+		runFor(config.durationMs);
+		result.allocations = FxAllocTracker::disarm();
+		result.report = FxAllocTracker::report();
+		result.ran = true;
+	}
+
+	for(auto &&id : ids)
+		sim.stopStreaming(id);
+	sim.quitPeriodicTask();
+	commThread.join();
+
+	if(!result.ran)
+	{
+		std::cout << "Allocation check: no data received from the simulated devices" << std::endl;
+		return result;
+	}
+
+	std::cout << "Allocation check: " << result.allocations << " allocations in " << config.durationMs
+			  << " ms of steady state streaming from " << ids.size() << " devices" << std::endl;
+	if(result.allocations)
+		std::cout << result.report;
+
+	return result;
+}
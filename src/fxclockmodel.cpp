@@ -0,0 +1,127 @@
+#include "fxclockmodel.h"
+#include <cmath>
+
+#define FX_CLOCK_WINDOW_NS 1000000000LL
+#define FX_CLOCK_ALPHA 0.1
+#define FX_WRAP_SPAN (1ULL << 32)
+#define FX_HALF_WRAP (1ULL << 31)
+
+FxClockModel::FxClockModel()
+	: epochOffset(0), _latest(0), lastRaw(0), haveRaw(false), resets(0)
+{
+	resetFit();
+}
+
+void FxClockModel::resetFit()
+{
+	windowStartNs = 0;
+	windowMinOffset = 0;
+	windowMinTs = 0;
+	windowOpen = false;
+
+	meanTs = meanOffset = varTs = covTsOffset = 0;
+	slope = 0;
+	haveFit = false;
+}
+
+uint64_t FxClockModel::unwrap(uint32_t raw)
+{
+	if(!haveRaw)
+	{
+		haveRaw = true;
+	}
+	else if(raw < lastRaw)
+	{
+		if(lastRaw - raw > FX_HALF_WRAP)
+		{
+			// counter wrapped around
+			epochOffset += FX_WRAP_SPAN;
+		}
+		else
+		{
+			// device reset: continue right after the last timestamp we saw
+			epochOffset += (uint64_t)(lastRaw - raw) + 1;
+			resets++;
+			resetFit();
+		}
+	}
+
+	lastRaw = raw;
+	_latest = raw + epochOffset;
+	return _latest;
+}
+
+uint64_t FxClockModel::unwrapQuery(uint32_t raw) const
+{
+	if(!haveRaw) return raw;
+
+	uint64_t q = raw + epochOffset;
+
+	if(raw > lastRaw && raw - lastRaw > FX_HALF_WRAP && q >= FX_WRAP_SPAN)
+		q -= FX_WRAP_SPAN;		// from before the last wrap
+	else if(raw < lastRaw && lastRaw - raw > FX_HALF_WRAP)
+		q += FX_WRAP_SPAN;		// from after the next wrap
+
+	return q;
+}
+
+void FxClockModel::addSample(uint64_t deviceTs, int64_t hostNs)
+{
+	int64_t offset = hostNs - (int64_t)deviceTs * FX_DEVICE_TICK_NS;
+
+	if(!windowOpen)
+	{
+		windowOpen = true;
+		windowStartNs = hostNs;
+		windowMinOffset = offset;
+		windowMinTs = deviceTs;
+		return;
+	}
+
+	// lowest (host - device) in the window is the sample with the least transport latency
+	if(offset < windowMinOffset)
+	{
+		windowMinOffset = offset;
+		windowMinTs = deviceTs;
+	}
+
+	if(hostNs - windowStartNs < FX_CLOCK_WINDOW_NS)
+		return;
+
+	// fold the window's minimum into the fit
+	if(!haveFit)
+	{
+		meanTs = windowMinTs;
+		meanOffset = windowMinOffset;
+		haveFit = true;
+	}
+	else
+	{
+		const double a = FX_CLOCK_ALPHA;
+		double dx = (double)windowMinTs - meanTs;
+		double dy = (double)windowMinOffset - meanOffset;
+		meanTs += a * dx;
+		meanOffset += a * dy;
+		varTs = (1 - a) * (varTs + a * dx * dx);
+		covTsOffset = (1 - a) * (covTsOffset + a * dx * dy);
+
+		if(varTs > 0)
+			slope = covTsOffset / varTs;
+	}
+
+	windowStartNs = hostNs;
+	windowMinOffset = offset;
+	windowMinTs = deviceTs;
+}
+
+int64_t FxClockModel::toHostNs(uint64_t deviceTs) const
+{
+	int64_t base = (int64_t)deviceTs * FX_DEVICE_TICK_NS;
+
+	if(haveFit)
+		return base + std::llround(meanOffset + slope * ((double)deviceTs - meanTs));
+	if(windowOpen)
+		return base + windowMinOffset;
+
+	return 0;
+}
@@ -0,0 +1,85 @@
+#include "fxcommand.h"
+
+#include <cstring>
+
+FxCommandState::FxCommandState(int id, bool awaitConfirmation, std::chrono::steady_clock::time_point dl)
+	: devId(id)
+	, awaitsConfirmation(awaitConfirmation)
+	, deadline(dl)
+	, status(FX_CMD_PENDING)
+	, future(promise.get_future().share())
+{
+	memset(expectedBitmap, 0, sizeof(expectedBitmap));
+}
+
+FxCommandStatus FxCommandState::getStatus() const
+{
+	std::lock_guard<std::mutex> lk(mutex);
+	return status;
+}
+
+void FxCommandState::resolve(FxCommandStatus s)
+{
+	std::vector<FxCommandCallback> toCall;
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		if(fxCommandIsFinal(status, awaitsConfirmation) || s <= status)
+			return;
+
+		status = s;
+		if(!fxCommandIsFinal(status, awaitsConfirmation))
+			return;
+
+		promise.set_value(status);
+		toCall.swap(callbacks);
+	}
+	cv.notify_all();
+
+	for(auto &&cb : toCall)
+		cb(devId, s);
+}
+
+void FxCommandState::addCallback(const FxCommandCallback &cb)
+{
+	FxCommandStatus s;
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		if(!fxCommandIsFinal(status, awaitsConfirmation))
+		{
+			callbacks.push_back(cb);
+			return;
+		}
+		s = status;
+	}
+	cb(devId, s);
+}
+
+FxCommandStatus FxCommandState::wait(std::chrono::milliseconds timeout) const
+{
+	std::unique_lock<std::mutex> lk(mutex);
+	auto done = [this]{ return fxCommandIsFinal(status, awaitsConfirmation); };
+
+	if(timeout == std::chrono::milliseconds::max())
+		cv.wait(lk, done);
+	else
+		cv.wait_for(lk, timeout, done);
+
+	return status;
+}
+
+std::shared_future<FxCommandStatus> FxCommandHandle::getFuture() const
+{
+	if(state) return state->getFuture();
+
+	std::promise<FxCommandStatus> p;
+	p.set_value(FX_CMD_FAILED);
+	return p.get_future().share();
+}
+
+void FxCommandHandle::then(const FxCommandCallback &cb) const
+{
+	if(state)
+		state->addCallback(cb);
+	else
+		cb(-1, FX_CMD_FAILED);
+}
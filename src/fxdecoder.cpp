@@ -0,0 +1,76 @@
+#include "fxdecoder.h"
+
+extern "C" {
+	#include "flexsea_dataformats.h"
+}
+
+FxDecoder::FxDecoder(FlexseaDeviceType type_)
+	: type(type_)
+	, specialized(false)
+	, _payloadSize(0)
+{
+	// only types described by deviceSpecs get a specialized decoder
+	specialized = type < NUM_DEVICE_TYPES && type != FX_NONE && deviceSpecs[type].fieldTypes;
+}
+
+void FxDecoder::setBitmap(const uint32_t *bitmap)
+{
+	runs.clear();
+	_payloadSize = 0;
+
+	if(!isSpecialized()) return;
+
+	const FlexseaDeviceSpec &ds = deviceSpecs[type];
+	runs.reserve(ds.numFields);
+
+	uint16_t src = 0;
+	for(uint16_t j = 0; j < ds.numFields; ++j)
+	{
+		if(!IS_FIELD_HIGH(j, bitmap)) continue;
+
+		uint8_t ft = ds.fieldTypes[j];
+		uint8_t fw = FORMAT_SIZE_MAP[ft];
+
+		uint8_t kind;
+		if(ft == FORMAT_16S)		kind = OP_16S;
+		else if(ft == FORMAT_16U)	kind = OP_16U;
+		else if(ft == FORMAT_8S)	kind = OP_8S;
+		else if(ft == FORMAT_8U)	kind = OP_8U;
+		else if(fw == sizeof(int32_t))	kind = OP_32;
+		else						kind = OP_RAW;
+
+		// fields are packed back to back on the wire, so a run only needs contiguous row slots
+		FieldRun *last = runs.empty() ? nullptr : &runs.back();
+		if(last && last->kind == kind && last->width == fw && kind != OP_RAW && last->dst + last->count == j)
+			last->count++;
+		else
+			runs.push_back({src, j, 1, kind, fw});
+
+		src += fw;
+	}
+
+	_payloadSize = src;
+}
+
+void FxDecoder::decodeRuns(const FieldRun *runs, size_t n, const uint8_t *payload, int32_t *row)
+{
+	for(size_t i = 0; i < n; ++i)
+	{
+		const FieldRun &r = runs[i];
+		const uint8_t *src = payload + r.src;
+		int32_t *dst = row + r.dst;
+
+		switch(r.kind)
+		{
+		case OP_32:		memcpy(dst, src, r.count * sizeof(int32_t));	break;
+		case OP_16S:	decodeRun<int16_t>(src, dst, r.count);			break;
+		case OP_16U:	decodeRun<uint16_t>(src, dst, r.count);			break;
+		case OP_8S:		decodeRun<int8_t>(src, dst, r.count);			break;
+		case OP_8U:		decodeRun<uint8_t>(src, dst, r.count);			break;
+		default:
+			*dst = 0;
+			memcpy(dst, src, r.width < sizeof(int32_t) ? r.width : sizeof(int32_t));
+			break;
+		}
+	}
+}
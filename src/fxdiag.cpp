@@ -0,0 +1,194 @@
+#include "fxdiag.h"
+
+#include <cstdarg>
+#include <cstring>
+#include <chrono>
+
+// how often the flusher wakes up to write queued messages
+#define FX_DIAG_FLUSH_MS 20
+
+static const char* levelName(int l)
+{
+	switch(l)
+	{
+	case FX_DIAG_ERROR: return "error";
+	case FX_DIAG_WARN: return "warning";
+	case FX_DIAG_INFO: return "info";
+	case FX_DIAG_DEBUG: return "debug";
+	default: return "";
+	}
+}
+
+FxDiagLog::FxDiagLog()
+	: enqueuePos(0)
+	, dequeuePos(0)
+	, dropped(0)
+	, reportedDrops(0)
+	, level(FX_DIAG_INFO)
+	, out(stdout)
+	, callback(nullptr)
+	, quit(false)
+{
+	for(uint64_t i = 0; i < FX_DIAG_RING_SIZE; ++i)
+		slots[i].seq.store(i, std::memory_order_relaxed);
+}
+
+FxDiagLog::~FxDiagLog()
+{
+	quit = true;
+	if(flusher.joinable())
+		flusher.join();
+	flush();
+
+	if(out && out != stdout)
+		fclose(out);
+}
+
+FxDiagLog& FxDiagLog::instance()
+{
+	static FxDiagLog log;
+	return log;
+}
+
+bool FxDiagLog::setOutput(const char *path)
+{
+	FILE *f = stdout;
+	if(path && *path)
+	{
+		f = fopen(path, "a");
+		if(!f) return false;
+	}
+
+	std::lock_guard<std::mutex> lk(outputMutex);
+	if(out && out != stdout)
+		fclose(out);
+	out = f;
+	return true;
+}
+
+void FxDiagLog::setCallback(FxDiagCallback cb)
+{
+	std::lock_guard<std::mutex> lk(outputMutex);
+	callback = cb;
+}
+
+bool FxDiagLog::allow(FxDiagSite *site, uint32_t *suppressed)
+{
+	*suppressed = 0;
+	if(!site) return true;
+
+	int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+
+	// a new one second window; whoever swaps the start resets the count
+	int64_t start = site->windowStart.load(std::memory_order_relaxed);
+	if(now - start >= 1000 && site->windowStart.compare_exchange_strong(start, now, std::memory_order_relaxed))
+		site->count.store(0, std::memory_order_relaxed);
+
+	if(site->count.fetch_add(1, std::memory_order_relaxed) >= FX_DIAG_SITE_LIMIT)
+	{
+		site->suppressed.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	*suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+	return true;
+}
+
+void FxDiagLog::post(FxDiagLevel l, FxDiagSite *site, const char *fmt, ...)
+{
+	if(!enabled(l)) return;
+
+	uint32_t suppressed;
+	if(!allow(site, &suppressed)) return;
+
+	// the flusher is only started once there is something to flush
+	std::call_once(flusherStarted, [this]{ flusher = std::thread(&FxDiagLog::run, this); });
+
+	// claim a slot (bounded MPMC queue, Vyukov)
+	Slot *slot;
+	uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+	while(true)
+	{
+		slot = &slots[pos % FX_DIAG_RING_SIZE];
+		uint64_t seq = slot->seq.load(std::memory_order_acquire);
+		int64_t diff = (int64_t)seq - (int64_t)pos;
+
+		if(!diff)
+		{
+			if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if(diff < 0)
+		{
+			// full, the flusher is behind
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else
+			pos = enqueuePos.load(std::memory_order_relaxed);
+	}
+
+	slot->level = (uint8_t)l;
+
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(slot->text, FX_DIAG_MSG_LEN, fmt, args);
+	va_end(args);
+
+	if(suppressed && n >= 0 && n < FX_DIAG_MSG_LEN)
+		snprintf(slot->text + n, FX_DIAG_MSG_LEN - n, " (%u similar suppressed)", suppressed);
+
+	slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+void FxDiagLog::write(int l, const char *text)
+{
+	if(callback)
+		callback(l, text);
+	else if(out)
+		fprintf(out, "[%s] %s\n", levelName(l), text);
+}
+
+void FxDiagLog::flush()
+{
+	std::lock_guard<std::mutex> lk(outputMutex);
+
+	uint64_t d = dropped.load(std::memory_order_relaxed);
+	uint64_t lost = d - reportedDrops;
+	reportedDrops = d;
+	bool wrote = false;
+
+	while(true)
+	{
+		Slot *slot = &slots[dequeuePos % FX_DIAG_RING_SIZE];
+		if(slot->seq.load(std::memory_order_acquire) != dequeuePos + 1)
+			break;
+
+		write(slot->level, slot->text);
+		wrote = true;
+
+		slot->seq.store(dequeuePos + FX_DIAG_RING_SIZE, std::memory_order_release);
+		dequeuePos++;
+	}
+
+	if(lost)
+	{
+		char text[64];
+		snprintf(text, sizeof(text), "%llu diagnostic messages dropped", (unsigned long long)lost);
+		write(FX_DIAG_WARN, text);
+		wrote = true;
+	}
+
+	if(wrote && !callback && out)
+		fflush(out);
+}
+
+void FxDiagLog::run()
+{
+	while(!quit)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(FX_DIAG_FLUSH_MS));
+		flush();
+	}
+}
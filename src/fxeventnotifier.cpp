@@ -0,0 +1,133 @@
+#include "fxeventnotifier.h"
+
+FxEventNotifier::FxEventNotifier(size_t maxPending_)
+	: maxPending(maxPending_)
+	, quit(false)
+	, subscribers(std::make_shared<SubscriberList>())
+	, nextHandle(1)
+	, activeMask(0)
+	, dropped(0)
+{
+	pending.reserve(maxPending);
+}
+
+FxEventNotifier::~FxEventNotifier()
+{
+	{
+		std::lock_guard<std::mutex> lk(queueMutex);
+		quit = true;
+	}
+	queueCV.notify_all();
+
+	if(worker.joinable())
+		worker.join();
+}
+
+int FxEventNotifier::subscribe(uint8_t eventMask, const FxEventCallback &cb)
+{
+	if(!cb || !eventMask) return -1;
+
+	int handle;
+	{
+		std::lock_guard<std::mutex> lk(subscriberMutex);
+		std::shared_ptr<SubscriberList> next = std::make_shared<SubscriberList>(*std::atomic_load(&subscribers));
+		handle = nextHandle++;
+		next->push_back({handle, eventMask, cb});
+		std::atomic_store(&subscribers, std::shared_ptr<const SubscriberList>(std::move(next)));
+		updateMask();
+
+		if(!worker.joinable())
+			worker = std::thread(&FxEventNotifier::run, this);
+	}
+
+	return handle;
+}
+
+void FxEventNotifier::unsubscribe(int handle)
+{
+	std::lock_guard<std::mutex> lk(subscriberMutex);
+	std::shared_ptr<SubscriberList> next = std::make_shared<SubscriberList>(*std::atomic_load(&subscribers));
+
+	for(auto it = next->begin(); it != next->end(); ++it)
+	{
+		if(it->handle == handle)
+		{
+			next->erase(it);
+			break;
+		}
+	}
+
+	std::atomic_store(&subscribers, std::shared_ptr<const SubscriberList>(std::move(next)));
+	updateMask();
+}
+
+void FxEventNotifier::updateMask()
+{
+	uint8_t mask = 0;
+	for(const auto &s : *std::atomic_load(&subscribers))
+		mask |= s.mask;
+
+	activeMask = mask;
+}
+
+void FxEventNotifier::post(FxEventType type, int devId, uint32_t count)
+{
+	if(!wants(type)) return;
+
+	{
+		std::lock_guard<std::mutex> lk(queueMutex);
+
+		// coalesce with the device's latest pending event if it is of the same kind;
+		// merging past a different event would reorder them (connected, removed, connected)
+		for(auto it = pending.rbegin(); it != pending.rend(); ++it)
+		{
+			if(it->devId != devId) continue;
+
+			if(it->type == type)
+			{
+				it->count += count;
+				return;
+			}
+			break;
+		}
+
+		if(pending.size() >= maxPending)
+		{
+			dropped++;
+			return;
+		}
+
+		pending.push_back({type, devId, count});
+	}
+
+	queueCV.notify_one();
+}
+
+void FxEventNotifier::run()
+{
+	std::vector<FxEvent> batch;
+	batch.reserve(maxPending);
+
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> lk(queueMutex);
+			queueCV.wait(lk, [this]{ return quit || !pending.empty(); });
+			if(quit) return;
+
+			batch.swap(pending);
+		}
+
+		std::shared_ptr<const SubscriberList> subs = std::atomic_load(&subscribers);
+		for(const FxEvent &e : batch)
+		{
+			for(const Subscriber &s : *subs)
+			{
+				if(s.mask & e.type)
+					s.cb(e);
+			}
+		}
+
+		batch.clear();
+	}
+}
@@ -0,0 +1,81 @@
+#include "fxfieldinterest.h"
+
+#include <algorithm>
+#include <cstring>
+
+int FxFieldInterests::add(int devId, const uint32_t *map)
+{
+	std::lock_guard<std::mutex> lk(mutex);
+
+	Entry e;
+	e.handle = nextHandle++;
+	e.devId = devId;
+	memcpy(e.map, map, sizeof(e.map));
+	entries.push_back(e);
+	return e.handle;
+}
+
+void FxFieldInterests::set(int handle, const uint32_t *map)
+{
+	std::lock_guard<std::mutex> lk(mutex);
+	for(auto &e : entries)
+	{
+		if(e.handle == handle)
+			memcpy(e.map, map, sizeof(e.map));
+	}
+}
+
+void FxFieldInterests::widen(int handle, const uint32_t *map)
+{
+	std::lock_guard<std::mutex> lk(mutex);
+	for(auto &e : entries)
+	{
+		if(e.handle != handle) continue;
+		for(int i = 0; i < FX_BITMAP_WIDTH; ++i)
+			e.map[i] |= map[i];
+	}
+}
+
+int FxFieldInterests::remove(int handle)
+{
+	std::lock_guard<std::mutex> lk(mutex);
+	for(auto it = entries.begin(); it != entries.end(); ++it)
+	{
+		if(it->handle != handle) continue;
+
+		int devId = it->devId;
+		entries.erase(it);
+		return devId;
+	}
+	return -1;
+}
+
+bool FxFieldInterests::getUnion(int devId, uint32_t *out) const
+{
+	memset(out, 0, sizeof(uint32_t) * FX_BITMAP_WIDTH);
+
+	std::lock_guard<std::mutex> lk(mutex);
+	bool found = false;
+	for(auto &&e : entries)
+	{
+		if(e.devId != devId) continue;
+
+		found = true;
+		for(int i = 0; i < FX_BITMAP_WIDTH; ++i)
+			out[i] |= e.map[i];
+	}
+	return found;
+}
+
+std::vector<int> FxFieldInterests::getDeviceIds() const
+{
+	std::vector<int> ids;
+
+	std::lock_guard<std::mutex> lk(mutex);
+	for(auto &&e : entries)
+	{
+		if(std::find(ids.begin(), ids.end(), e.devId) == ids.end())
+			ids.push_back(e.devId);
+	}
+	return ids;
+}
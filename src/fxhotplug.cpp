@@ -0,0 +1,275 @@
+#include "fxhotplug.h"
+#include "flexseaserial.h"
+#include "fxdiag.h"
+
+#include <cstdio>
+#include <serial/serial.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// time given to udev to finish setting up a new node (permissions) before it is opened
+#define FX_HOTPLUG_SETTLE_MS 50
+// full rescan period, catches anything inotify missed
+#define FX_HOTPLUG_RESCAN_MS 1000
+
+static bool isUsbSerialName(const std::string &name)
+{
+	return name.find("ttyACM") != std::string::npos || name.find("ttyUSB") != std::string::npos;
+}
+
+FxHotplugWatcher::FxHotplugWatcher(FlexseaSerial *fs)
+	: fxSerial(fs)
+	, inotifyFd(-1)
+{}
+
+FxHotplugWatcher::~FxHotplugWatcher()
+{
+	stop();
+}
+
+bool FxHotplugWatcher::start(const std::vector<FxHotplugRule> &r)
+{
+	std::lock_guard<std::mutex> lk(startMutex);
+	if(worker.joinable()) return false;
+
+	rules = r;
+	managed.clear();
+
+#ifdef __linux__
+	inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(inotifyFd >= 0 && inotify_add_watch(inotifyFd, "/dev", IN_CREATE | IN_DELETE | IN_ATTRIB) < 0)
+	{
+		::close(inotifyFd);
+		inotifyFd = -1;
+	}
+	if(inotifyFd < 0)
+		FX_DIAG(FX_DIAG_WARN, "Auto connect: can't watch /dev, falling back to polling");
+#endif
+
+	nextScan = std::chrono::steady_clock::now();
+	taskPeriod = 100;
+	worker = std::thread(&FxHotplugWatcher::runPeriodicTask, this);
+
+	// runPeriodicTask raises runPeriodicThread itself, wait for it so an early stop() isn't lost
+	while(true)
+	{
+		{
+			std::lock_guard<std::mutex> clk(conditionMutex);
+			if(runPeriodicThread) break;
+		}
+		std::this_thread::yield();
+	}
+	return true;
+}
+
+void FxHotplugWatcher::stop()
+{
+	std::lock_guard<std::mutex> lk(startMutex);
+	if(!worker.joinable()) return;
+
+	quitPeriodicTask();
+	worker.join();
+
+#ifdef __linux__
+	if(inotifyFd >= 0)
+		::close(inotifyFd);
+#endif
+	inotifyFd = -1;
+
+	// ports stay open, they just aren't managed anymore
+	managed.clear();
+}
+
+bool FxHotplugWatcher::parseHardwareId(const std::string &hwId, uint16_t *vid, uint16_t *pid, std::string *serialNumber)
+{
+	size_t p = hwId.find("VID:PID=");
+	if(p == std::string::npos) return false;
+
+	unsigned int v, d;
+	if(sscanf(hwId.c_str() + p, "VID:PID=%x:%x", &v, &d) != 2) return false;
+	*vid = (uint16_t)v;
+	*pid = (uint16_t)d;
+
+	serialNumber->clear();
+	size_t s = hwId.find("SNR=", p);
+	if(s != std::string::npos)
+	{
+		s += 4;
+		size_t e = hwId.find(' ', s);
+		*serialNumber = hwId.substr(s, e == std::string::npos ? std::string::npos : e - s);
+	}
+	return true;
+}
+
+bool FxHotplugWatcher::matches(const std::string &hwId, std::string *serialNumber) const
+{
+	uint16_t vid, pid;
+	if(!parseHardwareId(hwId, &vid, &pid, serialNumber)) return false;
+
+	for(auto &&r : rules)
+	{
+		if((!r.vid || r.vid == vid) && (!r.pid || r.pid == pid)
+		   && (r.serialNumber.empty() || r.serialNumber == *serialNumber))
+			return true;
+	}
+	return false;
+}
+
+void FxHotplugWatcher::periodicTask()
+{
+	auto now = std::chrono::steady_clock::now();
+
+	if(readEvents())
+	{
+		auto settled = now + std::chrono::milliseconds(FX_HOTPLUG_SETTLE_MS);
+		if(settled < nextScan) nextScan = settled;
+	}
+
+	if(now >= nextScan)
+	{
+		scan();
+		nextScan = now + std::chrono::milliseconds(FX_HOTPLUG_RESCAN_MS);
+	}
+}
+
+bool FxHotplugWatcher::readEvents()
+{
+	bool relevant = false;
+#ifdef __linux__
+	if(inotifyFd < 0) return false;
+
+	alignas(struct inotify_event) char buf[4096];
+	ssize_t n;
+	while((n = read(inotifyFd, buf, sizeof(buf))) > 0)
+	{
+		for(char *p = buf; p < buf + n; )
+		{
+			const struct inotify_event *ev = (const struct inotify_event*)p;
+			if(ev->len && isUsbSerialName(ev->name))
+				relevant = true;
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+#endif
+	return relevant;
+}
+
+int FxHotplugWatcher::choosePortIdx(const std::string &key) const
+{
+	auto isFree = [this](int idx) {
+		for(auto &&m : managed)
+			if(m.portIdx == idx) return false;
+		return !fxSerial->isOpen(idx) && fxSerial->getPortState(idx) != serial::state_opening;
+	};
+
+	for(auto &&l : lastPortIdx)
+	{
+		if(l.first == key && isFree(l.second))
+			return l.second;
+	}
+
+	// prefer indices no other known device used before, so those can get theirs back
+	int fallback = -1;
+	for(int i = 0; i < FX_NUMPORTS; ++i)
+	{
+		if(!isFree(i)) continue;
+
+		bool reserved = false;
+		for(auto &&l : lastPortIdx)
+			reserved |= l.second == i;
+
+		if(!reserved) return i;
+		if(fallback < 0) fallback = i;
+	}
+	return fallback;
+}
+
+void FxHotplugWatcher::scan()
+{
+	std::vector<serial::PortInfo> ports = serial::list_ports();
+
+	// matching ports, by node name
+	std::vector<std::pair<std::string, std::string>> found;
+	for(auto &&pi : ports)
+	{
+		std::string serialNumber;
+		if(isUsbSerialName(pi.port) && matches(pi.hardware_id, &serialNumber))
+			found.emplace_back(pi.port, serialNumber);
+	}
+
+	for(auto &m : managed)
+	{
+		m.present = false;
+		for(auto &&f : found)
+			m.present |= f.first == m.portName;
+	}
+
+	// devices that went away first, so a device that came back under a new node gets its index back
+	for(auto it = managed.begin(); it != managed.end(); )
+	{
+		if(it->present)
+		{
+			++it;
+			continue;
+		}
+
+		FX_DIAG(FX_DIAG_INFO, "Auto connect: %s removed", it->portName.c_str());
+		if(fxSerial->isOpen(it->portIdx))
+			fxSerial->close(it->portIdx);
+		it = managed.erase(it);
+	}
+
+	for(auto &&f : found)
+	{
+		const std::string &portName = f.first;
+		const std::string &serialNumber = f.second;
+
+		bool known = false;
+		for(auto &m : managed)
+		{
+			if(m.portName != portName) continue;
+
+			known = true;
+
+			// closed after an I/O error while the device stayed plugged in
+			if(!fxSerial->isOpen(m.portIdx) && fxSerial->getPortState(m.portIdx) != serial::state_opening)
+			{
+				FX_DIAG(FX_DIAG_INFO, "Auto connect: reopening %s", m.portName.c_str());
+				fxSerial->open(m.portName, m.portIdx);
+			}
+			break;
+		}
+		if(known) continue;
+
+		// opened by hand, leave it alone
+		bool openElsewhere = false;
+		for(int i = 0; i < FX_NUMPORTS; ++i)
+			openElsewhere |= fxSerial->isOpen(i) && fxSerial->getPortName(i) == portName;
+		if(openElsewhere) continue;
+
+		std::string key = serialNumber.empty() ? portName : serialNumber;
+		int idx = choosePortIdx(key);
+		if(idx < 0)
+		{
+			FX_DIAG(FX_DIAG_WARN, "Auto connect: no free port index for %s", portName.c_str());
+			continue;
+		}
+
+		FX_DIAG(FX_DIAG_INFO, "Auto connect: opening %s at port %d", portName.c_str(), idx);
+		fxSerial->open(portName, idx);
+		managed.push_back({portName, serialNumber, idx, true});
+
+		bool remembered = false;
+		for(auto &l : lastPortIdx)
+		{
+			if(l.first != key) continue;
+			l.second = idx;
+			remembered = true;
+		}
+		if(!remembered)
+			lastPortIdx.emplace_back(key, idx);
+	}
+}
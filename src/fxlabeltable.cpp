@@ -0,0 +1,77 @@
+#include "fxlabeltable.h"
+#include "flexsea_sys_def.h"
+
+#include <cstring>
+#include <stdexcept>
+
+FxLabelTablePtr FxLabelTable::forType(FlexseaDeviceType type)
+{
+	static std::mutex m;
+	static std::map<int, FxLabelTablePtr> tables;
+
+	std::lock_guard<std::mutex> lk(m);
+	auto found = tables.find(type);
+	if(found != tables.end())
+		return found->second;
+
+	std::vector<std::string> labels;
+	for(int i = 0; i < deviceSpecs[type].numFields; ++i)
+	{
+		const char* c_str = deviceSpecs[type].fieldLabels[i];
+		if(c_str)
+			labels.push_back(c_str);
+		else
+			throw std::invalid_argument("Device Spec for given type is invalid, causing null pointer access");
+	}
+
+	FxLabelTablePtr t = std::make_shared<const FxLabelTable>(labels);
+	tables.insert({type, t});
+	return t;
+}
+
+FxLabelTablePtr FxLabelTable::forLabels(const std::vector<std::string> &labels)
+{
+	static std::mutex m;
+	static std::map<std::vector<std::string>, std::weak_ptr<const FxLabelTable>> tables;
+
+	std::lock_guard<std::mutex> lk(m);
+	auto found = tables.find(labels);
+	if(found != tables.end())
+	{
+		if(FxLabelTablePtr t = found->second.lock())
+			return t;
+	}
+
+	// drop tables whose devices are all gone
+	for(auto it = tables.begin(); it != tables.end(); )
+		it = it->second.expired() ? tables.erase(it) : std::next(it);
+
+	FxLabelTablePtr t = std::make_shared<const FxLabelTable>(labels);
+	tables[labels] = t;
+	return t;
+}
+
+const FxActiveFields& FxLabelTable::active(const uint32_t *bitmap) const
+{
+	Key key;
+	memcpy(key.data(), bitmap, sizeof(uint32_t) * FX_BITMAP_WIDTH);
+
+	std::lock_guard<std::mutex> lk(viewMutex);
+	auto found = views.find(key);
+	if(found != views.end())
+		return *found->second;
+
+	FxActiveFields *v = new FxActiveFields;
+	int numFields = (int)labels.size();
+	for(int fieldId = 0; fieldId < 32*FX_BITMAP_WIDTH && fieldId < numFields; ++fieldId)
+	{
+		if(IS_FIELD_HIGH(fieldId, bitmap))
+		{
+			v->fieldIds.push_back(fieldId);
+			v->labels.push_back(labels.at(fieldId));
+		}
+	}
+
+	views[key].reset(v);
+	return *v;
+}
@@ -0,0 +1,33 @@
+#include "fxlinkbudget.h"
+
+#include "flexsea_multi_frame_packet_def.h"
+
+extern "C" {
+	#include "flexsea_device_spec.h"
+	#include "flexsea_dataformats.h"
+}
+
+uint32_t fxSampleWireBytes(FlexseaDeviceType type, const uint32_t *bitmap)
+{
+	if(type >= NUM_DEVICE_TYPES || type == FX_NONE || !deviceSpecs[type].fieldTypes)
+		return 0;
+
+	const FlexseaDeviceSpec &ds = deviceSpecs[type];
+
+	uint32_t payload = 0;
+	for(uint16_t j = 0; j < ds.numFields; ++j)
+	{
+		if(IS_FIELD_HIGH(j, bitmap))
+			payload += FORMAT_SIZE_MAP[ds.fieldTypes[j]];
+	}
+
+	// header up to the first field (ids, command, timestamp, metadata flag)
+	uint32_t msgLen = MP_DATA1 + 1 + payload;
+
+	// each frame carries its own header and checksum
+	const uint32_t frameOverhead = MULTI_DATA_OFFSET + 1;
+	const uint32_t frameData = PACKET_WRAPPER_LEN - frameOverhead;
+	uint32_t frames = (msgLen + frameData - 1) / frameData;
+
+	return msgLen + frames * frameOverhead;
+}
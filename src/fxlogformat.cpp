@@ -0,0 +1,266 @@
+#include "fxlogformat.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <array>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static std::array<uint32_t, 256> makeCrcTable()
+{
+	std::array<uint32_t, 256> table;
+	for(uint32_t i = 0; i < 256; ++i)
+	{
+		uint32_t c = i;
+		for(int k = 0; k < 8; ++k)
+			c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		table[i] = c;
+	}
+	return table;
+}
+
+/// CRC-32 (IEEE 802.3); pass the CRC of the preceding bytes as crc to continue it
+static uint32_t fxCrc32(const char *data, size_t len, uint32_t crc = 0)
+{
+	static const std::array<uint32_t, 256> table = makeCrcTable();
+
+	uint32_t c = crc ^ 0xFFFFFFFF;
+	for(size_t i = 0; i < len; ++i)
+		c = table[(c ^ (uint8_t)data[i]) & 0xFF] ^ (c >> 8);
+	return c ^ 0xFFFFFFFF;
+}
+
+static void put16(std::string &out, uint16_t v)
+{
+	out += (char)(v & 0xFF);
+	out += (char)(v >> 8);
+}
+
+static void put32(std::string &out, uint32_t v)
+{
+	for(int i = 0; i < 4; ++i)
+		out += (char)((v >> (8 * i)) & 0xFF);
+}
+
+static uint16_t get16(const char *p)
+{
+	return (uint16_t)((uint8_t)p[0] | (uint8_t)p[1] << 8);
+}
+
+static uint32_t get32(const char *p)
+{
+	return (uint32_t)(uint8_t)p[0] | (uint32_t)(uint8_t)p[1] << 8
+			| (uint32_t)(uint8_t)p[2] << 16 | (uint32_t)(uint8_t)p[3] << 24;
+}
+
+static void appendBlock(std::string &out, uint8_t type, const std::string &payload)
+{
+	put32(out, FX_LOG_BLOCK_MAGIC);
+	out += (char)type;
+	out.append(3, '\0');
+	put32(out, (uint32_t)payload.size());
+	put32(out, fxCrc32(payload.data(), payload.size()));
+	out += payload;
+}
+
+/// same as above for a payload made of head followed by body, without joining them
+static void appendBlock(std::string &out, uint8_t type, const std::string &head, const std::string &body)
+{
+	put32(out, FX_LOG_BLOCK_MAGIC);
+	out += (char)type;
+	out.append(3, '\0');
+	put32(out, (uint32_t)(head.size() + body.size()));
+	put32(out, fxCrc32(body.data(), body.size(), fxCrc32(head.data(), head.size())));
+	out += head;
+	out += body;
+}
+
+void fxLogAppendFileHeader(std::string &out)
+{
+	out.append(FX_LOG_FILE_MAGIC, 5);
+	out += '\0';
+	out += (char)FX_LOG_FORMAT_VERSION;
+	out += '\0';
+}
+
+void fxLogAppendSchema(std::string &out, int devId, int devType, const std::vector<FxLogColumn> &columns)
+{
+	std::string payload;
+	put32(payload, (uint32_t)devId);
+	put16(payload, (uint16_t)devType);
+	put16(payload, (uint16_t)columns.size());
+	for(auto &&c : columns)
+	{
+		put16(payload, (uint16_t)(int16_t)c.fieldId);
+		payload += c.label;
+		payload += '\0';
+	}
+
+	appendBlock(out, FX_LOG_BLOCK_SCHEMA, payload);
+}
+
+FxLogDataBlock::FxLogDataBlock(int nc)
+	: numRows(0)
+	, numColumns((uint16_t)nc)
+{}
+
+void FxLogDataBlock::reset(int nc)
+{
+	payload.clear();
+	numRows = 0;
+	numColumns = (uint16_t)nc;
+}
+
+void FxLogDataBlock::beginRow(uint32_t timestamp)
+{
+	put32(payload, timestamp);
+	numRows++;
+}
+
+void FxLogDataBlock::add(int32_t value)
+{
+	put32(payload, (uint32_t)value);
+}
+
+void FxLogDataBlock::appendTo(std::string &out)
+{
+	if(!numRows) return;
+
+	std::string header;
+	put32(header, numRows);
+	put16(header, numColumns);
+
+	appendBlock(out, FX_LOG_BLOCK_DATA, header, payload);
+
+	payload.clear();
+	numRows = 0;
+}
+
+void FxLogDataBlock::appendTo(std::string &out, int devId)
+{
+	if(!numRows) return;
+
+	std::string header;
+	put32(header, (uint32_t)devId);
+	put32(header, numRows);
+	put16(header, numColumns);
+
+	appendBlock(out, FX_LOG_BLOCK_DEVICE_DATA, header, payload);
+
+	payload.clear();
+	numRows = 0;
+}
+
+/// walks the blocks of a log file, calling onBlock for each valid one
+/// returns the offset just past the last valid block, or -1 if the file is not a block log
+static int64_t readBlocks(std::ifstream &in, const std::function<void(uint8_t, const std::string&)> &onBlock)
+{
+	char fh[FX_LOG_FILE_HEADER_SIZE];
+	if(!in.read(fh, sizeof(fh)) || memcmp(fh, FX_LOG_FILE_MAGIC, 5) != 0 || fh[6] != FX_LOG_FORMAT_VERSION)
+		return -1;
+
+	int64_t good = FX_LOG_FILE_HEADER_SIZE;
+	char bh[FX_LOG_BLOCK_HEADER_SIZE];
+	std::string payload;
+
+	while(in.read(bh, sizeof(bh)))
+	{
+		uint32_t len = get32(bh + 8);
+		if(get32(bh) != FX_LOG_BLOCK_MAGIC || len > FX_LOG_MAX_BLOCK_SIZE)
+			break;
+
+		payload.resize(len);
+		if(len && !in.read(&payload[0], len))
+			break;
+		if(fxCrc32(payload.data(), len) != get32(bh + 12))
+			break;
+
+		onBlock((uint8_t)bh[4], payload);
+		good += FX_LOG_BLOCK_HEADER_SIZE + len;
+	}
+
+	return good;
+}
+
+int64_t fxRecoverLog(const std::string &path, bool truncate)
+{
+	int64_t good, size;
+	{
+		std::ifstream in(path, std::ios::binary);
+		if(!in.is_open()) return -1;
+
+		good = readBlocks(in, [](uint8_t, const std::string&){});
+
+		in.clear();
+		in.seekg(0, std::ios::end);
+		size = (int64_t)in.tellg();
+	}
+
+	if(good < 0 || !truncate || good == size)
+		return good;
+
+#ifdef _WIN32
+	FILE *f = fopen(path.c_str(), "r+b");
+	if(!f) return -1;
+	int rc = _chsize_s(_fileno(f), good);
+	fclose(f);
+#else
+	int rc = ::truncate(path.c_str(), (off_t)good);
+#endif
+
+	return rc == 0 ? good : -1;
+}
+
+bool fxConvertLogToCsv(const std::string &inPath, const std::string &outPath)
+{
+	std::ifstream in(inPath, std::ios::binary);
+	if(!in.is_open()) return false;
+
+	std::ofstream out(outPath);
+	if(!out.is_open()) return false;
+
+	int64_t good = readBlocks(in, [&out](uint8_t type, const std::string &p){
+		const char *d = p.data();
+		size_t n = p.size();
+
+		if(type == FX_LOG_BLOCK_SCHEMA && n >= 8)
+		{
+			uint16_t nc = get16(d + 6);
+			size_t pos = 8;
+
+			out << "timestamp";
+			for(uint16_t c = 0; c < nc && pos + 2 < n; ++c)
+			{
+				pos += 2;
+				size_t end = p.find('\0', pos);
+				if(end == std::string::npos) break;
+				out << ", " << p.substr(pos, end - pos);
+				pos = end + 1;
+			}
+			out << "\n";
+		}
+		else if(type == FX_LOG_BLOCK_DATA && n >= 6)
+		{
+			uint32_t nr = get32(d);
+			uint16_t nc = get16(d + 4);
+			size_t pos = 6;
+
+			for(uint32_t r = 0; r < nr && pos + 4 * (1 + nc) <= n; ++r)
+			{
+				out << get32(d + pos);
+				pos += 4;
+				for(uint16_t c = 0; c < nc; ++c, pos += 4)
+					out << ", " << (int32_t)get32(d + pos);
+				out << "\n";
+			}
+		}
+	});
+
+	return good >= 0 && out.good();
+}
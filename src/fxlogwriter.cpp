@@ -0,0 +1,461 @@
+#include "fxlogwriter.h"
+#include "fxdiag.h"
+
+#include <cstdio>
+#include <algorithm>
+
+#ifdef FX_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cstring>
+#define FX_HAVE_MMAP_LOG
+#endif
+
+// written chunks whose buffers are kept for reuse
+#define FX_LOG_SPARE_BUFFERS 16
+
+class FxStdioLogSink : public FxLogSink
+{
+public:
+	FxStdioLogSink() : fp(nullptr), written(0) {}
+	~FxStdioLogSink() { close(); }
+
+	bool open(const std::string &path)
+	{
+		fp = fopen(path.c_str(), "wb");
+		return fp != nullptr;
+	}
+
+	bool write(const char *data, size_t len)
+	{
+		if(!fp) return false;
+		size_t n = fwrite(data, 1, len, fp);
+		written += n;
+		return n == len;
+	}
+
+	bool flush() { return fp && fflush(fp) == 0; }
+
+	void close()
+	{
+		if(fp) fclose(fp);
+		fp = nullptr;
+	}
+
+	uint64_t bytesOnDisk() const { return written; }
+
+private:
+	FILE *fp;
+	uint64_t written;
+};
+
+#ifdef FX_HAVE_MMAP_LOG
+/// appends through a mapping of one preallocated segment at a time
+/// the file is truncated to the bytes actually written when it is closed
+class FxMmapLogSink : public FxLogSink
+{
+public:
+	explicit FxMmapLogSink(size_t segSize)
+		: fd(-1), map(nullptr), segmentSize(segSize), segmentStart(0), segmentPos(0), syncedPos(0), written(0)
+	{
+		size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		if(segmentSize < page) segmentSize = page;
+		segmentSize = (segmentSize + page - 1) / page * page;
+	}
+	~FxMmapLogSink() { close(); }
+
+	bool open(const std::string &path)
+	{
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0) return false;
+
+		segmentStart = 0;
+		written = 0;
+		if(!mapSegment())
+		{
+			::close(fd);
+			fd = -1;
+			return false;
+		}
+		return true;
+	}
+
+	bool write(const char *data, size_t len)
+	{
+		if(!map) return false;
+
+		while(len)
+		{
+			if(segmentPos == segmentSize)
+			{
+				unmapSegment();
+				segmentStart += segmentSize;
+				if(!mapSegment()) return false;
+			}
+
+			size_t n = std::min(len, segmentSize - segmentPos);
+			memcpy(map + segmentPos, data, n);
+			segmentPos += n;
+			written += n;
+			data += n;
+			len -= n;
+		}
+		return true;
+	}
+
+	bool flush()
+	{
+		if(!map) return false;
+
+		// schedule writeback of the pages dirtied since the last flush, without waiting for it
+		size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		size_t from = syncedPos / page * page;
+		if(segmentPos > from && msync(map + from, segmentPos - from, MS_ASYNC) != 0)
+			return false;
+
+		syncedPos = segmentPos;
+		return true;
+	}
+
+	void close()
+	{
+		if(fd < 0) return;
+
+		unmapSegment();
+		// drop the unused, preallocated tail so the file ends with the last row
+		if(ftruncate(fd, (off_t)written) != 0)
+			FX_DIAG(FX_DIAG_ERROR, "FxMmapLogSink: truncate: %s", strerror(errno));
+		::close(fd);
+		fd = -1;
+	}
+
+	uint64_t bytesOnDisk() const { return written; }
+
+private:
+	bool mapSegment()
+	{
+		// reserving the blocks up front keeps metadata updates off the write path
+		if(posix_fallocate(fd, (off_t)segmentStart, (off_t)segmentSize) != 0)
+			return false;
+
+		void *p = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)segmentStart);
+		if(p == MAP_FAILED) return false;
+
+		map = (char*)p;
+		segmentPos = 0;
+		syncedPos = 0;
+		return true;
+	}
+
+	void unmapSegment()
+	{
+		if(!map) return;
+
+		msync(map, segmentPos, MS_ASYNC);
+		munmap(map, segmentSize);
+		map = nullptr;
+	}
+
+	int fd;
+	char *map;
+	size_t segmentSize;
+	uint64_t segmentStart;
+	size_t segmentPos, syncedPos;
+	uint64_t written;
+};
+#endif
+
+#ifdef FX_HAVE_ZSTD
+#define FX_ZSTD_LEVEL 3
+
+/// compresses into another sink, one frame per file
+class FxZstdLogSink : public FxLogSink
+{
+public:
+	explicit FxZstdLogSink(FxLogSink *fileSink) : file(fileSink), cctx(nullptr), isOpen(false) {}
+	~FxZstdLogSink() { close(); if(cctx) ZSTD_freeCStream(cctx); }
+
+	bool open(const std::string &path)
+	{
+		if(!cctx) cctx = ZSTD_createCStream();
+		if(!cctx || ZSTD_isError(ZSTD_initCStream(cctx, FX_ZSTD_LEVEL))) return false;
+
+		out.resize(ZSTD_CStreamOutSize());
+		isOpen = file->open(path);
+		return isOpen;
+	}
+
+	bool write(const char *data, size_t len)
+	{
+		ZSTD_inBuffer in = {data, len, 0};
+		while(in.pos < in.size)
+		{
+			ZSTD_outBuffer o = {&out[0], out.size(), 0};
+			if(ZSTD_isError(ZSTD_compressStream(cctx, &o, &in))) return false;
+			if(!file->write(&out[0], o.pos)) return false;
+		}
+		return true;
+	}
+
+	bool flush()
+	{
+		// flushing makes everything written so far decodable without ending the frame
+		size_t remaining;
+		do {
+			ZSTD_outBuffer o = {&out[0], out.size(), 0};
+			remaining = ZSTD_flushStream(cctx, &o);
+			if(ZSTD_isError(remaining)) return false;
+			if(!file->write(&out[0], o.pos)) return false;
+		} while(remaining);
+
+		return file->flush();
+	}
+
+	void close()
+	{
+		if(!isOpen) return;
+		isOpen = false;
+
+		size_t remaining;
+		do {
+			ZSTD_outBuffer o = {&out[0], out.size(), 0};
+			remaining = ZSTD_endStream(cctx, &o);
+			if(ZSTD_isError(remaining)) break;
+			file->write(&out[0], o.pos);
+		} while(remaining);
+
+		file->close();
+	}
+
+	uint64_t bytesOnDisk() const { return file->bytesOnDisk(); }
+
+private:
+	std::unique_ptr<FxLogSink> file;
+	ZSTD_CStream *cctx;
+	std::vector<char> out;
+	bool isOpen;
+};
+#endif
+
+bool fxLogCompressionAvailable(FxLogCompression c)
+{
+	switch(c)
+	{
+	case FX_LOG_PLAIN: return true;
+#ifdef FX_HAVE_ZSTD
+	case FX_LOG_ZSTD: return true;
+#endif
+	default: return false;
+	}
+}
+
+bool fxLogBackendAvailable(FxLogBackend b)
+{
+	switch(b)
+	{
+	case FX_LOG_STDIO: return true;
+#ifdef FX_HAVE_MMAP_LOG
+	case FX_LOG_MMAP: return true;
+#endif
+	default: return false;
+	}
+}
+
+const char* fxLogCompressionExtension(FxLogCompression c)
+{
+	return c == FX_LOG_ZSTD ? ".zst" : "";
+}
+
+FxLogSink* FxLogSink::create(const FxLogSinkConfig &config)
+{
+	if(!fxLogCompressionAvailable(config.compression)) return nullptr;
+
+	FxLogSink *file = nullptr;
+	switch(config.backend)
+	{
+	case FX_LOG_STDIO: file = new FxStdioLogSink(); break;
+#ifdef FX_HAVE_MMAP_LOG
+	case FX_LOG_MMAP: file = new FxMmapLogSink(config.segmentSize); break;
+#endif
+	default: return nullptr;
+	}
+
+#ifdef FX_HAVE_ZSTD
+	if(config.compression == FX_LOG_ZSTD)
+		return new FxZstdLogSink(file);
+#endif
+
+	return file;
+}
+
+FxAsyncLogWriter::FxAsyncLogWriter(size_t maxBytes)
+	: queuedBytes(0)
+	, maxQueuedBytes(maxBytes)
+	, busy(false)
+	, quit(false)
+	, nextHandle(0)
+	, droppedBytes(0)
+	, errors(0)
+{
+	queue.reserve(256);
+	spareBuffers.reserve(FX_LOG_SPARE_BUFFERS);
+	worker = std::thread(&FxAsyncLogWriter::run, this);
+}
+
+FxAsyncLogWriter::~FxAsyncLogWriter()
+{
+	{
+		std::lock_guard<std::mutex> lk(queueMutex);
+		quit = true;
+	}
+	queueCV.notify_all();
+	worker.join();
+
+	// the worker drains the queue before quitting, close anything left open
+	for(auto &&s : sinks)
+		s.second->close();
+}
+
+int FxAsyncLogWriter::openFile(const std::string &path, const FxLogSinkConfig &config)
+{
+	FxLogSink *sink = FxLogSink::create(config);
+	if(!sink)
+		return -1;
+
+	int h;
+	{
+		std::lock_guard<std::mutex> lk(queueMutex);
+		h = nextHandle++;
+	}
+
+	// from here on the sink is only touched by the writer thread, which opens it
+	push({Command::ADOPT, h, sink, path});
+	return h;
+}
+
+bool FxAsyncLogWriter::write(int handle, std::string &&data)
+{
+	{
+		std::lock_guard<std::mutex> lk(queueMutex);
+		if(queuedBytes + data.size() > maxQueuedBytes)
+		{
+			droppedBytes += data.size();
+			return false;
+		}
+	}
+
+	push({Command::WRITE, handle, nullptr, std::move(data)});
+	return true;
+}
+
+std::string FxAsyncLogWriter::takeBuffer()
+{
+	std::string s;
+	std::lock_guard<std::mutex> lk(queueMutex);
+	if(!spareBuffers.empty())
+	{
+		s.swap(spareBuffers.back());
+		spareBuffers.pop_back();
+	}
+	return s;
+}
+
+void FxAsyncLogWriter::flushFile(int handle)
+{
+	push({Command::FLUSH, handle, nullptr, std::string()});
+}
+
+void FxAsyncLogWriter::closeFile(int handle)
+{
+	push({Command::CLOSE, handle, nullptr, std::string()});
+}
+
+void FxAsyncLogWriter::push(Command &&cmd)
+{
+	{
+		std::lock_guard<std::mutex> lk(queueMutex);
+		if(cmd.op == Command::WRITE)
+			queuedBytes += cmd.data.size();
+		queue.push(std::move(cmd));
+	}
+	queueCV.notify_one();
+}
+
+void FxAsyncLogWriter::drain()
+{
+	std::unique_lock<std::mutex> lk(queueMutex);
+	drainedCV.wait(lk, [this]{ return queue.empty() && !busy; });
+}
+
+void FxAsyncLogWriter::run()
+{
+	std::unique_lock<std::mutex> lk(queueMutex);
+	while(true)
+	{
+		queueCV.wait(lk, [this]{ return quit || !queue.empty(); });
+		if(queue.empty())
+		{
+			if(quit) break;
+			continue;
+		}
+
+		Command cmd = std::move(queue.front());
+		queue.pop();
+		if(cmd.op == Command::WRITE)
+			queuedBytes -= cmd.data.size();
+		busy = true;
+
+		lk.unlock();
+		execute(cmd);
+		lk.lock();
+
+		if(cmd.op == Command::WRITE && spareBuffers.size() < FX_LOG_SPARE_BUFFERS)
+		{
+			cmd.data.clear();
+			spareBuffers.push_back(std::move(cmd.data));
+		}
+
+		busy = false;
+		if(queue.empty())
+			drainedCV.notify_all();
+	}
+}
+
+void FxAsyncLogWriter::execute(Command &cmd)
+{
+	if(cmd.op == Command::ADOPT)
+	{
+		std::unique_ptr<FxLogSink> sink(cmd.sink);
+		if(sink->open(cmd.data))
+			sinks[cmd.handle] = std::move(sink);
+		else
+			errors++;
+		return;
+	}
+
+	auto it = sinks.find(cmd.handle);
+	if(it == sinks.end()) return;
+
+	switch(cmd.op)
+	{
+	case Command::WRITE:
+		if(!it->second->write(cmd.data.data(), cmd.data.size()))
+			errors++;
+		break;
+	case Command::FLUSH:
+		if(!it->second->flush())
+			errors++;
+		break;
+	case Command::CLOSE:
+		it->second->close();
+		sinks.erase(it);
+		break;
+	default:
+		break;
+	}
+}
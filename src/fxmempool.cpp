@@ -0,0 +1,137 @@
+#include "fxmempool.h"
+#include "flexseadevice.h"
+#include "fxdiag.h"
+
+#include <new>
+
+// room for the shared_ptr control block allocated along with each device
+#define FX_DEVICE_BLOCK_OVERHEAD 64
+
+FxBlockPool::FxBlockPool(const char *n)
+	: name(n)
+	, arena(nullptr)
+	, blockSize(0)
+	, numBlocks(0)
+	, inUse(0)
+	, peakInUse(0)
+	, heapFallbacks(0)
+	, reportFallbacks(false)
+{}
+
+FxBlockPool::~FxBlockPool()
+{
+	delete[] arena;
+}
+
+bool FxBlockPool::reserve(size_t size, size_t n)
+{
+	std::lock_guard<std::mutex> lk(mutex);
+	if(inUse) return false;
+
+	// keep blocks aligned for anything they may hold
+	size = (size + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+	delete[] arena;
+	arena = n ? new char[size * n] : nullptr;
+	blockSize = size;
+	numBlocks = n;
+
+	freeBlocks.clear();
+	freeBlocks.reserve(n);
+	for(size_t i = n; i > 0; --i)
+		freeBlocks.push_back(arena + (i - 1) * size);
+
+	peakInUse = 0;
+	return true;
+}
+
+void* FxBlockPool::acquire(size_t size)
+{
+	bool firstFallback;
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		if(size <= blockSize && !freeBlocks.empty())
+		{
+			void *p = freeBlocks.back();
+			freeBlocks.pop_back();
+			if(++inUse > peakInUse) peakInUse = inUse;
+			return p;
+		}
+
+		firstFallback = !heapFallbacks++ && reportFallbacks;
+	}
+
+	// reported once the pool is unlocked
+	if(firstFallback)
+		FX_DIAG(FX_DIAG_WARN, "Memory pool %s: allocating %zu bytes from the heap (%zu blocks of %zu bytes)",
+				name, size, numBlocks, blockSize);
+
+	return ::operator new(size);
+}
+
+void FxBlockPool::release(void *p)
+{
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		if(owns(p))
+		{
+			freeBlocks.push_back(p);
+			--inUse;
+			return;
+		}
+	}
+
+	::operator delete(p);
+}
+
+FxPoolStats FxBlockPool::getStats() const
+{
+	std::lock_guard<std::mutex> lk(mutex);
+	return {blockSize, numBlocks, inUse, peakInUse, heapFallbacks};
+}
+
+FxMemoryPools::FxMemoryPools()
+	: messages("messages")
+	, devices("devices")
+	, deviceData("device data")
+	, configured(false)
+{}
+
+FxMemoryPools& FxMemoryPools::instance()
+{
+	static FxMemoryPools pools;
+	return pools;
+}
+
+bool FxMemoryPools::configure(const FxMemoryConfig &config)
+{
+	int maxFields = 0;
+	for(int t = 0; t < NUM_DEVICE_TYPES; ++t)
+	{
+		if(deviceSpecs[t].numFields > maxFields)
+			maxFields = deviceSpecs[t].numFields;
+	}
+
+	size_t rowBytes = sizeof(uint32_t) * (maxFields + 1) + sizeof(FxRowInfo);
+
+	bool ok = messages.reserve(FX_MESSAGE_BLOCK_SIZE, config.messageBlocks);
+	ok &= devices.reserve(sizeof(FlexseaDevice) + FX_DEVICE_BLOCK_OVERHEAD, config.maxDevices);
+	ok &= deviceData.reserve(rowBytes * FX_DATA_BUFFER_SIZE, config.maxDevices);
+
+	messages.setReportFallbacks(config.reportHeapFallbacks);
+	devices.setReportFallbacks(config.reportHeapFallbacks);
+	deviceData.setReportFallbacks(config.reportHeapFallbacks);
+
+	if(!ok)
+		FX_DIAG(FX_DIAG_WARN, "FxMemoryPools::configure, some pools are in use and keep their current size");
+
+	configured = true;
+	return ok;
+}
+
+uint64_t FxMemoryPools::getHeapFallbacks() const
+{
+	return messages.getStats().heapFallbacks
+			+ devices.getStats().heapFallbacks
+			+ deviceData.getStats().heapFallbacks;
+}
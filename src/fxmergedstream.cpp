@@ -0,0 +1,367 @@
+#include "fxmergedstream.h"
+
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+
+// a source that hasn't produced data for this long no longer holds back emission
+#define FX_MERGE_STALL_NS 100000000LL
+// bound on how much history is kept for a source, in samples
+#define FX_MERGE_MAX_HISTORY 4096
+// how often the log file is flushed
+#define FX_MERGE_FLUSH_NS 1000000000LL
+
+static int64_t steadyNowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FxMergedStream::History::init(size_t fields, size_t capacity)
+{
+	numFields = fields;
+	head = count = 0;
+	times.assign(capacity, 0);
+	values.assign(capacity * fields, 0);
+}
+
+int32_t* FxMergedStream::History::push(int64_t t)
+{
+	if(count == times.size())
+		dropFront(1);
+
+	size_t slot = (head + count++) % times.size();
+	times[slot] = t;
+	return &values[slot * numFields];
+}
+
+void FxMergedStream::History::dropFront(size_t k)
+{
+	if(k > count) k = count;
+	head = (head + k) % times.size();
+	count -= k;
+}
+
+FxMergedStream::FxMergedStream(FlexseaDeviceProvider *fdp, FxAsyncLogWriter *writer)
+	: devProvider(fdp)
+	, active(false)
+	, policy(FX_MERGE_LATEST)
+	, periodNs(0)
+	, nextBucketNs(0)
+	, ringRows(0)
+	, ringCols(0)
+	, rowsEmitted(0)
+	, logWriter(writer)
+	, logHandle(-1)
+	, lastFlushNs(0)
+{}
+
+FxMergedStream::~FxMergedStream()
+{
+	stop();
+}
+
+bool FxMergedStream::start(const std::vector<FxMergedColumn> &cols, int periodUs, FxMergePolicy pol,
+						   const std::string &logPath, size_t ringSize)
+{
+	std::lock_guard<std::mutex> slk(stateMutex);
+	stopLocked();
+
+	if(cols.empty() || periodUs < 1 || ringSize < 1) return false;
+
+	std::vector<Source> srcs;
+	for(size_t c = 0; c < cols.size(); ++c)
+	{
+		FxDevicePtr dev = devProvider->getDevicePtr(cols[c].devId);
+		if(!dev || cols[c].fieldId < 0 || cols[c].fieldId >= dev->numFields)
+			return false;
+
+		auto it = std::find_if(srcs.begin(), srcs.end(), [&](const Source &s){ return s.devId == dev->id; });
+		if(it == srcs.end())
+		{
+			std::lock_guard<std::recursive_mutex> lk(*dev->dataMutex);
+
+			Source s;
+			s.devId = dev->id;
+			s.dev = dev;
+			s.nextSeq = dev->getCircBuff()->nextSequence();
+			s.lastArrivalNs = steadyNowNs();
+			srcs.push_back(s);
+			it = srcs.end() - 1;
+		}
+
+		it->fieldIds.push_back(cols[c].fieldId);
+		it->colIdx.push_back(c);
+	}
+
+	for(auto &s : srcs)
+		s.history.init(s.fieldIds.size(), FX_MERGE_MAX_HISTORY);
+
+	columns = cols;
+	sources.swap(srcs);
+	policy = pol;
+	periodNs = (int64_t)periodUs * 1000;
+	nextBucketNs = 0;
+	rowScratch.assign(columns.size(), 0);
+
+	{
+		std::lock_guard<std::mutex> lk(ringMutex);
+		ringRows = ringSize;
+		ringCols = columns.size();
+		ringTimes.assign(ringRows, 0);
+		ringValues.assign(ringRows * columns.size(), 0);
+		rowsEmitted = 0;
+	}
+
+	if(!logPath.empty())
+	{
+		FxLogSinkConfig config = {FX_LOG_PLAIN, FX_LOG_STDIO, FX_LOG_DEFAULT_SEGMENT_SIZE};
+		logHandle = logWriter->openFile(logPath, config);
+		if(logHandle < 0)
+			return false;
+
+		std::string header = "host_time_ns";
+		for(auto &&l : labelsLocked())
+			header += ", " + l;
+		header += "\n";
+		logWriter->write(logHandle, std::move(header));
+		lastFlushNs = steadyNowNs();
+	}
+
+	active = true;
+	return true;
+}
+
+void FxMergedStream::stop()
+{
+	std::lock_guard<std::mutex> slk(stateMutex);
+	stopLocked();
+}
+
+void FxMergedStream::stopLocked()
+{
+	active = false;
+	sources.clear();
+	closeLog();
+}
+
+void FxMergedStream::closeLog()
+{
+	if(logHandle >= 0)
+		logWriter->closeFile(logHandle);
+
+	logHandle = -1;
+}
+
+std::vector<std::string> FxMergedStream::getColumnLabels() const
+{
+	std::lock_guard<std::mutex> slk(stateMutex);
+	return labelsLocked();
+}
+
+std::vector<std::string> FxMergedStream::labelsLocked() const
+{
+	std::vector<std::string> labels;
+	for(auto &&c : columns)
+	{
+		std::string label = std::to_string(c.devId) + "_";
+		FxDevicePtr dev = devProvider->getDevicePtr(c.devId);
+		if(dev)
+			label += dev->getAllFieldLabels().at(c.fieldId);
+		else
+			label += std::to_string(c.fieldId);
+
+		labels.push_back(label);
+	}
+	return labels;
+}
+
+void FxMergedStream::pull(Source &src, int64_t nowNs)
+{
+	FxDevicePtr dev = devProvider->getDevicePtr(src.devId);
+	if(!dev) return;
+
+	// removed and added again under the same id: its sequence numbers start over
+	if(src.dev.lock() != dev)
+	{
+		src.dev = dev;
+		src.nextSeq = 0;
+	}
+
+	std::lock_guard<std::recursive_mutex> lk(*dev->dataMutex);
+	FxDevData *cb = dev->getCircBuff();
+
+	size_t n = cb->count();
+	if(!n || cb->nextSequence() <= src.nextSeq) return;
+
+	// rows are contiguous in sequence number, so the first unconsumed row can be indexed directly
+	uint64_t firstSeq = cb->getInfo(0)->seq;
+	size_t i = src.nextSeq > firstSeq ? (size_t)(src.nextSeq - firstSeq) : 0;
+
+	for(; i < n; ++i)
+	{
+		const FxRowInfo *ri = cb->getInfo(i);
+		const int32_t *row = (const int32_t*)cb->peek(i);
+
+		int32_t *v = src.history.push(ri->alignedNs);
+		for(size_t f = 0; f < src.fieldIds.size(); ++f)
+			v[f] = row[1 + src.fieldIds[f]];
+	}
+
+	src.nextSeq = cb->nextSequence();
+	src.lastArrivalNs = nowNs;
+}
+
+void FxMergedStream::service()
+{
+	std::lock_guard<std::mutex> slk(stateMutex);
+	if(!active) return;
+
+	int64_t now = steadyNowNs();
+	for(auto &src : sources)
+		pull(src, now);
+
+	// a bucket can be emitted once every live source has data past it
+	bool haveWatermark = false, haveEarliest = false;
+	int64_t watermark = 0, earliest = 0;
+	for(auto &src : sources)
+	{
+		if(src.history.empty())
+		{
+			if(now - src.lastArrivalNs < FX_MERGE_STALL_NS)
+				return;		// still waiting on this source's first sample
+			continue;
+		}
+
+		if(!haveEarliest || src.history.t(0) < earliest)
+			earliest = src.history.t(0);
+		haveEarliest = true;
+
+		if(now - src.lastArrivalNs >= FX_MERGE_STALL_NS)
+			continue;		// stalled sources just hold their last value
+
+		int64_t latest = src.history.t(src.history.size() - 1);
+		if(!haveWatermark || latest < watermark)
+			watermark = latest;
+		haveWatermark = true;
+	}
+
+	if(!haveWatermark) return;
+
+	if(!nextBucketNs)
+		nextBucketNs = (earliest / periodNs + 1) * periodNs;
+
+	// after a long stall, skip ahead rather than emitting a burst of stale rows
+	if(watermark - nextBucketNs > (int64_t)ringRows * periodNs)
+		nextBucketNs = watermark - (watermark % periodNs);
+
+	if(logHandle >= 0)
+		logChunk = logWriter->takeBuffer();
+
+	while(nextBucketNs <= watermark)
+	{
+		emit(nextBucketNs);
+		nextBucketNs += periodNs;
+	}
+
+	if(logHandle >= 0)
+	{
+		if(!logChunk.empty())
+			logWriter->write(logHandle, std::move(logChunk));
+
+		if(now - lastFlushNs >= FX_MERGE_FLUSH_NS)
+		{
+			logWriter->flushFile(logHandle);
+			lastFlushNs = now;
+		}
+	}
+}
+
+void FxMergedStream::emit(int64_t t)
+{
+	for(auto &src : sources)
+	{
+		// no sample at or before t: the next one belongs to a later bucket
+		if(src.history.empty() || src.history.t(0) > t)
+		{
+			for(size_t f = 0; f < src.fieldIds.size(); ++f)
+				rowScratch[src.colIdx[f]] = FX_MERGE_MISSING;
+			continue;
+		}
+
+		// last sample at or before t
+		size_t k = 0;
+		while(k + 1 < src.history.size() && src.history.t(k + 1) <= t)
+			++k;
+
+		int64_t at = src.history.t(k);
+		const int32_t *av = src.history.v(k);
+		bool interpolate = policy == FX_MERGE_INTERPOLATE && k + 1 < src.history.size();
+
+		for(size_t f = 0; f < src.fieldIds.size(); ++f)
+		{
+			int32_t v = av[f];
+			if(interpolate)
+			{
+				int64_t bt = src.history.t(k + 1);
+				const int32_t *bv = src.history.v(k + 1);
+				double w = bt > at ? (double)(t - at) / (double)(bt - at) : 0.0;
+				v = (int32_t)(av[f] + w * ((double)bv[f] - av[f]));
+			}
+			rowScratch[src.colIdx[f]] = v;
+		}
+
+		// samples before k can no longer affect later buckets
+		src.history.dropFront(k);
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(ringMutex);
+		size_t slot = rowsEmitted % ringRows;
+		ringTimes[slot] = t;
+		std::copy(rowScratch.begin(), rowScratch.end(), ringValues.begin() + slot * ringCols);
+		rowsEmitted++;
+	}
+
+	if(logHandle >= 0)
+	{
+		// formatted on the stack, straight into the chunk recycled by the writer
+		char text[24];
+		int n = snprintf(text, sizeof(text), "%lld", (long long)t);
+		logChunk.append(text, n);
+		for(auto v : rowScratch)
+		{
+			logChunk += ", ";
+			if(v == FX_MERGE_MISSING) continue;
+			n = snprintf(text, sizeof(text), "%d", (int)v);
+			logChunk.append(text, n);
+		}
+		logChunk += "\n";
+	}
+}
+
+uint64_t FxMergedStream::getNextRowIndex() const
+{
+	std::lock_guard<std::mutex> lk(ringMutex);
+	return rowsEmitted;
+}
+
+size_t FxMergedStream::getRows(uint64_t fromRow, size_t maxRows, int64_t *times, int32_t *values) const
+{
+	std::lock_guard<std::mutex> lk(ringMutex);
+
+	if(!ringRows) return 0;
+
+	uint64_t oldest = rowsEmitted > ringRows ? rowsEmitted - ringRows : 0;
+	uint64_t r = std::max(fromRow, oldest);
+	size_t n = 0, nc = ringCols;
+
+	for(; r < rowsEmitted && n < maxRows; ++r, ++n)
+	{
+		size_t slot = r % ringRows;
+		times[n] = ringTimes[slot];
+		std::copy(ringValues.begin() + slot * nc, ringValues.begin() + (slot + 1) * nc, values + n * nc);
+	}
+
+	return n;
+}
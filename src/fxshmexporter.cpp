@@ -0,0 +1,248 @@
+#include "fxshmexporter.h"
+#include "fxdiag.h"
+
+FxShmExporter::FxShmExporter(FlexseaDeviceProvider *fdp)
+	: devProvider(fdp)
+	, active(false)
+	, numSlots(0)
+	, dir(nullptr)
+{}
+
+FxShmExporter::~FxShmExporter()
+{
+	stop();
+}
+
+#ifdef __linux__
+
+static void* createShm(const std::string &name, size_t size)
+{
+	shm_unlink(name.c_str());		// stale segment from a previous run
+
+	int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if(fd < 0) return nullptr;
+
+	void *p = MAP_FAILED;
+	if(ftruncate(fd, (off_t)size) == 0)
+		p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(p == MAP_FAILED)
+	{
+		shm_unlink(name.c_str());
+		return nullptr;
+	}
+	return p;		// ftruncate zero fills, so all atomics start at 0
+}
+
+bool FxShmExporter::start(const std::string &pfx, uint32_t slots)
+{
+	std::lock_guard<std::mutex> lk(stateMutex);
+	if(active || pfx.empty() || !slots) return false;
+
+	dir = (FxShmDirectory*)createShm("/" + pfx, sizeof(FxShmDirectory));
+	if(!dir)
+	{
+		FX_DIAG(FX_DIAG_ERROR, "Shared memory export: can't create /%s", pfx.c_str());
+		return false;
+	}
+
+	dir->magic = FX_SHM_MAGIC;
+	dir->version = FX_SHM_VERSION;
+
+	prefix = pfx;
+	numSlots = slots;
+	active = true;
+	return true;
+}
+
+void FxShmExporter::stop()
+{
+	std::lock_guard<std::mutex> lk(stateMutex);
+	if(!active) return;
+
+	for(auto &&s : segments)
+		releaseSegment(s.first, s.second);
+	segments.clear();
+
+	munmap(dir, sizeof(FxShmDirectory));
+	shm_unlink(("/" + prefix).c_str());
+	dir = nullptr;
+	active = false;
+}
+
+void FxShmExporter::service()
+{
+	std::lock_guard<std::mutex> lk(stateMutex);
+	if(!active) return;
+
+	FxRegistrySnapshot reg = devProvider->snapshot();
+	bool changed = false;
+
+	for(auto it = segments.begin(); it != segments.end(); )
+	{
+		if(reg->devices.count(it->first))
+		{
+			++it;
+			continue;
+		}
+
+		releaseSegment(it->first, it->second);
+		it = segments.erase(it);
+		changed = true;
+	}
+
+	for(auto &&id : reg->deviceIds)
+	{
+		FxDevicePtr dev = reg->find(id);
+		if(!dev) continue;
+
+		auto found = segments.find(id);
+		if(found == segments.end())
+		{
+			Segment seg;
+			if(segments.size() >= FX_SHM_MAX_DEVICES || !createSegment(dev, seg))
+				continue;
+
+			found = segments.insert({id, seg}).first;
+			changed = true;
+		}
+
+		exportRows(dev, found->second);
+	}
+
+	if(changed)
+		writeDirectory();
+}
+
+bool FxShmExporter::createSegment(const FxDevicePtr &dev, Segment &seg)
+{
+	int numColumns = dev->numFields + 1;
+	if(dev->numFields > FX_SHM_MAX_FIELDS) return false;
+
+	seg.size = fxShmDeviceSegmentSize(numColumns, numSlots);
+	seg.hdr = (FxShmDeviceHeader*)createShm(fxShmDeviceName(prefix, dev->id), seg.size);
+	if(!seg.hdr) return false;
+
+	FxShmDeviceHeader *h = seg.hdr;
+	h->magic = FX_SHM_MAGIC;
+	h->version = FX_SHM_VERSION;
+	h->devId = dev->id;
+	h->devType = (uint16_t)dev->type;
+	h->numColumns = (uint16_t)numColumns;
+	h->numSlots = numSlots;
+	h->slotSize = (uint32_t)fxShmSlotSize(numColumns);
+
+	// all labels are written once, they don't depend on the bitmap
+	char *p = h->labels, *end = h->labels + FX_SHM_LABELS_SIZE;
+	for(auto &&l : dev->getAllFieldLabels())
+	{
+		if(p + l.size() + 1 > end) break;
+		memcpy(p, l.c_str(), l.size() + 1);
+		p += l.size() + 1;
+	}
+
+	{
+		std::lock_guard<std::recursive_mutex> dlk(*dev->dataMutex);
+		seg.nextSeq = dev->getCircBuff()->nextSequence();
+	}
+
+	h->alive.store(1, std::memory_order_release);
+	return true;
+}
+
+void FxShmExporter::releaseSegment(int devId, Segment &seg)
+{
+	// readers that still have it mapped see the device as gone
+	seg.hdr->alive.store(0, std::memory_order_release);
+	munmap(seg.hdr, seg.size);
+	shm_unlink(fxShmDeviceName(prefix, devId).c_str());
+	seg.hdr = nullptr;
+}
+
+void FxShmExporter::writeSchema(Segment &seg, const std::vector<int> &fids)
+{
+	FxShmDeviceHeader *h = seg.hdr;
+	uint32_t g = h->schemaGeneration.load(std::memory_order_relaxed);
+
+	h->schemaGeneration.store(g + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	uint32_t n = 0;
+	for(auto &&f : fids)
+	{
+		if(n >= FX_SHM_MAX_FIELDS) break;
+		h->activeFieldIds[n++] = (uint16_t)f;
+	}
+	h->numActiveFields = n;
+
+	h->schemaGeneration.store(g + 2, std::memory_order_release);
+	seg.fieldIds = fids;
+}
+
+void FxShmExporter::exportRows(const FxDevicePtr &dev, Segment &seg)
+{
+	const std::vector<int> &fids = dev->getActiveFieldIds();
+	if(fids != seg.fieldIds || !seg.hdr->schemaGeneration.load(std::memory_order_relaxed))
+		writeSchema(seg, fids);
+
+	std::lock_guard<std::recursive_mutex> lk(*dev->dataMutex);
+	FxDevData *cb = dev->getCircBuff();
+
+	size_t n = cb->count();
+	if(!n || cb->nextSequence() <= seg.nextSeq) return;
+
+	// rows are contiguous in sequence number, so the first unexported row can be indexed directly
+	uint64_t firstSeq = cb->getInfo(0)->seq;
+	size_t i = seg.nextSeq > firstSeq ? (size_t)(seg.nextSeq - firstSeq) : 0;
+
+	FxShmDeviceHeader *h = seg.hdr;
+	char *slots = (char*)h + sizeof(FxShmDeviceHeader);
+	uint64_t w = h->writeCount.load(std::memory_order_relaxed);
+	size_t rowBytes = sizeof(uint32_t) * h->numColumns;
+
+	for(; i < n; ++i, ++w)
+	{
+		FxShmSlotHeader *slot = (FxShmSlotHeader*)(slots + (w % h->numSlots) * h->slotSize);
+		const FxRowInfo *ri = cb->getInfo(i);
+
+		slot->seq.store(2 * w + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		slot->deviceTs = ri->deviceTs;
+		slot->alignedNs = ri->alignedNs;
+		memcpy((char*)slot + sizeof(FxShmSlotHeader), cb->peek(i), rowBytes);
+
+		slot->seq.store(2 * w + 2, std::memory_order_release);
+	}
+
+	h->writeCount.store(w, std::memory_order_release);
+	seg.nextSeq = cb->nextSequence();
+}
+
+void FxShmExporter::writeDirectory()
+{
+	uint32_t g = dir->generation.load(std::memory_order_relaxed);
+	dir->generation.store(g + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	uint32_t n = 0;
+	for(auto &&s : segments)
+		dir->devIds[n++] = s.first;
+	dir->numDevices = n;
+
+	dir->generation.store(g + 2, std::memory_order_release);
+}
+
+#else
+
+bool FxShmExporter::start(const std::string &pfx, uint32_t slots)
+{
+	(void)pfx; (void)slots;
+	return false;
+}
+
+void FxShmExporter::stop() {}
+void FxShmExporter::service() {}
+
+#endif
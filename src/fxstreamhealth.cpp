@@ -0,0 +1,86 @@
+#include "fxstreamhealth.h"
+
+#include <cmath>
+#include <chrono>
+
+static int64_t steadyNowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FxRateMeter::FxRateMeter()
+	: started(false)
+	, nextSeq(0)
+	, windowStartNs(0)
+	, lastRowNs(0)
+	, rows(0)
+	, intervals(0)
+	, sum(0)
+	, sumSq(0)
+{}
+
+bool FxRateMeter::update(const FxDevicePtr &dev, int windowMs, float *rateHz, float *jitterUs)
+{
+	int64_t now = steadyNowNs();
+
+	{
+		std::lock_guard<std::recursive_mutex> lk(*dev->dataMutex);
+		FxDevData *cb = dev->getCircBuff();
+
+		uint64_t end = cb->nextSequence();
+		if(!started || device.lock() != dev || end < nextSeq)
+		{
+			// only rows received from now on are measured
+			started = true;
+			device = dev;
+			nextSeq = end;
+			windowStartNs = now;
+			lastRowNs = 0;
+			rows = intervals = 0;
+			sum = sumSq = 0;
+			return false;
+		}
+
+		size_t n = cb->count();
+		if(end > nextSeq && n)
+		{
+			rows += end - nextSeq;
+
+			uint64_t firstSeq = cb->getInfo(0)->seq;
+			size_t i = nextSeq > firstSeq ? (size_t)(nextSeq - firstSeq) : 0;
+			for(; i < n; ++i)
+			{
+				// rows are read in batches, their receive times say more about the polling than the stream
+				int64_t t = cb->getInfo(i)->alignedNs;
+				if(lastRowNs && t > lastRowNs)
+				{
+					double dt = (double)(t - lastRowNs);
+					sum += dt;
+					sumSq += dt * dt;
+					intervals++;
+				}
+				lastRowNs = t;
+			}
+		}
+		nextSeq = end;
+	}
+
+	int64_t elapsed = now - windowStartNs;
+	if(elapsed < (int64_t)windowMs * 1000000) return false;
+
+	*rateHz = (float)(rows * 1e9 / elapsed);
+
+	double var = 0;
+	if(intervals > 1)
+	{
+		double mean = sum / intervals;
+		var = sumSq / intervals - mean * mean;
+	}
+	*jitterUs = (float)(var > 0 ? std::sqrt(var) / 1000 : 0);
+
+	windowStartNs = now;
+	rows = intervals = 0;
+	sum = sumSq = 0;
+	return true;
+}
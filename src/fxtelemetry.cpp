@@ -0,0 +1,253 @@
+#include "fxtelemetry.h"
+#include "fxlogformat.h"
+#include "fxdiag.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+// how much unsent data a client may accumulate before batches are dropped for it
+#define FX_TELEMETRY_MAX_BACKLOG (4 << 20)
+
+FxTelemetryPublisher::FxTelemetryPublisher(FlexseaDeviceProvider *fdp)
+	: devProvider(fdp)
+	, listenFd(-1)
+	, numClients(0)
+	, droppedBatches(0)
+{}
+
+FxTelemetryPublisher::~FxTelemetryPublisher()
+{
+	stop();
+}
+
+bool FxTelemetryPublisher::start(const std::string &socketPath, unsigned int periodMs)
+{
+#ifdef __linux__
+	std::lock_guard<std::mutex> lk(startMutex);
+	if(listenFd >= 0) return false;
+
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(socketPath.empty() || socketPath.size() >= sizeof(addr.sun_path)) return false;
+	strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd < 0) return false;
+
+	unlink(socketPath.c_str());
+	if(bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0)
+	{
+		FX_DIAG(FX_DIAG_ERROR, "Telemetry: can't listen on %s: %s", socketPath.c_str(), strerror(errno));
+		::close(fd);
+		return false;
+	}
+
+	path = socketPath;
+	listenFd = fd;
+	taskPeriod = periodMs ? periodMs : 1;
+	worker = std::thread(&FxTelemetryPublisher::runPeriodicTask, this);
+
+	// runPeriodicTask raises runPeriodicThread itself, wait for it so an early stop() isn't lost
+	while(true)
+	{
+		{
+			std::lock_guard<std::mutex> clk(conditionMutex);
+			if(runPeriodicThread) break;
+		}
+		std::this_thread::yield();
+	}
+	return true;
+#else
+	(void)socketPath; (void)periodMs;
+	return false;
+#endif
+}
+
+void FxTelemetryPublisher::stop()
+{
+#ifdef __linux__
+	std::lock_guard<std::mutex> lk(startMutex);
+	if(listenFd < 0) return;
+
+	quitPeriodicTask();
+	if(worker.joinable())
+		worker.join();
+
+	for(auto &c : clients)
+		::close(c.fd);
+	clients.clear();
+	sources.clear();
+	numClients = 0;
+
+	::close(listenFd);
+	listenFd = -1;
+	unlink(path.c_str());
+#endif
+}
+
+void FxTelemetryPublisher::periodicTask()
+{
+	acceptClients();
+
+	// track devices even with no clients, so a new client starts from fresh data rather than history
+	std::string batch;
+	collect(batch);
+
+	std::string schemas;
+	for(auto &c : clients)
+	{
+		if(c.backlog.size() + batch.size() > FX_TELEMETRY_MAX_BACKLOG)
+		{
+			// drop the whole batch (never part of a block), it may have held a schema change
+			// so the client gets all schemas again once it catches up
+			droppedBatches++;
+			c.needsSchemas = true;
+			send(c, std::string());
+			continue;
+		}
+
+		if(c.needsSchemas)
+		{
+			if(schemas.empty())
+			{
+				for(auto &&s : sources)
+					schemas += s.second.schema;
+			}
+
+			c.needsSchemas = false;
+			send(c, schemas);
+		}
+
+		send(c, batch);
+	}
+
+	clients.erase(std::remove_if(clients.begin(), clients.end(), [](const Client &c){ return c.fd < 0; }),
+				  clients.end());
+	numClients = clients.size();
+}
+
+void FxTelemetryPublisher::acceptClients()
+{
+#ifdef __linux__
+	int fd;
+	while((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+		clients.push_back({fd, std::string(), true});
+#endif
+}
+
+void FxTelemetryPublisher::collect(std::string &batch)
+{
+	FxRegistrySnapshot reg = devProvider->snapshot();
+
+	// removed devices
+	for(auto it = sources.begin(); it != sources.end(); )
+	{
+		if(reg->devices.count(it->first))
+		{
+			++it;
+			continue;
+		}
+
+		fxLogAppendSchema(batch, it->first, 0, std::vector<FxLogColumn>());
+		it = sources.erase(it);
+	}
+
+	for(auto &&id : reg->deviceIds)
+	{
+		FxDevicePtr dev = reg->find(id);
+		if(!dev) continue;
+
+		const std::vector<int> &fids = dev->getActiveFieldIds();
+
+		std::lock_guard<std::recursive_mutex> lk(*dev->dataMutex);
+		FxDevData *cb = dev->getCircBuff();
+
+		auto found = sources.find(id);
+		if(found == sources.end())
+			found = sources.insert({id, {cb->nextSequence(), std::vector<int>(), std::string()}}).first;
+		Source &src = found->second;
+
+		if(src.fieldIds != fids || src.schema.empty())
+		{
+			const std::vector<std::string> &labels = dev->getActiveFieldLabels();
+			std::vector<FxLogColumn> columns;
+			for(size_t i = 0; i < fids.size() && i < labels.size(); ++i)
+				columns.push_back({fids.at(i), labels.at(i)});
+
+			src.fieldIds = fids;
+			src.schema.clear();
+			fxLogAppendSchema(src.schema, id, dev->type, columns);
+			batch += src.schema;
+		}
+
+		size_t n = cb->count();
+		if(!n || cb->nextSequence() <= src.nextSeq || fids.empty())
+		{
+			src.nextSeq = cb->nextSequence();
+			continue;
+		}
+
+		// rows are contiguous in sequence number, so the first unsent row can be indexed directly
+		uint64_t firstSeq = cb->getInfo(0)->seq;
+		size_t i = src.nextSeq > firstSeq ? (size_t)(src.nextSeq - firstSeq) : 0;
+
+		FxLogDataBlock block(fids.size());
+		for(; i < n; ++i)
+		{
+			const int32_t *row = (const int32_t*)cb->peek(i);
+			block.beginRow((uint32_t)row[0]);
+			for(auto &&f : fids)
+				block.add(row[1 + f]);
+		}
+		block.appendTo(batch, id);
+
+		src.nextSeq = cb->nextSequence();
+	}
+}
+
+void FxTelemetryPublisher::send(Client &c, const std::string &data)
+{
+#ifdef __linux__
+	if(c.fd < 0) return;
+
+	c.backlog += data;
+	while(!c.backlog.empty())
+	{
+		ssize_t n = ::send(c.fd, c.backlog.data(), c.backlog.size(), MSG_NOSIGNAL);
+		if(n > 0)
+		{
+			c.backlog.erase(0, n);
+			continue;
+		}
+
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;		// socket full, keep the rest for next time
+		if(n < 0 && errno == EINTR)
+			continue;
+
+		closeClient(c);
+		return;
+	}
+#else
+	(void)c; (void)data;
+#endif
+}
+
+void FxTelemetryPublisher::closeClient(Client &c)
+{
+#ifdef __linux__
+	if(c.fd >= 0)
+		::close(c.fd);
+#endif
+	c.fd = -1;
+	c.backlog.clear();
+}
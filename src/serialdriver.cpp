@@ -1,6 +1,6 @@
 #include "serialdriver.h"
+#include "fxdiag.h"
 
-#include <iostream>
 
 #define CHECK_PORTIDX(idx) do { if(idx >= _NUMPORTS) throw std::out_of_range("Port Index outside of range"); } while(0)
 #define LOCK_MTX(idx) std::lock_guard<std::mutex> lk(serialMutexes[idx])
@@ -66,6 +66,8 @@ bool SerialDriver::tryOpen(const std::string &portName, uint16_t portIdx) {
         s->setParity(serial::parity_none);
         s->setStopbits(serial::stopbits_one);
         s->setFlowcontrol(serial::flowcontrol_none);
+        // reads only ask for bytes already available, only writes need a bound
+        s->setTimeout(serial::Timeout(serial::Timeout::max(), 0, 0, FX_SERIAL_WRITE_TIMEOUT_MS, 0));
 
 //#ifdef __WIN32
 #if defined(__WIN32) || defined(__WIN64)
@@ -81,7 +83,7 @@ bool SerialDriver::tryOpen(const std::string &portName, uint16_t portIdx) {
     {
         std::lock_guard<std::mutex> lk(_portCountMutex);
         openPorts++;
-        std::cout << "Port " << portIdx << " opened" << std::endl;
+        FX_DIAG(FX_DIAG_INFO, "Port %d opened", portIdx);
     }
 
     return isOpen;
@@ -128,8 +130,8 @@ size_t SerialDriver::bytesAvailable(int portIdx) const
         // semantically this function is still const in that if the serial port errors on calling available
         // it is effectively already "closed"
         // here we just do the book keeping...
-        ((SerialDriver*)this)->tryClose(portIdx);   // should update state so that isOpen(...) returns false
-        ((SerialDriver*)this)->close(portIdx);      // allow derived classes to handle port closing stuff
+        // by default closes the port, derived classes may also try to recover it
+        ((SerialDriver*)this)->portLost(portIdx);
     }
 
     return 0;
@@ -155,33 +157,36 @@ void SerialDriver::tryClose(uint16_t portIdx) {
 
     if(!ports[portIdx].isOpen() && isPortOpen[portIdx])
     {
-        std::cout << "Closed port " << portIdx << "." << std::endl;
+        FX_DIAG(FX_DIAG_INFO, "Closed port %d.", portIdx);
         std::lock_guard<std::mutex> lk(_portCountMutex);
         openPorts--;
     }
 }
 
-void SerialDriver::write(uint8_t bytes_to_send, uint8_t *serial_tx_data, uint16_t portIdx)
+bool SerialDriver::write(uint8_t bytes_to_send, uint8_t *serial_tx_data, uint16_t portIdx)
 {
     CHECK_PORTIDX(portIdx);
     LOCK_MTX(portIdx);
 
-    bool success = false;
+    bool success = false, complete = false;
 
     if(ports[portIdx].isOpen())
     {
         try {
-            ports[portIdx].write(serial_tx_data, bytes_to_send);
+            complete = ports[portIdx].write(serial_tx_data, bytes_to_send) == bytes_to_send;
             success = true;
         } catch (serial::IOException e) {
-            std::cout << "IO Exception:  " << e.what() << std::endl;
+            FX_DIAG(FX_DIAG_ERROR, "IO Exception:  %s", e.what());
         } catch (serial::SerialException e) {
-            std::cout << "Serial Exception:  " << e.what() << std::endl;
+            FX_DIAG(FX_DIAG_ERROR, "Serial Exception:  %s", e.what());
         }
     }
 
     if(!success && ports[portIdx].isOpen())
         ports[portIdx].close();
+
+    // a timed out write leaves the port open, the device may just be slow to start reading
+    return success && complete;
 }
 
 void SerialDriver::flush(uint16_t portIdx)
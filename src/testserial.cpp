@@ -7,15 +7,25 @@
 #include <iostream>
 #include <assert.h>
 #include <cstring>
+#include <algorithm>
 #include "flexsea_device_spec.h"
 #include "flexsea_sys_def.h"
 #include "flexseadevicetypes.h"
 #include "flexsea_multi_frame_packet_def.h"
+#include "flexsea_comm_multi.h"
 #include "testserial.h"
 
+extern "C" {
+    #include "flexsea_dataformats.h"
+}
+
 
 TestSerial::TestSerial() : notQuit(1), runVerbose(0)
-{ srand(time(0)); }
+{
+    srand(time(0));
+    memset(&packedOut, 0, sizeof(packedOut));
+    packedDevices.reserve(FX_DEFAULT_MAX_DEVICES);
+}
 
 void TestSerial::runTestSim1()
 {
@@ -100,6 +110,42 @@ void TestSerial::tryClose(uint16_t portIdx)
     }
 }
 
+bool TestSerial::addSimulatedDevice(int id, FlexseaDeviceType type, int port)
+{
+    if(this->addDevice(id, port, type))
+        return false;
+
+    FxDevicePtr dev = getDevicePtr(id);
+    uint32_t map[FX_BITMAP_WIDTH];
+    memset(map, 0, FX_BITMAP_WIDTH*sizeof(uint32_t));
+    for(int f = 0; f < dev->numFields && f < 32*FX_BITMAP_WIDTH; f++)
+        SET_FIELD_HIGH(f, map);
+
+    writeDeviceMap(dev, map);
+    return true;
+}
+
+int TestSerial::addPackedDevice(int shortId, FlexseaDeviceType type, int port)
+{
+    if(type >= NUM_DEVICE_TYPES || !deviceSpecs[type].fieldTypes)
+        return -1;
+
+    // the id the receive path looks the device up by
+    int id = (shortId << 6) | port;
+    if(this->addDevice(id, shortId, port, type, FLEXSEA_MANAGE_1))
+        return -1;
+
+    FxDevicePtr dev = getDevicePtr(id);
+    uint32_t map[FX_BITMAP_WIDTH];
+    memset(map, 0, FX_BITMAP_WIDTH*sizeof(uint32_t));
+    for(int f = 0; f < dev->numFields && f < 32*FX_BITMAP_WIDTH; f++)
+        SET_FIELD_HIGH(f, map);
+
+    writeDeviceMap(dev, map);
+    packedDevices.push_back(id);
+    return id;
+}
+
 int doesRidMatchType(int rid, int type)
 {
     if((rid & FLEXSEA_MANAGE_BASE) && (type == FX_MANAGE || type == FX_RIGID))
@@ -110,24 +156,29 @@ int doesRidMatchType(int rid, int type)
     return false;
 }
 
-void TestSerial::write(uint8_t bytes_to_send, uint8_t *serial_tx_data, uint16_t portIdx)
+bool TestSerial::write(uint8_t bytes_to_send, uint8_t *serial_tx_data, uint16_t portIdx)
 {
     (void)bytes_to_send;
     (void)portIdx;
     static uint32_t timestamp = 0;
     timestamp++;
 
-    for(auto &x : connectedDevices)
+    FxRegistrySnapshot reg = snapshot();
+    for(auto &x : reg->devices)
     {
-        if(x.second->id == serial_tx_data[MULTI_DATA_OFFSET + MP_RID]) //portIdx && doesRidMatchType(rid, x.second.type))
+        if(x.second->getShortId() == serial_tx_data[MULTI_DATA_OFFSET + MP_RID]) //portIdx && doesRidMatchType(rid, x.second.type))
         {
             //we found our device
-            testReceiveDataFromDevice(x.second->id, timestamp);
-            return;
+            if(std::find(packedDevices.begin(), packedDevices.end(), x.second->id) != packedDevices.end())
+                receivePackedRow(*x.second, timestamp);
+            else
+                testReceiveDataFromDevice(x.second->id, timestamp);
+            return true;
         }
     }
 
     std::cout << "TestSerial::write failed to match the message to a connected device" << std::endl;
+    return false;
 }
 
 void TestSerial::writeDevice(uint8_t bytes_to_send, uint8_t *serial_tx_data, const FlexseaDevice &d)
@@ -145,10 +196,15 @@ void TestSerial::writeDevice(uint8_t bytes_to_send, uint8_t *serial_tx_data, con
     testReceiveDataFromDevice(d.id, timestamp);
 }
 
-int TestSerial::writeDeviceMap(const FxDevicePtr d, uint32_t *map)
+int TestSerial::writeDeviceMap(const FxDevicePtr d, uint32_t *map, const FxCommandStatePtr &completion)
 {
+    if(completion)
+        completion->resolve(FX_CMD_SENT);
+
     d->setBitmap(map);
     mapChangedFlags.notify();
+    events.post(FX_EVENT_BITMAP_CHANGED, d->id);
+    deviceMetadataReceived(d->id);
     return 0;
 }
 
@@ -203,7 +259,7 @@ void TestSerial::randomConnections()
         }
     }
 
-    while(deviceIds.size())
+    while(getDeviceIds().size())
     {
         std::cout << TAB << "Disconnecting Device..." <<std::endl;
         testDisconnectDevice();
@@ -211,8 +267,8 @@ void TestSerial::randomConnections()
             std::this_thread::sleep_for(std::chrono::seconds(2));
     }
 
-    assert(deviceIds.size() == 0);
-    assert(connectedDevices.empty());
+    assert(snapshot()->deviceIds.size() == 0);
+    assert(snapshot()->devices.empty());
 }
 
 void TestSerial::randomDeviceMapChanges()
@@ -226,10 +282,11 @@ void TestSerial::randomDeviceMapChanges()
     bool existsNonTrivialDevice = false;
     size_t idx;
     int id;
-    for(idx=0;idx<deviceIds.size();idx++)
+    FxRegistrySnapshot reg = snapshot();
+    for(idx=0;idx<reg->deviceIds.size();idx++)
     {
-        id = deviceIds.at(idx);
-        if(connectedDevices.at(id)->numFields > 0)
+        id = reg->deviceIds.at(idx);
+        if(reg->devices.at(id)->numFields > 0)
         {
             existsNonTrivialDevice = true;
             break;
@@ -242,7 +299,7 @@ void TestSerial::randomDeviceMapChanges()
     }
 
     if(runVerbose)
-        printDeviceMaps(this->deviceIds, this->connectedDevices);
+        printDeviceMaps(*snapshot());
 
     for(int i=0; i<NUM_RAND_CHANGES && notQuit; i++)
     {
@@ -255,7 +312,7 @@ void TestSerial::randomDeviceMapChanges()
             testChangeDeviceMap();
 
         if(runVerbose)
-            printDeviceMaps(this->deviceIds, this->connectedDevices);
+            printDeviceMaps(*snapshot());
     }
 
     std::cout << TAB << "Disconnecting " << NUM_DEVICES << " Devices..." <<std::endl;
@@ -300,12 +357,7 @@ void TestSerial::testConnectDevice(int port)
     while(!unique)
     {
         id = rand() % 255 + 1;
-        unique = 1;
-        for(std::vector<int>::iterator it = deviceIds.begin(); it != deviceIds.end(); ++it)
-        {
-            if((*it) == id)
-                unique = 0;
-        }
+        unique = !haveDevice(id);
     }
 
     // select a port
@@ -338,12 +390,14 @@ void TestSerial::testConnectDevice(int port)
             map[0] = (rand() % (int)(pow(2, dev->numFields) - 1));
             dev->setBitmap(map);
             mapChangedFlags.notify();
+            events.post(FX_EVENT_BITMAP_CHANGED, id);
         }
     }
 }
 
 void TestSerial::testDisconnectDevice(int id)
 {
+    std::vector<int> deviceIds = getDeviceIds();
     if(!deviceIds.size()) return;
 
     if(id < 0)
@@ -361,17 +415,18 @@ void TestSerial::testDisconnectDevice(int id)
 
 void TestSerial::testChangeDeviceMap()
 {
-    if(!deviceIds.size()) return;
+    FxRegistrySnapshot reg = snapshot();
+    if(!reg->deviceIds.size()) return;
 
     //select a random device with a non trivial map
     int idx, id;
     do {
-        idx = rand() % deviceIds.size();
-        id = deviceIds.at(idx);
-    } while(connectedDevices.at(id)->numFields == 0);
+        idx = rand() % reg->deviceIds.size();
+        id = reg->deviceIds.at(idx);
+    } while(reg->devices.at(id)->numFields == 0);
 
     // get their map
-    FxDevicePtr dev = connectedDevices.at(id);
+    FxDevicePtr dev = reg->devices.at(id);
 
     // figure out how many fields the device actually has
     int numFields = dev->numFields;
@@ -385,6 +440,7 @@ void TestSerial::testChangeDeviceMap()
         dev->setBitmap(map);
         //Notify device connected
         mapChangedFlags.notify();
+        events.post(FX_EVENT_BITMAP_CHANGED, id);
     }
 }
 
@@ -402,6 +458,7 @@ void TestSerial::testReceiveData()
     static uint32_t timestamp = 0;
     timestamp++;
 
+    std::vector<int> deviceIds = getDeviceIds();
     for(unsigned int i=0;i<deviceIds.size();i++)
     {
         // get the device
@@ -413,7 +470,8 @@ void TestSerial::testReceiveData()
 
 void TestSerial::testReceiveDataFromDevice(int id, uint32_t timestamp)
 {
-    FxDevicePtr d = connectedDevices.at(id);
+    FxDevicePtr d = getDevicePtr(id);
+    if(!d) return;
     double x = (double)timestamp * (double)(2 * M_PI / 1000); // 1 cycle per 10 second about
 
     //if the device has no fields we can skip it
@@ -423,13 +481,8 @@ void TestSerial::testReceiveDataFromDevice(int id, uint32_t timestamp)
     //lock the mutex before accessing data buffer
     std::lock_guard<std::recursive_mutex> lk(*(d->dataMutex));
 
-    //get the data buffer for this device
-    FxDevData *cb = d->getCircBuff();
-    if(!cb) return;
-
-    FX_DataPtr dataptr = cb->getWrite();
-
-    dataptr[0] = timestamp;
+    //append a row to the device's data buffer
+    FX_DataPtr dataptr = d->writeRow(timestamp);
     dataptr[1] = d->type;
     dataptr[2] = d->id;
     if(d->numFields > 2) dataptr[3] = (sin(x) + 1)*1000;
@@ -443,6 +496,48 @@ void TestSerial::testReceiveDataFromDevice(int id, uint32_t timestamp)
         printData(d->id, d->numFields, dataptr);
 }
 
+void TestSerial::receivePackedRow(const FlexseaDevice &d, uint32_t timestamp)
+{
+    const FlexseaDeviceSpec &ds = deviceSpecs[d.type];
+    uint32_t bitmap[FX_BITMAP_WIDTH];
+    d.getBitmap(bitmap);
+
+    // payload of a sysdata reply: not metadata, then the active fields in their wire format
+    MultiWrapper *out = &packedOut;
+    uint8_t *payload = out->unpacked + MP_DATA1;
+    uint16_t n = 0;
+    payload[n++] = 0;
+    for(int j = 0; j < ds.numFields; j++)
+    {
+        if(!IS_FIELD_HIGH(j, bitmap)) continue;
+
+        int32_t v = (int32_t)(timestamp * (j + 1));
+        uint8_t fw = FORMAT_SIZE_MAP[ds.fieldTypes[j]];
+        memcpy(payload + n, &v, fw);
+        n += fw;
+    }
+
+    out->unpackedIdx = n;
+    setMsgInfo(out->unpacked, d.getShortId(), FLEXSEA_PLAN_1, CMD_SYSDATA, RX_PTYPE_REPLY, timestamp);
+    out->unpackedIdx += MULTI_PACKET_OVERHEAD;
+    out->currentMultiPacket = (out->currentMultiPacket + 1) % 4;
+
+    if(packMultiPacket(out))
+    {
+        std::cout << "TestSerial: couldn't pack a reply from device " << d.id << std::endl;
+        return;
+    }
+
+    unsigned int frameId = 0;
+    while(out->frameMap > 0)
+    {
+        if(out->frameMap & (1 << frameId))
+            receiveBytes(d.port, out->packed[frameId], PACKET_WRAPPER_LEN);
+        out->frameMap &= ~(1 << frameId);
+        frameId++;
+    }
+}
+
 void TestSerial::printBitMap(const uint32_t* map, int numFields)
 {
     if(numFields < 0 || !map) return;
@@ -453,10 +548,10 @@ void TestSerial::printBitMap(const uint32_t* map, int numFields)
     }
 }
 
-void TestSerial::printDeviceMaps(
-        const std::vector<int>& deviceIds,
-        const std::unordered_map<int, FxDevicePtr> &connectedDevices)
+void TestSerial::printDeviceMaps(const FxDeviceRegistry &reg)
 {
+    const std::vector<int>& deviceIds = reg.deviceIds;
+    const std::unordered_map<int, FxDevicePtr> &connectedDevices = reg.devices;
     int id, nf;
     unsigned int i;
     std::cout << TAB << "Devices {id, numfields, map}: [ ";
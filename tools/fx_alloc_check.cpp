@@ -0,0 +1,18 @@
+// Fails (non zero exit) if steady state streaming allocates, run by ctest when built with FX_ALLOC_CHECK
+
+#include "com_wrapper.h"
+
+#include <cstdint>
+#include <iostream>
+
+int main()
+{
+	int64_t allocations = fxRunAllocationCheck(4, 500, 2000);
+	if(allocations < 0)
+	{
+		std::cout << "The allocation check could not run" << std::endl;
+		return 2;
+	}
+
+	return allocations ? 1 : 0;
+}